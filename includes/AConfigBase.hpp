@@ -26,9 +26,52 @@ enum ConfigBlock {
 	HTTP,
 	SERVER,
 	LOCATION,
+	UPSTREAM,
 	ERROR
 };
 
+struct LocationConfig;
+
+// bits of EffectiveLocation::_methods
+# define METHOD_GET		1
+# define METHOD_POST	2
+# define METHOD_DELETE	4
+
+/*
+	What a block inherits from its parents, resolved once after parsing
+	(ParserUtils::compile_effective) so requests don't walk back_ref.
+*/
+struct EffectiveLocation {
+	unsigned int				_methods;				// allowed here or in a parent location
+	long long					_client_max_body_size;	// closest one set, <= 0 = unlimited
+	STR							_root;					// closest one set
+	VECTOR<VECTOR<STR> >		_index_levels;			// index lists, closest block first
+	MAP<int, VECTOR<STR> >		_error_pages;			// code -> pages to try, closest block first
+	MAP<int, const STR*>		_error_responses;		// code -> response of the first readable page, see HttpConfig::_error_documents
+	int							_return_code;			// -1 = no redirect
+	STR							_return_url;
+	LocationConfig				*_limit_req_zone;		// closest location with limit_req
+
+	EffectiveLocation() :
+		_methods(0),
+		_client_max_body_size(-1),
+		_root(""),
+		_return_code(-1),
+		_return_url(""),
+		_limit_req_zone(NULL)
+	{}
+
+	static unsigned int	methodBit(const STR &method) {
+		if (method == "GET")
+			return METHOD_GET;
+		if (method == "POST")
+			return METHOD_POST;
+		if (method == "DELETE")
+			return METHOD_DELETE;
+		return 0;
+	}
+};
+
 struct AConfigBase {
 	STR					_add_header;
 	STR					_root;
@@ -37,6 +80,7 @@ struct AConfigBase {
 	MAP<int, STR>		_error_pages;
 
 	AConfigBase			*back_ref;
+	EffectiveLocation	*_effective;
 
 	virtual void		_self_destruct() = 0;
 	static	ConfigBlock	_identify(AConfigBase *elem);
@@ -47,7 +91,8 @@ struct AConfigBase {
         _client_max_body_size(-1),
         _index(),
         _error_pages(),
-        back_ref(NULL)
+        back_ref(NULL),
+        _effective(NULL)
     {
 		_error_pages[400] = "default_errors/400.html";
 		_error_pages[401] = "default_errors/401.html";
@@ -64,7 +109,7 @@ struct AConfigBase {
 		_error_pages[504] = "default_errors/504.html";
 	}
 
-	virtual ~AConfigBase() {}
+	virtual ~AConfigBase() { delete _effective; }
 };
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef ACCESSLOG_HPP
+#define ACCESSLOG_HPP
+
+#include <ctime>
+#include "HttpConfig.hpp"
+
+// nginx's predefined format, used when access_log names none
+# define ACCESS_LOG_COMBINED "$remote_addr - - [$time_local] \"$request\" $status $body_bytes_sent " \
+	"\"$http_referer\" \"$http_user_agent\""
+
+class Request;
+
+// what the format variables of one finished request are taken from
+struct AccessLogEntry {
+	const Request	*request;
+	STR				remote_addr;
+	int				remote_port;
+	int				status;
+	long long		bytes_sent;			// whole response, headers included
+	long long		body_bytes_sent;
+	long long		request_time_us;	// first request byte to last response byte
+};
+
+/*
+	access_log: one line per finished request, rendered with a log_format
+	compiled once at startup. Lines collect in a ring buffer and reach the
+	file in one writev when the buffer is full, when the oldest line is
+	flush= seconds old, on reload and on shutdown. SIGUSR1 reopens the file
+	for log rotation.
+*/
+class AccessLog {
+	public:
+		struct Segment {
+			int	variable;	// -1 for literal text
+			STR	text;		// literal text, or the header name of $http_*
+		};
+
+		static bool	compile(const STR &format, VECTOR<Segment> &segments);
+		static void	init(HttpConfig *config);
+		static void	log(const AccessLogEntry &entry);
+		static void	tick(long long now_ms);
+		static void	flush();
+		static void	reopen();
+
+	private:
+		static void	append(const STR &line);
+		static void	open();
+		static void	close();
+		static STR	headerValue(const Request &request, const STR &name);
+
+		static STR				_path;				// "" = off
+		static int				_fd;
+		static VECTOR<Segment>	_segments;
+		static VECTOR<char>		_ring;
+		static size_t			_head;				// first unwritten byte
+		static size_t			_used;
+		static int				_flush_ms;
+		static long long		_oldest_ms;			// when the oldest buffered line was added
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+// chunk sizes handed out, smallest first
+# define BUFFER_POOL_CLASSES 3
+// bytes of returned chunks kept per size class, the rest goes back to the allocator
+# define BUFFER_POOL_KEEP (4 * 1024 * 1024)
+
+/*
+	Fixed-size chunks of 4, 16 and 64 KB for connection output. A chunk goes
+	back to the free list of its size when the connection is done with it,
+	so steady traffic reuses the same memory instead of growing and freeing
+	strings per request.
+*/
+class BufferPool {
+	public:
+		static char		*acquire(size_t wanted, size_t &size);
+		static void		release(char *chunk, size_t size);
+		static void		purge();
+		static size_t	usedBytes();
+		static size_t	freeBytes();
+		static size_t	largest();
+
+	private:
+		static const size_t			_sizes[BUFFER_POOL_CLASSES];
+		static std::vector<char*>	_free[BUFFER_POOL_CLASSES];
+		static size_t				_used;
+
+		static int		sizeClass(size_t size);
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <ctime>
+#include "AConfigBase.hpp"
+
+// Server response header
+# define SERVER_SOFTWARE "webserv"
+
+/*
+	Wall clock of the event loop, read once per iteration by tick(). The
+	strings built from it (the Date header, the error_log and access_log
+	timestamps) are formatted only when the second changes. Before the
+	first tick, the system clock is read.
+*/
+class Clock {
+	public:
+		static void			tick();
+		static time_t		now();
+		static const STR	&httpDate();
+		static STR			httpDate(time_t time);
+		static const STR	&logTime();
+		static const STR	&timeLocal();
+		static const STR	&timeIso8601();
+
+	private:
+		static time_t		_now;		// 0 = no loop yet
+		static time_t		_formatted;	// second the strings below belong to
+		static STR			_http_date;
+		static STR			_log_time;
+		static STR			_time_local;
+		static STR			_time_iso8601;
+
+		static void			update();
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef CONFIGGENERATION_HPP
+#define CONFIGGENERATION_HPP
+
+#include "HttpConfig.hpp"
+#include "Listener.hpp"
+
+/*
+	One loaded configuration and the listeners built from it. The server holds
+	a reference to the current generation and every accepted connection holds
+	one to the generation it was accepted under, which it keeps using until it
+	closes. A reload makes a new generation current; the old one is freed once
+	its last connection is gone.
+*/
+class ConfigGeneration {
+	public:
+		ConfigGeneration(HttpConfig *config, int number);
+
+		void							retain();
+		void							release();
+
+		HttpConfig						*config() const;
+		int								number() const;
+		std::map<ListenKey, Listener*>	&listeners();
+
+	private:
+		HttpConfig						*_config;
+		int								_number;
+		int								_refs;
+		std::map<ListenKey, Listener*>	_listeners;	// (address, port) -> servers reachable through it
+
+		~ConfigGeneration();
+		static void	forgetLocations(MAP<STR, LocationConfig*> &locations);
+
+		ConfigGeneration(const ConfigGeneration &obj);
+		ConfigGeneration	&operator=(const ConfigGeneration &obj);
+};
+
+#endif
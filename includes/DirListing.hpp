@@ -0,0 +1,95 @@
+#ifndef DIRLISTING_HPP
+#define DIRLISTING_HPP
+
+#include <ctime>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "AConfigBase.hpp"
+
+// directories whose entries stay in memory between requests
+# define DIR_LISTING_CACHE 16
+// entries kept across all of them, least recently listed directories go first
+# define DIR_LISTING_CACHE_ENTRIES (1024 * 1024)
+// default autoindex_page_size
+# define DIR_LISTING_PAGE_SIZE 1000
+// entries a background rescan reads per loop iteration, across all directories
+# define DIR_LISTING_SCAN_STEP 1024
+
+enum DirSort {
+	DIR_SORT_NAME,		// directories first, then byte order
+	DIR_SORT_SIZE,
+	DIR_SORT_TIME,
+	DIR_SORTS
+};
+
+/*
+	autoindex: a directory is read once with fstatat() on its descriptor and
+	its entries are kept. When the mtime of the directory changes, which it
+	does whenever an entry is added, removed or renamed, the kept entries are
+	still served while tick() reads the directory again a few entries per loop
+	iteration; the new listing replaces them once complete. A request renders
+	one page, "?sort=name|size|time&order=asc|desc&page=N", so a huge
+	directory never turns into one huge response. The size and time of a file
+	changed in place show up once the directory itself changes.
+*/
+class DirListing {
+	public:
+		static bool		render(const STR &path, const STR &uri, const STR &query, bool json,
+							size_t page_size, STR &body);
+		static void		tick();
+		static bool		scanning();
+		static void		clear();
+
+	private:
+		struct Entry {
+			STR			name;
+			bool		dir;
+			long long	size;
+			time_t		mtime;
+		};
+		struct Scan {
+			int					fd;
+			DIR					*dir;
+			struct stat			st;					// of the directory when the scan started
+			VECTOR<Entry>		entries;
+		};
+		struct Listing {
+			time_t				mtime;
+			long				mtime_nsec;
+			ino_t				ino;
+			VECTOR<Entry>		entries;			// in DIR_SORT_NAME order
+			VECTOR<uint32_t>	orders[DIR_SORTS];	// the other orders, built on first use
+			unsigned long		last_used;
+			Scan				*rescan;			// newer entries being read, NULL if none
+		};
+		struct ByName;
+		struct BySize;
+		struct ByTime;
+
+		static Listing		*load(const STR &path);
+		static bool			openScan(const STR &path, const struct stat &st, Scan &scan);
+		static bool			readScan(Scan &scan, size_t &budget);
+		static void			closeScan(Scan &scan);
+		static void			replace(Listing &listing, Scan &scan);
+		static void			drop(MAP<STR, Listing>::iterator it);
+		static void			evict(size_t incoming, const Listing *keep);
+		static const VECTOR<uint32_t>	&order(Listing &listing, DirSort sort);
+		static void			parseQuery(const STR &query, DirSort &sort, bool &desc, size_t &page);
+		static void			renderHtml(const Listing &listing, const VECTOR<uint32_t> *order, bool desc,
+								size_t first, size_t last, size_t page, size_t pages,
+								const STR &uri, const STR &query_sort, STR &body);
+		static void			renderJson(const Listing &listing, const VECTOR<uint32_t> *order, bool desc,
+								size_t first, size_t last, STR &body);
+		static void			appendHtml(STR &out, const STR &text);
+		static void			appendUri(STR &out, const STR &text);
+		static void			appendJson(STR &out, const STR &text);
+
+		static MAP<STR, Listing>	_cache;
+		static size_t				_cached_entries;
+		static unsigned long		_uses;		// last_used stamps, higher is more recent
+		static size_t				_rescans;	// listings with a rescan running
+};
+
+#endif
@@ -2,6 +2,7 @@
 # define HTTPCONFIG_HPP
 
 # include "AConfigBase.hpp"
+# include "Logger.hpp"
 
 /*
 	Needed for sure:					Subject line
@@ -22,26 +23,73 @@
 */
 
 struct ServerConfig;
+struct UpstreamConfig;
 
 struct HttpConfig : AConfigBase
 {
 	STR						_global_user;
 	STR						_global_worker_process;
-	STR						_global_error_log;
+	STR						_global_error_log;		// "stderr" = terminal
+	Logger::LogLevel		_error_log_level;		// least severe level written
 	STR						_global_pid;
 
 	STR						_keepalive_timeout;
+	int						_client_header_timeout;	// seconds, whole request line + headers
+	int						_client_body_timeout;	// seconds between two successive body reads
+	int						_send_timeout;			// seconds between two successive writes
+	long long				_client_min_rate;		// bytes per second, 0 = disabled
+	int						_worker_connections;	// max simultaneous clients
+	int						_worker_shutdown_timeout;	// seconds to drain connections on SIGQUIT/SIGTERM, 0 = no limit
+	int						_limit_conn_per_ip;		// max simultaneous clients per address, 0 = unlimited
+	int						_proxy_connect_timeout;	// seconds to establish the upstream connection
+	int						_proxy_read_timeout;	// seconds between two successive upstream reads/writes
+	STR						_proxy_cache_path;		// "" = no proxy_cache
+	VECTOR<int>				_proxy_cache_levels;	// directory name lengths, levels=1:2
+	long long				_proxy_cache_max_size;	// bytes, 0 = unlimited
+	int						_proxy_cache_inactive;	// seconds an unused entry is kept
+	int						_proxy_cache_lock_timeout;	// seconds other requests wait for the one filling an entry
+	STR						_access_log;			// "" = off
+	STR						_access_log_format;		// log_format name, "combined" is predefined
+	long long				_access_log_buffer;		// bytes collected before a write
+	int						_access_log_flush;		// seconds a buffered line may wait
+	MAP<STR, STR>			_log_formats;			// log_format name -> format
+	STR						_types_file;			// nginx mime.types file, "" = built-in types
+	MAP<std::pair<int, STR>, STR>	_error_documents;	// (code, page) -> response after Response::statusHeaders, "" = unreadable
 
 	VECTOR<ServerConfig*>	_servers;
+	VECTOR<UpstreamConfig*>	_upstreams;
 	void					_self_destruct();
 
 	HttpConfig() :
         _global_user(""),
         _global_worker_process("1"),
         _global_error_log("logs/error.log"),
+        _error_log_level(Logger::INFO),
         _global_pid("logs/nginx.pid"),
         _keepalive_timeout("65"),
-		_servers()
+        _client_header_timeout(60),
+        _client_body_timeout(60),
+        _send_timeout(60),
+        _client_min_rate(0),
+        _worker_connections(1024),
+        _worker_shutdown_timeout(30),
+        _limit_conn_per_ip(0),
+        _proxy_connect_timeout(60),
+        _proxy_read_timeout(60),
+        _proxy_cache_path(""),
+        _proxy_cache_levels(),
+        _proxy_cache_max_size(0),
+        _proxy_cache_inactive(600),
+        _proxy_cache_lock_timeout(5),
+        _access_log(""),
+        _access_log_format("combined"),
+        _access_log_buffer(64 * 1024),
+        _access_log_flush(1),
+        _log_formats(),
+        _types_file(""),
+        _error_documents(),
+		_servers(),
+		_upstreams()
     {
 		_root = "./www";
 		_client_max_body_size = 1000000; // 1MB
@@ -0,0 +1,32 @@
+#ifndef HTTPSTATUS_HPP
+#define HTTPSTATUS_HPP
+
+#include "AConfigBase.hpp"
+
+// codes with a status line of their own, the reason phrase of others is empty
+# define HTTP_STATUS_MAX 600
+
+/*
+	Reason phrases and the complete "HTTP/1.1 200 OK\r\n" lines, built once on
+	first use and indexed by code.
+*/
+class HttpStatus {
+	public:
+		static const char	*reason(int code);
+		static const STR	&line(int code);
+
+	private:
+		struct Reason {
+			int			code;
+			const char	*text;
+		};
+
+		static const Reason	_reasons[];
+		static const char	*_texts[HTTP_STATUS_MAX];
+		static STR			_lines[HTTP_STATUS_MAX];
+		static STR			_unknown;
+
+		static void			build();
+};
+
+#endif
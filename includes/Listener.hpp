@@ -0,0 +1,65 @@
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include <stdint.h>
+#include "AConfigBase.hpp"
+
+struct ServerConfig;
+class ConfigGeneration;
+
+typedef std::pair<STR, int> ListenKey;	// (address, port) of a listen directive
+
+/*
+	One listening socket and the servers reachable through it. The server_name
+	table is built once at startup: exact names in a hash table, "*.example.com"
+	in a trie of labels read from the right, "www.example.*" in one read from
+	the left. A lookup tries them in that order, the longest wildcard wins, and
+	falls back to the default server: the one marked default_server, else the
+	first one listening here.
+*/
+class Listener {
+	public:
+		Listener(const STR &address, int port, ConfigGeneration *generation);
+		~Listener();
+
+		void			addServer(ServerConfig *server);
+		ServerConfig	*findServer(const STR &host) const;
+
+		const STR		&address() const;
+		int				port() const;
+		bool			isWildcard() const;
+		ConfigGeneration	*generation() const;
+		ServerConfig	*defaultServer() const;
+
+	private:
+		struct Node {
+			MAP<STR, Node*>	children;
+			ServerConfig	*server;
+
+			Node() : server(NULL) {}
+		};
+		typedef VECTOR<std::pair<STR, ServerConfig*> >	Bucket;
+
+		STR				_address;
+		int				_port;
+		ConfigGeneration	*_generation;	// configuration the servers belong to
+		ServerConfig	*_default_server;
+		VECTOR<Bucket>	_buckets;
+		size_t			_names;
+		Node			_suffix;	// *.example.com, labels last to first
+		Node			_prefix;	// www.example.*, labels first to last
+
+		void				addName(STR name, ServerConfig *server);
+		void				addExact(const STR &name, ServerConfig *server);
+		ServerConfig		*findExact(const STR &name) const;
+		void				grow();
+		static void			addWildcard(Node *node, const VECTOR<STR> &labels, ServerConfig *server);
+		static ServerConfig	*findWildcard(const Node *node, const VECTOR<STR> &labels);
+		static void			destroy(Node *node);
+		static VECTOR<STR>	splitLabels(const STR &name, bool reverse);
+
+		Listener(const Listener &obj);
+		Listener		&operator=(const Listener &obj);
+};
+
+#endif
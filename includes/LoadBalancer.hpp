@@ -0,0 +1,35 @@
+#ifndef LOADBALANCER_HPP
+#define LOADBALANCER_HPP
+
+#include <ctime>
+#include <stdint.h>
+#include "UpstreamConfig.hpp"
+
+// ring points per unit of weight for consistent hashing
+# define HASH_POINTS_PER_WEIGHT 100
+
+/*
+	Picks the server of an upstream block for each proxied request and keeps
+	track of which servers are usable: passively from request outcomes
+	(max_fails within fail_timeout takes a server out for fail_timeout) and
+	actively with health_check probes run from the event loop tick.
+*/
+class LoadBalancer {
+	public:
+		static int	pick(UpstreamConfig *upstream, const STR &hash_value);
+		static void	release(UpstreamConfig *upstream, int server, bool failed);
+		static void	runHealthChecks(VECTOR<UpstreamConfig*> &upstreams, time_t now);
+		static void	stopHealthChecks(VECTOR<UpstreamConfig*> &upstreams);
+
+	private:
+		static bool		isAvailable(const UpstreamServer &server, time_t now);
+		static int		pickWeighted(UpstreamConfig *upstream, time_t now, bool least_conn);
+		static int		pickHash(UpstreamConfig *upstream, const STR &hash_value, time_t now);
+		static void		buildRing(UpstreamConfig *upstream);
+		static uint32_t	hash(const STR &value);
+		static void		startProbe(UpstreamConfig *upstream, UpstreamServer &server, time_t now);
+		static void		stepProbe(UpstreamConfig *upstream, UpstreamServer &server, time_t now);
+		static void		probeResult(UpstreamConfig *upstream, UpstreamServer &server, bool ok, time_t now);
+};
+
+#endif
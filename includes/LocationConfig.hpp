@@ -1,31 +1,56 @@
 #ifndef LOCATIONCONFIG_HPP
 # define LOCATIONCONFIG_HPP
 # include "AConfigBase.hpp"
+# include "DirListing.hpp"
+
+struct UpstreamConfig;
 
 struct LocationConfig : AConfigBase {
 	STR								_proxy_pass_host;
 	int								_proxy_pass_port;
+	STR								_proxy_pass_uri;			// replaces the location prefix when set
+	struct sockaddr_in				_proxy_pass_addr;			// resolved once per configuration
+	UpstreamConfig					*_upstream;					// proxy_pass host names an upstream block
+	bool							_proxy_cache;
+	int								_proxy_cache_valid;			// seconds, when the upstream sends no freshness info
+	bool							_stub_status;				// answers with the server metrics
 	STR								_path;
 	int								_return_code;				//server, location
 	STR								_return_url;				//server, location
 	bool							_autoindex;
+	bool							_autoindex_json;			// autoindex_format json
+	size_t						_autoindex_page_size;		// entries per listing page, 0 = all
 	MAP<STR, bool>					_allowed_methods;
 	MAP<STR, LocationConfig*>		_locations;
 	STR								_upload_store;
 	STR								_alias;
+	double							_limit_req_rate;			// requests per second, 0 = no limit
+	int								_limit_req_burst;
+	bool							_limit_req_nodelay;
 
 	void							_self_destruct();
 
 	LocationConfig() :
 		_proxy_pass_host(""),
-		_proxy_pass_port(8080),
+		_proxy_pass_port(80),
+		_proxy_pass_uri(""),
+		_upstream(NULL),
+		_proxy_cache(false),
+		_proxy_cache_valid(0),
+		_stub_status(false),
         _path(""),
 		_return_code(-1),
 		_return_url(""),
         _autoindex(false),
+		_autoindex_json(false),
+		_autoindex_page_size(DIR_LISTING_PAGE_SIZE),
 		_upload_store(""),
-		_alias("")
+		_alias(""),
+		_limit_req_rate(0),
+		_limit_req_burst(0),
+		_limit_req_nodelay(false)
     {
+		memset(&_proxy_pass_addr, 0, sizeof(_proxy_pass_addr));
 		_allowed_methods["GET"] = false;
 		_allowed_methods["POST"] = false;
 		_allowed_methods["DELETE"] = false;
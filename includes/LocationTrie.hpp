@@ -0,0 +1,40 @@
+#ifndef LOCATIONTRIE_HPP
+#define LOCATIONTRIE_HPP
+
+#include "AConfigBase.hpp"
+
+struct LocationConfig;
+
+/*
+	Locations of one server, nested ones included, keyed by path segment.
+	Built once when the config is checked; a lookup walks the request path
+	one segment at a time and keeps the deepest location seen, which is the
+	longest matching prefix on segment boundaries. "/api" and "/api/" both
+	sit on the "api" node, the one without the slash wins.
+*/
+class LocationTrie {
+	public:
+		LocationTrie();
+		~LocationTrie();
+
+		void			insert(const STR &path, LocationConfig *location);
+		LocationConfig	*match(const STR &uri, STR &matched_path) const;
+
+	private:
+		struct Node {
+			MAP<STR, Node*>	children;
+			LocationConfig	*exact;		// location "/a/b"
+			LocationConfig	*slash;		// location "/a/b/"
+
+			Node() : exact(NULL), slash(NULL) {}
+		};
+
+		Node			*_root;
+
+		static void		destroy(Node *node);
+
+		LocationTrie(const LocationTrie &obj);
+		LocationTrie	&operator=(const LocationTrie &obj);
+};
+
+#endif
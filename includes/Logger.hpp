@@ -15,15 +15,31 @@
 #define BLUE "\033[34m"
 #define END "\033[0m"
 
+// builds the message only when its level is enabled, for call sites on the request path
+#define LOG(level, message) do { if (Logger::enabled(level)) Logger::log(level, message); } while (0)
 
+/*
+	Lines go to the error_log file, or to the terminal until one is opened
+	(and when it cannot be). The timestamp comes from Clock, formatted once
+	per second of the event loop. The level threshold comes from error_log
+	and changes with the configuration on reload.
+*/
 class Logger {
 	public:
 		enum LogLevel { INFO, WARNING, ERROR, DEBUG };
 		static void log(LogLevel level, const std::string &message);
+		static bool enabled(LogLevel level) { return _enabled[level]; }
+		static bool parseLevel(const std::string &name, LogLevel &level);
+		static void configure(const std::string &path, LogLevel level);
+		static void reopen();
 
 	private:
-		static std::string getCurrentTime();
 		static std::string logLevelToString(LogLevel level);
+		static void open();
+
+		static bool			_enabled[4];
+		static std::string	_path;		// "" or "stderr" = terminal
+		static int			_fd;
 };
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include "AConfigBase.hpp"
+
+// status codes counted one by one, anything outside is folded into the last slot
+# define METRICS_MAX_STATUS 600
+// upper bounds of the latency histogram buckets, plus one for +Inf
+# define METRICS_LATENCY_BUCKETS 19
+
+// request phases with a latency histogram, boundaries taken in RequestsManager
+enum LatencyPhase {
+	LATENCY_ACCEPT,		// accept to the first byte of the first request
+	LATENCY_HEADER,		// first byte to the end of the headers
+	LATENCY_ROUTING,	// server and location lookup
+	LATENCY_HANDLER,	// response built in the event loop (static, upload, errors)
+	LATENCY_CGI,		// request handed to a CGI until its output is complete
+	LATENCY_TTFB,		// first request byte to first response byte written
+	LATENCY_WRITE,		// first to last response byte written
+	LATENCY_TOTAL,		// first request byte to last response byte written
+	LATENCY_PHASES
+};
+
+/*
+	Counters behind stub_status. The server is one process with one event loop,
+	so they are plain integers bumped where the event happens; the connection
+	states are kept per ClientPhase and summed when the page is rendered.
+	Latencies go into fixed log-spaced buckets, exported as cumulative
+	Prometheus histograms. Nothing is reset on reload or drain.
+*/
+class Metrics {
+	public:
+		static void	connectionAccepted();
+		static void	connectionHandled();
+		static void	phaseChanged(int from, int to);	// ClientPhase, -1 for none
+		static void	bytesReceived(long long bytes);
+		static void	bytesSent(long long bytes);
+		static void	responseSent(int status_code);
+		static void	cgiSpawned();
+		static void	cgiTimedOut();
+		static void	cgiFailed();
+		static void	observe(LatencyPhase phase, long long micros);
+
+		static STR	render();
+
+	private:
+		static unsigned long long	_accepted;
+		static unsigned long long	_handled;
+		static unsigned long long	_requests;
+		static unsigned long long	_bytes_in;
+		static unsigned long long	_bytes_out;
+		static unsigned long long	_cgi_spawned;
+		static unsigned long long	_cgi_timeouts;
+		static unsigned long long	_cgi_errors;
+		static long					_phases[5];
+		static unsigned long long	_responses[METRICS_MAX_STATUS];
+		static unsigned long long	_latency[LATENCY_PHASES][METRICS_LATENCY_BUCKETS];
+		static unsigned long long	_latency_sum[LATENCY_PHASES];	// microseconds
+		static const long long		_latency_bounds[METRICS_LATENCY_BUCKETS - 1];	// microseconds
+		static const char			*_latency_names[LATENCY_PHASES];
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef MIMETYPES_HPP
+#define MIMETYPES_HPP
+
+#include "HttpConfig.hpp"
+
+// type of a name without a known extension
+# define MIME_DEFAULT_TYPE "text/plain"
+
+/*
+	Extension -> media type, one sorted table searched by binary search. The
+	built-in list is constant data; types_file replaces it with the types of
+	an nginx mime.types file, on startup and on reload. contentType() is the
+	Content-Type header value, text types with their charset.
+*/
+class MimeTypes {
+	public:
+		static bool			load(const STR &path, MAP<STR, STR> &types);
+		static void			init(HttpConfig *config);
+		static const STR	&type(const STR &path);
+		static const STR	&contentType(const STR &path);
+
+	private:
+		struct Builtin {
+			const char	*extension;
+			const char	*type;
+		};
+		struct Entry {
+			STR		extension;
+			STR		type;
+			STR		content_type;
+		};
+
+		static const Builtin	_builtin[];
+		static VECTOR<Entry>	_table;		// sorted by extension
+		static Entry			_default;
+
+		static void			install(const MAP<STR, STR> &types);
+		static const Entry	&find(const STR &path);
+		static Entry		entry(const STR &extension, const STR &type);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef OUTPUTCHAIN_HPP
+#define OUTPUTCHAIN_HPP
+
+#include <deque>
+#include <sys/types.h>
+#include "AConfigBase.hpp"
+
+// memory buffers handed to one writev
+# define OUTPUT_CHAIN_IOV 64
+
+/*
+	Response bytes waiting for the client: BufferPool chunks and file regions
+	in order. writeTo() sends the leading chunks with one writev, a file
+	region with sendfile, and moves offsets forward instead of erasing what
+	was sent; a chunk goes back to the pool as soon as it is sent. The chain
+	owns the chunks and the file descriptors of its regions.
+*/
+class OutputChain {
+	public:
+		OutputChain();
+		OutputChain(const OutputChain &obj);
+		OutputChain	&operator=(const OutputChain &obj);
+		OutputChain	&operator=(const STR &data);
+		OutputChain	&operator+=(const STR &data);
+		~OutputChain();
+
+		void		append(const STR &data);
+		void		appendFile(int fd, off_t offset, size_t length);
+		void		clear();
+		size_t		size() const;
+		bool		empty() const;
+		STR			head(size_t max) const;
+		ssize_t		writeTo(int fd);
+
+	private:
+		struct Segment {
+			char	*chunk;		// pooled memory, NULL for a file region
+			size_t	capacity;
+			size_t	offset;		// sent bytes of the chunk, or position in the file
+			size_t	end;		// bytes filled in the chunk
+			int		fd;			// -1 for a memory chunk
+			size_t	length;		// bytes of the file region left
+		};
+
+		std::deque<Segment>	_segments;
+		size_t				_size;
+
+		void		advance(size_t bytes);
+		void		release(Segment &segment);
+};
+
+#endif
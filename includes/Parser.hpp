@@ -3,6 +3,7 @@
 # include "HttpConfig.hpp"
 # include "LocationConfig.hpp"
 # include "ServerConfig.hpp"
+# include "UpstreamConfig.hpp"
 # include <iostream>
 # include <fstream>
 # include <limits.h>
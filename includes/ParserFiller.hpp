@@ -5,6 +5,7 @@
 #include "HttpConfig.hpp"
 #include "ServerConfig.hpp"
 #include "LocationConfig.hpp"
+#include "UpstreamConfig.hpp"
 #include "Logger.hpp"
 #include "Utils.hpp"
 #include <iostream>
@@ -17,6 +18,7 @@ public:
 	static bool FillHttp(HttpConfig* httpConf, VECTOR<STR> tokens);
 	static bool FillServer(ServerConfig* serverConf, VECTOR<STR> tokens);
 	static bool FillLocation(LocationConfig* locConf, VECTOR<STR> tokens);
+	static bool FillUpstream(UpstreamConfig* upstreamConf, VECTOR<STR> tokens);
 	static bool FillDirective(AConfigBase* block, STR line, int position);
 };
 
@@ -8,6 +8,8 @@
 #include "HttpConfig.hpp"
 #include "ServerConfig.hpp"
 #include "LocationConfig.hpp"
+#include "UpstreamConfig.hpp"
+#include "LocationTrie.hpp"
 #include "Utils.hpp"
 #include "Logger.hpp"
 
@@ -16,11 +18,25 @@ class ParserUtils {
 		static int verifyPort(std::string port_str);
 		static bool verifyAutoIndex(std::string autoindex_str);
 		static long long verifyClientMaxBodySize(std::string client_max_body_size_str);
+		static int verifyTimeout(std::string timeout_str);
+		static int verifyCount(std::string count_str);
+		static double verifyRate(std::string rate_str);
+		static bool verifyProxyPass(std::string url, STR &host, int &port, STR &uri);
+		static bool verifyListen(STR value, STR &address, int &port);
 		static bool isDirectiveOk(std::string line, int start, int end);
 		static bool isBlockOk(std::string line, int start, int end);
 		static bool isBlockEndOk(STR line, int start);
 		static bool check_location_path_duplicate(STR new_path, MAP<STR, LocationConfig*> locs);
 		static bool minimum_value_check(HttpConfig *conf);
+		static void link_upstreams(HttpConfig *conf, MAP<STR, LocationConfig*> &locs);
+		static bool resolve_proxy_pass(MAP<STR, LocationConfig*> &locs);
+		static bool resolve_address(const STR &host, int port, struct sockaddr_in &addr);
+		static bool check_proxy_cache(HttpConfig *conf, MAP<STR, LocationConfig*> &locs);
+		static void build_location_trie(LocationTrie *trie, MAP<STR, LocationConfig*> &locs);
+		static void compile_effective(HttpConfig *conf);
+		static void compile_locations(HttpConfig *conf, MAP<STR, LocationConfig*> &locs, EffectiveLocation *parent);
+		static void load_error_pages(HttpConfig *conf, EffectiveLocation *effective);
+		static EffectiveLocation *inherit_effective(AConfigBase *block, EffectiveLocation *parent, bool is_http);
 };
 
 #endif // PARSERUTILS_HPP
@@ -2,6 +2,7 @@
 # define POLLSERVER_HPP
 # include "HttpConfig.hpp"
 # include "RequestsManager.hpp"
+# include "ConfigGeneration.hpp"
 # include <iostream>
 
 //to clean
@@ -19,43 +20,83 @@
 #include <fcntl.h>
 #include <map>
 #include <sys/epoll.h>
+#include <sys/wait.h>
 
 enum FdType {
     SERVER_FD,
     CLIENT_FD,
     CGI_FD,
-    POST_FD
+    POST_FD,
+    UPSTREAM_FD,
+    UPGRADE_FD          // readiness pipe of a new binary started on SIGUSR2
 };
 
 class PollServer {
 	private:
-		HttpConfig 					*config;
+		HttpConfig 					*config;             // of the current generation
+		ConfigGeneration			*_generation;        // new connections are accepted under this one
+		STR							_config_path;
+		STR							_binary_path;
+		pid_t						_upgrade_pid;        // new binary being started, -1 if none
+		int							_upgrade_fd;         // its readiness pipe
+		bool						_draining;           // not accepting anymore, exit once the clients are gone
+		time_t						_drain_deadline;     // worker_shutdown_timeout, 0 = none
+		std::map<ListenKey, int>	_inherited_sockets;  // from the previous binary, not taken over yet
+		RequestsManager				*_manager;
 		bool						running;
-		std::map<int, int>			_server_sockets;      // port -> socket_fd
+		std::map<int, Listener*>	_server_sockets;      // socket_fd -> listener bound on it
 		std::map<int, STR>			_partial_requests;
 		std::map<int, STR>			_partial_responses;
 		std::map<int, FdType>       _fd_types;           // Track fd types
 		std::map<int, int>          _cgi_to_client;      // Map CGI fd to client fd
+		std::map<int, int>          _upstream_to_client; // proxy_pass upstream fd -> client fd
 		int							_epoll_fd;
+		time_t						_last_timeout_check;
+		time_t						_last_upstream_check;
+		int							_spare_fd;           // kept open to get out of EMFILE
+		bool						_accept_paused;
+		time_t						_accept_resume_at;
+		std::map<int, ClientKey>	_client_ips;         // client fd -> remote address
+		std::map<ClientKey, int>	_connections_per_ip;
 		VECTOR<struct epoll_event>	_events;
 		const int 					MAX_EVENTS;
 
 		bool	WaitAndService(RequestsManager &requests);
-		void	AcceptClient(int new_fd);
+		void	AcceptClient(int new_fd, RequestsManager &manager);
+		void	RejectClient(int client_fd, const STR &reason);
+		void	HandleFdExhaustion(int server_fd);
+		void	PauseAccepting();
+		void	ResumeAccepting();
 		void	CloseClient(int client_fd);
 		void	HandleCgiOutput(int cgi_fd, RequestsManager &requests);
 		bool	AddFd(int fd, uint32_t events, FdType type);
 		bool	ModifyFd(int fd, uint32_t events);
 		bool	RemoveFd(int fd);
-		bool	AddServerSocket(int port, int socket_fd);
+		bool	isCoveredByWildcard(ConfigGeneration *generation, const Listener *listener);
+		int		openServerSocket(const STR &server_addr_str, int port);
+		void	switchServerSockets(std::map<int, Listener*> &sockets);
+		void	reloadConfig(RequestsManager &manager);
+		void	beginDrain(RequestsManager &manager);
+		bool	isDrained();
+		void	startUpgrade();
+		void	finishUpgrade();
+		void	loadInheritedSockets();
+		void	signalReady();
+		Listener	*findListener(int server_fd, int client_fd);
 		bool	AddCgiFd(int cgi_fd, int client_fd);
-		void	getUniqueServers(const HttpConfig *hcf, MAP<int, STR>& unique_servers);
+		void	HandleUpstreamEvent(int upstream_fd, uint32_t events, RequestsManager &manager);
+		void	syncUpstream(int client_fd, RequestsManager &manager);
+		void	processUpstreamTimeouts(RequestsManager &manager);
+		void	getUniqueServers(ConfigGeneration *generation);
 		void	processDisconnectOrTimeoutCgis(RequestsManager &manager);
+		void	processClientTimeouts(RequestsManager &manager);
+		void	processDelayedClients(RequestsManager &manager);
+		int		nextWaitTimeout(RequestsManager &manager);
 		void	handleSingleEpollEvent(const epoll_event& current_event, RequestsManager &manager);
 		void	checkingEventError(const epoll_event& current_event, RequestsManager &manager, FdType fd_type, int fd);
 		void	handleClientEventActivity(const epoll_event& current_event, RequestsManager &manager, int fd, int status);
 		void	handleEventBasedOnFdType(const epoll_event& current_event, RequestsManager &manager, int fd, FdType fd_type);
-		void	initializeServerSockets(MAP<int, STR>& unique_servers);
+		void	initializeServerSockets(ConfigGeneration *generation, std::map<int, Listener*> &sockets);
 
 	public:
 		PollServer();
@@ -64,6 +105,8 @@ class PollServer {
 		~PollServer();
 
 		void setConfig(HttpConfig *config);
+		void setConfigPath(const STR &config_path);
+		void setBinaryPath(const STR &binary_path);
 
 		void start();
 		void stop();
@@ -0,0 +1,69 @@
+#ifndef PROXYCACHE_HPP
+#define PROXYCACHE_HPP
+
+#include <map>
+#include <list>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+#include "HttpConfig.hpp"
+
+// how often a request waiting on another one filling the same key looks again
+# define PROXY_CACHE_LOCK_WAIT_MS 50
+// larger responses are passed through without being stored
+# define PROXY_CACHE_MAX_ENTRY (8 * 1024 * 1024)
+
+enum CacheLock {
+	CACHE_LOCK_ACQUIRED,	// this request fetches the response and stores it
+	CACHE_LOCK_WAIT,		// another request is already fetching it
+	CACHE_LOCK_BYPASS		// that one takes longer than proxy_cache_lock_timeout, go to the upstream uncached
+};
+
+/*
+	proxy_cache: upstream responses stored under proxy_cache_path, one file per
+	key in the levels= directory layout, with the key index kept in memory.
+	Entries leave the index when they expire, when nothing used them for
+	inactive seconds, or least recently used first to stay under max_size.
+	The index is rebuilt from the files on startup. A hit hands out the
+	stored header and the file itself, the body is sent from it with sendfile.
+*/
+class ProxyCache {
+	public:
+		static void			init(HttpConfig *config);
+		static bool			enabled();
+		static bool			lookup(const STR &key, STR &headers, int &fd, off_t &offset, size_t &length);
+		static CacheLock	lock(const STR &key);
+		static void			unlock(const STR &key);
+		static void			store(const STR &key, const STR &response, int valid);
+		static void			cleanup(time_t now);
+
+	private:
+		struct Entry {
+			STR							file;
+			long long					size;
+			off_t						header_offset;	// the response starts after the key and expiry lines
+			off_t						body_offset;
+			time_t						expires;
+			time_t						last_used;
+			std::list<STR>::iterator	lru;
+		};
+
+		static int		freshness(const STR &response, int valid);
+		static STR		filePath(const STR &key, bool create_dirs);
+		static void		add(const STR &key, const STR &file, long long size, off_t header_offset,
+							off_t body_offset, time_t expires);
+		static void		remove(std::map<STR, Entry>::iterator it);
+		static void		loadDir(const STR &dir, size_t depth);
+
+		static STR							_path;
+		static VECTOR<int>					_levels;
+		static long long					_max_size;
+		static int							_inactive;
+		static int							_lock_timeout;
+		static long long					_size;
+		static std::map<STR, Entry>			_entries;
+		static std::list<STR>				_lru;		// most recently used first
+		static std::map<STR, time_t>		_locks;		// key -> when its fetch started
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef PROXYHANDLER_HPP
+#define PROXYHANDLER_HPP
+
+#include <ctime>
+#include <stdint.h>
+#include "AConfigBase.hpp"
+#include "UpstreamPool.hpp"
+
+// largest upstream response head we accept
+# define PROXY_MAX_HEAD 16384
+
+enum ProxyStatus {
+	PROXY_CONNECTING,
+	PROXY_SENDING,		// request going out to the upstream
+	PROXY_READING,		// response coming back, streamed to the client
+	PROXY_DONE,
+	PROXY_FAILED,		// 502
+	PROXY_TIMEDOUT		// 504
+};
+
+/*
+	Non-blocking HTTP/1.1 client for one proxied request, driven by the server's
+	epoll loop like CgiHandler. The upstream response is passed through as it
+	arrives: the caller collects it with takeOutput() and stops asking for
+	EPOLLIN while the client is not keeping up.
+*/
+class ProxyHandler {
+	private:
+		enum ChunkState {
+			CHUNK_LINE,			// chunk size line
+			CHUNK_BODY,
+			CHUNK_BODY_END,		// CRLF after the chunk data
+			CHUNK_TRAILERS,
+			CHUNK_END
+		};
+
+		STR			_host;
+		int			_port;
+		struct sockaddr_in	_addr;
+		STR			_key;				// pool key, host:port
+		STR			_request;
+		size_t		_sent;
+		int			_fd;
+		bool		_reused;			// connection came from the pool
+		ProxyStatus	_status;
+		time_t		_last_activity;
+		int			_connect_timeout;
+		int			_read_timeout;
+		bool		_head_only;			// HEAD request, no body follows the response head
+
+		STR			_head;				// upstream response head, until complete
+		bool		_head_done;
+		STR			_output;			// bytes ready for the client
+		bool		_forwarded;			// something was already handed to the client
+		long long	_content_left;		// Content-Length framing, -1 otherwise
+		bool		_chunked;
+		bool		_until_close;		// body ends when the upstream closes
+		bool		_keep_alive;		// connection can go back to the pool
+
+		bool		_capture;			// keep a copy of the output for proxy_cache
+		size_t		_capture_limit;
+		STR			_captured;
+
+		ChunkState	_chunk_state;
+		long long	_chunk_left;
+		STR			_chunk_line;
+
+		bool		connectUpstream();
+		bool		retryFresh();
+		void		fail(ProxyStatus status, const STR &reason);
+		void		readResponse();
+		void		sendRequest();
+		bool		parseHead();
+		void		consumeBody(const char *data, size_t len);
+		size_t		advanceChunked(const char *data, size_t len);
+
+	public:
+		ProxyHandler(const STR &host, int port, const struct sockaddr_in &addr, const STR &request, bool head_only,
+			int connect_timeout, int read_timeout);
+		~ProxyHandler();
+
+		bool		start();
+		void		handleEvent(uint32_t events);
+		bool		checkTimeout(time_t now, bool paused);
+		uint32_t	wantedEvents() const;
+		STR			takeOutput();
+		void		finish();
+		void		capture(size_t limit);
+
+		int			getFd() const { return _fd; }
+		ProxyStatus	getStatus() const { return _status; }
+		bool		isFinished() const { return _status == PROXY_DONE || _status == PROXY_FAILED || _status == PROXY_TIMEDOUT; }
+		bool		hasForwarded() const { return _forwarded; }
+		bool		hasSent() const { return _sent > 0 || _status == PROXY_READING; }
+		bool		closesClient() const { return _until_close; }
+		bool		isCaptured() const { return _capture; }
+		const STR	&captured() const { return _captured; }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef RATELIMITER_HPP
+#define RATELIMITER_HPP
+
+#include <map>
+#include "LocationConfig.hpp"
+#include "Utils.hpp"
+
+enum LimitResult {
+	LIMIT_PASS,
+	LIMIT_DELAY,   // within burst, serve after delay_ms
+	LIMIT_REJECT   // over burst, answer 429
+};
+
+/*
+	limit_req: one bucket per (location, client address), shared by every
+	connection of that client. The bucket leaks at the configured rate and each
+	request adds one; "excess" above zero is the queue that burst allows.
+*/
+class RateLimiter {
+	public:
+		static LimitResult check(const LocationConfig *zone, const ClientKey &client, long long &delay_ms);
+		static void cleanup(long long now_ms);
+		static void forget(const LocationConfig *zone);
+
+	private:
+		struct Bucket {
+			double		excess;		// requests above the rate, in requests
+			long long	last_ms;
+		};
+		typedef std::pair<const LocationConfig*, ClientKey>	BucketKey;
+
+		static std::map<BucketKey, Bucket>	_buckets;
+		static long long					_last_cleanup;
+};
+
+#endif
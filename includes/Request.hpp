@@ -3,6 +3,7 @@
 # include "HttpConfig.hpp"
 # include "LocationConfig.hpp"
 # include "ServerConfig.hpp"
+# include "RequestArena.hpp"
 # include <iostream>
 
 #include <sys/socket.h>
@@ -31,10 +32,18 @@ enum ChunkedState {
 	CHUNK_COMPLETE,  // chunk complete
 };
 
+// one media range of the Accept header, kept in the request arena
+struct AcceptedType {
+	const char	*type;
+	float		quality;
+};
+
 class Request {
 	private:
 		void								parseQueryString();
 		void								parseTransferEncoding(const std::string &header);
+		void								parseHeaderLine(const char *line, size_t length);
+		void								parseAccept(const char *value, size_t length);
 
 		public:
 		STR									_cookies;
@@ -44,9 +53,11 @@ class Request {
 		STR									_file_name; //based on original path from request or empty if path is a location
 		STR									_http_version;
 		STR									_host;
+		bool								_has_host;	// a Host header was sent, _host is "localhost" otherwise
 		int									_port;
-		std::map<STR, float>				_accepted_types; //application/xml;q=0.9
-		//STR      float
+		RequestArena						*_arena;	// of the connection, NULL keeps no Accept list
+		AcceptedType						*_accepted_types; //application/xml;q=0.9
+		size_t								_accepted_count;
 		STR									_content_type;
 		STR									_http_content_type;  // added
 		unsigned long long					_body_size;
@@ -59,7 +70,8 @@ class Request {
 		unsigned long long					_chunk_data_read; // added for transfer-encoding
 		STR									_chunk_buffer;  //	 added for transfer-encoding
 
-		bool								setRequest(STR request);
+		bool								setRequest(const STR &request);
+		float								acceptQuality(const STR &type) const;
 
 		bool								processTransferEncoding(const char *data);
 		bool								parseHeader();
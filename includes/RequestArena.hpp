@@ -0,0 +1,41 @@
+#ifndef REQUESTARENA_HPP
+#define REQUESTARENA_HPP
+
+#include <cstddef>
+
+// every allocation starts on this boundary
+# define REQUEST_ARENA_ALIGN (2 * sizeof(void*))
+
+/*
+	Scratch memory of one request. allocate() moves a pointer forward in
+	BufferPool chunks, nothing is freed on its own: reset() gives all chunks
+	back once the request is done, so an idle connection holds none. Copies
+	start empty, what was allocated stays with the original.
+*/
+class RequestArena {
+	public:
+		RequestArena();
+		RequestArena(const RequestArena &obj);
+		RequestArena	&operator=(const RequestArena &obj);
+		~RequestArena();
+
+		void		*allocate(size_t size);
+		char		*copy(const char *data, size_t length);
+		void		reset();
+		size_t		used() const;
+
+	private:
+		struct Block {
+			Block	*next;
+			size_t	size;	// of the whole chunk, this header included
+		};
+
+		Block		*_blocks;	// the current one first
+		char		*_free;
+		char		*_end;
+		size_t		_used;
+
+		void		grow(size_t size);
+};
+
+#endif
@@ -3,14 +3,54 @@
 #ifndef REQUESTSMANAGER_HPP
 # define REQUESTSMANAGER_HPP
 # include "Response.hpp"
+# include "ConfigGeneration.hpp"
+# include "OutputChain.hpp"
+
+// seconds a slow client gets before client_min_rate is enforced
+# define MIN_RATE_GRACE 5
+
+// proxied responses: stop reading the upstream above the high mark of unsent
+// client data, resume once it drained below the low mark
+# define PROXY_HIGH_WATERMARK (256 * 1024)
+# define PROXY_LOW_WATERMARK (64 * 1024)
+
+// What the connection is currently waiting for, each phase has its own deadline
+enum ClientPhase {
+    PHASE_HEADER,   // request line and headers (client_header_timeout, whole phase)
+    PHASE_BODY,     // request body (client_body_timeout, between reads)
+    PHASE_HANDLER,  // CGI or upstream running, covered by their own timeouts
+    PHASE_WRITE,    // sending the response (send_timeout, between writes)
+    PHASE_IDLE      // keep-alive, waiting for the next request (keepalive_timeout)
+};
 
 // Client state tracking structure
 struct ClientState {
     Request request;
+    RequestArena arena;         // scratch memory of the current request, see RegisterClient
     long long body_read;
     bool processing_cgi;
+    ClientPhase phase;
+    time_t phase_start;
+    time_t last_activity;
+    long long phase_bytes;      // bytes read or written since phase_start
+    bool close_after_write;     // close instead of waiting for the next request
+    ClientKey client_ip;
+    STR remote_addr;            // printable peer address, formatted once at accept
+    int remote_port;
+    bool upstream_paused;       // proxied response waits for the client to read
+    const Listener *listener;   // listening socket the connection was accepted on
+    int response_status;        // status line of the response being written, 0 before
+    long long response_bytes;   // written so far, headers included
+    long long response_header_bytes;
+    long long accepted_us;      // monotonic, until the first request starts
+    long long request_start_us; // first byte of the current request, 0 between requests
+    long long dispatch_us;      // request handed to Response
+    long long first_write_us;   // first byte of the response written, 0 before
 
-    ClientState() : body_read(-1), processing_cgi(false) {}
+    ClientState() : body_read(-1), processing_cgi(false), phase(PHASE_HEADER),
+        phase_start(time(NULL)), last_activity(phase_start), phase_bytes(0), close_after_write(false),
+        client_ip(), remote_addr(""), remote_port(0), upstream_paused(false), listener(NULL),
+        response_status(0), response_bytes(0), response_header_bytes(0), accepted_us(0), request_start_us(0), dispatch_us(0), first_write_us(0) {}
 };
 
 class RequestsManager {
@@ -18,14 +58,19 @@ class RequestsManager {
         HttpConfig      *_config;
         int             _client_fd;
         MAP<int, STR>   _partial_requests;
-        MAP<int, STR>   _partial_responses;
+        MAP<int, OutputChain> _partial_responses;
         MAP<int, Response*> _active_responses; // Track active responses, particularly CGI ones
         MAP<int, ClientState> _client_states;  // Track client state for each client fd
+        MAP<int, long long> _delayed_clients;  // client fd -> when its limit_req delay is over (ms)
 
         int             HandleRead();               //*ints here should indicate next action like 1 = nothing, 0 = remove fd,
                                                     // 2 = update fd status
         int             HandleWrite();              //*
         STR             createErrorResponse(int statusCode, const STR& contentType, const STR& body, AConfigBase *base);
+        void            setPhase(ClientState &client_state, ClientPhase phase);
+        void            forgetClientState(int client_fd);
+        void            logAccess(const ClientState &client_state, long long now_us);
+        int             DispatchRequest(ClientState &client_state, bool rate_checked);
 
         public:
         RequestsManager();
@@ -37,7 +82,14 @@ class RequestsManager {
 
         void setConfig(HttpConfig *config);
         void setClientFd(int client_fd);
+        void RegisterClient(int client_fd, const struct sockaddr *client_addr, const Listener *listener);
+        const ClientState *getClientState(int client_fd) const;
         int HandleClient(short int revents);
+        int CheckTimeout(time_t now);
+        void Drain(VECTOR<int> &idle);
+        int ResumeDelayed();
+        void getReadyDelayedClients(long long now_ms, VECTOR<int> &ready) const;
+        long long nextDelayDeadline() const;
         void CloseClient();
 
         // Methods for CGI management
@@ -46,6 +98,15 @@ class RequestsManager {
         int getCurrentCgiFd() const; // Get current CGI fd for the client
         int HandleCgiOutput(int fd);    // Handle CGI output ready event - moved to public
         Response* getCgiResponse(int client_fd);  // Get CGI response for client
+
+        // Methods for proxy_pass upstreams, all for the current client
+        ProxyHandler* getProxyHandler() const;
+        int getCurrentUpstreamFd() const;
+        void HandleUpstreamEvent(uint32_t events);
+        bool CheckUpstreamTimeout(time_t now);
+        uint32_t getUpstreamEvents();
+        bool hasPendingOutput() const;
+        int FinishUpstream();
 		int PerformSocketRead(void);
 		int ProcessBufferedData(void);
 };
@@ -3,12 +3,18 @@
 # include "Request.hpp"
 # include <iostream>
 # include "CgiHandler.hpp"
+# include "ProxyHandler.hpp"
+# include "LoadBalancer.hpp"
+# include "Listener.hpp"
 # include "Logger.hpp"
 # include "Utils.hpp"
 
 #include <cerrno>
 #include <cstring> // For strerror
 
+// static files from this size on are sent with sendfile instead of being read into the response
+# define SENDFILE_MIN_SIZE (32 * 1024)
+
 enum FileType {
     NotFound,
     NormalFile,
@@ -19,6 +25,8 @@ enum ResponseState {
     READY,
     PROCESSING_CGI,
     PROCESSING_POST,  // Post request is processing, but not yet ready
+    PROCESSING_PROXY, // waiting on the proxy_pass upstream
+    DELAYED,          // limit_req wants the request served later
     COMPLETE
 };
 
@@ -27,13 +35,8 @@ class Response {
         Request     _request;
         STR         _body;
         HttpConfig  *_config;
-        std::map<STR, STR>          _all_mime_types; // _all_mime_types["extention"] = "name", _all_mime_types[".html"] = "text/html"
-                                                        // the order is not in reverse as several extentions can have same name
-
-        std::map<int, STR>          _all_status_codes;
-        STR                         handleGET(STR best_path, bool isDIR);
-        STR                         getMime(STR path);
-        STR                         handleDIR(STR path);
+        STR                         handleGET(STR best_path, bool isDIR, LocationConfig *matchLocation);
+        STR                         handleDIR(STR path, LocationConfig *matchLocation);
         void                        selectIndexIndexes(VECTOR<STR> indexes, STR &best_match, float &match_quality, STR dir_path);
         STR                         selectIndexAll(LocationConfig* location, STR dir_path);
         FileType                    checkFile(const STR& path);
@@ -42,10 +45,35 @@ class Response {
         STR                         matchMethod(STR path, bool isDIR, LocationConfig *matchLocation);
         STR                         checkRedirect(LocationConfig *matchLocation);
         bool                        checkBodySize(LocationConfig *matchLocation);
+        STR                         checkRateLimit(LocationConfig *matchLocation);
+        STR                         splitPathInfo(ServerConfig *matchServer, LocationConfig *&matchLocation, STR &dir_path);
+        STR                         startProxy(LocationConfig *matchLocation);
+        STR                         buildProxyRequest(LocationConfig *matchLocation);
+        STR                         upstreamHashValue(UpstreamConfig *upstream);
+        bool                        connectNext();
+        STR                         cachedResponse(const STR &headers, int fd, off_t offset, size_t length);
 
         CgiHandler*                 _cgi_handler;
+        ProxyHandler*               _proxy_handler;
+        UpstreamConfig*             _upstream;
+        int                         _upstream_server;   // picked by LoadBalancer, -1 once released
+        LocationConfig*             _proxy_location;
+        STR                         _proxy_request;
+        size_t                      _proxy_tries;       // servers left to try
+        STR                         _cache_key;         // "" = response not cacheable
+        bool                        _cache_locked;      // this request fills the proxy_cache entry
         ResponseState               _state;
         STR                         _response_buffer;
+        ClientKey                   _client_ip;
+        STR                         _remote_addr;
+        int                         _remote_port;
+        const Listener*             _listener;          // socket the connection came in on
+        bool                        _rate_checked;      // request already went through limit_req
+        long long                   _delay_ms;
+        long long                   _routing_us;        // server and location lookup, -1 if not reached
+        int                         _body_fd;           // static file sent after the headers, -1 if none
+        off_t                       _body_offset;
+        size_t                      _body_length;
 
     public:
         Response();
@@ -53,15 +81,25 @@ class Response {
         Response(const Response &obj);
         ~Response();
 
-        void    setRequest(Request request);
+        void    setRequest(const Request &request);
         void    setConfig(HttpConfig *config);
-        STR     createResponse(int statusCode, const STR& contentType, const STR& body, const STR& extra);
-        STR     createErrorResponse(int statusCode, const STR& contentType, const STR& body, AConfigBase *base);
+        void    setPeer(const ClientKey &client_ip, const STR &remote_addr, int remote_port);
+        void    setListener(const Listener *listener);
+        void    setRateChecked(bool rate_checked);
+        static STR  createResponse(int statusCode, const STR& contentType, const STR& body, const STR& extra);
+        static STR  createHeaders(int statusCode, const STR& contentType, size_t contentLength, const STR& extra);
+        static STR  statusHeaders(int statusCode);
+        static STR  entityHeaders(const STR& contentType, size_t contentLength, const STR& extra);
+        bool    takeBodyFile(int &fd, off_t &offset, size_t &length);
+        static STR  createErrorResponse(int statusCode, const STR& contentType, const STR& body, AConfigBase *base);
         STR     getResponse();
         void    clear();
 
         // CGI 통합 메소드
-        bool    isResponseReady() const { return _state != PROCESSING_CGI && _state != PROCESSING_POST; }
+        bool    isResponseReady() const { return _state != PROCESSING_CGI && _state != PROCESSING_POST && _state != PROCESSING_PROXY && _state != DELAYED; }
+        bool    isDelayed() const { return _state == DELAYED; }
+        long long getDelayMs() const { return _delay_ms; }
+        long long getRoutingUs() const { return _routing_us; }
         int     getCgiOutputFd() const;
         bool    processCgiOutput();
         STR     getFinalResponse();
@@ -71,6 +109,13 @@ class Response {
         STR     handleDELETE(STR full_path);
         CgiHandler* getCgiHandler() const { return _cgi_handler; }
 
+        // proxy_pass
+        int     getUpstreamFd() const;
+        ProxyHandler* getProxyHandler() const { return _proxy_handler; }
+        LocationConfig* getProxyLocation() const { return _proxy_location; }
+        bool    retryProxy();
+        void    finishProxy();
+
 };
 
 #endif
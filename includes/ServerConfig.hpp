@@ -2,16 +2,22 @@
 # define SERVERCONFIG_HPP
 # include "AConfigBase.hpp"
 
+// "localhost" and "127.0.0.1", always the first entries of _server_name
+# define SERVER_NAME_BUILTIN 2
+
 struct LocationConfig;
+class LocationTrie;
 
 struct ServerConfig : AConfigBase {
 	int								_return_code;				//server, location
 	STR								_return_url;				//server, location
 	int								_listen_port;
-	STR								_listen_server;
+	STR								_listen_server;				// as printed by inet_ntop, IPv6 without brackets
+	bool							_listen_default;			// listen ... default_server
 	VECTOR<STR>						_server_name;
 
 	MAP<STR, LocationConfig*>		_locations;
+	LocationTrie					*_location_trie;			// _locations compiled for matching, built after parsing
 	void							_self_destruct();
 
 	ServerConfig() :
@@ -19,7 +25,9 @@ struct ServerConfig : AConfigBase {
 		_return_url(""),
         _listen_port(-1), //80 only if it's the only block
         _listen_server("0.0.0.0"),
-        _server_name()
+        _listen_default(false),
+        _server_name(),
+        _location_trie(NULL)
     {
 		_server_name.push_back("localhost");
 		_server_name.push_back("127.0.0.1");
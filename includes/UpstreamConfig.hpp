@@ -0,0 +1,86 @@
+#ifndef UPSTREAMCONFIG_HPP
+# define UPSTREAMCONFIG_HPP
+# include "AConfigBase.hpp"
+# include <ctime>
+# include <stdint.h>
+
+enum BalanceMethod {
+	BALANCE_ROUND_ROBIN,
+	BALANCE_LEAST_CONN,
+	BALANCE_HASH			// consistent hash ring over _hash_key
+};
+
+// one "server" line of an upstream block, with the balancer's state for it
+struct UpstreamServer {
+	STR			_host;
+	int			_port;
+	struct sockaddr_in	_addr;		// resolved once per configuration
+	int			_weight;
+	int			_max_fails;			// 0 = never marked down by passive checks
+	int			_fail_timeout;		// seconds
+
+	// runtime state
+	int			_active;			// requests in flight
+	int			_current_weight;	// smooth weighted round robin
+	int			_fails;
+	time_t		_fail_window_start;
+	time_t		_down_until;
+	bool		_healthy;			// result of the active health checks
+	int			_probe_fd;
+	time_t		_probe_started;
+	time_t		_next_probe;
+	bool		_probe_sent;
+	STR			_probe_buffer;
+	int			_probe_fails;		// consecutive results, for fails= and passes=
+	int			_probe_passes;
+
+	UpstreamServer() :
+		_host(""),
+		_port(80),
+		_weight(1),
+		_max_fails(1),
+		_fail_timeout(10),
+		_active(0),
+		_current_weight(0),
+		_fails(0),
+		_fail_window_start(0),
+		_down_until(0),
+		_healthy(true),
+		_probe_fd(-1),
+		_probe_started(0),
+		_next_probe(0),
+		_probe_sent(false),
+		_probe_buffer(""),
+		_probe_fails(0),
+		_probe_passes(0)
+	{
+		memset(&_addr, 0, sizeof(_addr));
+	}
+};
+
+struct UpstreamConfig : AConfigBase {
+	STR								_name;
+	VECTOR<UpstreamServer>			_upstream_servers;
+	BalanceMethod					_balance;
+	STR								_hash_key;					// $remote_addr, $request_uri or $host
+	STR								_health_check_uri;			// "" = no active checks
+	int								_health_check_interval;		// seconds
+	int								_health_check_fails;		// failed probes before a server is down
+	int								_health_check_passes;		// good probes before it is up again
+
+	VECTOR<std::pair<uint32_t, int> >	_hash_ring;				// point -> server index, built on first use
+
+	void							_self_destruct();
+
+	UpstreamConfig() :
+		_name(""),
+		_balance(BALANCE_ROUND_ROBIN),
+		_hash_key(""),
+		_health_check_uri(""),
+		_health_check_interval(5),
+		_health_check_fails(1),
+		_health_check_passes(1)
+	{}
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef UPSTREAMPOOL_HPP
+#define UPSTREAMPOOL_HPP
+
+#include <map>
+#include <vector>
+#include <ctime>
+#include "AConfigBase.hpp"
+#include "Utils.hpp"
+
+// idle keep-alive connections kept per upstream, and for how long
+# define UPSTREAM_KEEPALIVE 16
+# define UPSTREAM_KEEPALIVE_TIMEOUT 60
+
+/*
+	Keep-alive connections to upstream servers, keyed by "host:port".
+	A connection is only handed back once its response was read completely,
+	and it is never registered in epoll while it sits in the pool.
+*/
+class UpstreamPool {
+	public:
+		static int	acquire(const STR &key);
+		static void	release(const STR &key, int fd);
+		static void	cleanup(time_t now);
+		static void	closeAll();
+
+	private:
+		struct IdleConnection {
+			int		fd;
+			time_t	since;
+		};
+
+		static std::map<STR, std::vector<IdleConnection> >	_idle;
+		static time_t										_last_cleanup;
+};
+
+#endif
@@ -7,6 +7,13 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <utility>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// per-client limits: address family, then the IPv4 address or the IPv6 /64 prefix
+typedef std::pair<int, uint64_t>	ClientKey;
 
 class Utils {
 	public:
@@ -14,6 +21,12 @@ class Utils {
 		static std::string floatToString(float num);
 		static void cleanUpDoublePointer(char **dptr);
 		static std::vector<std::string> split(std::string string, char delim, bool use_whitespaces_delim);
+		static long long nowMs(void);
+		static long long nowUs(void);
+		static std::string addressToString(const struct sockaddr *addr);
+		static int addressPort(const struct sockaddr *addr);
+		static ClientKey addressKey(const struct sockaddr *addr);
+		static uint64_t hash(const std::string &value);
 
 };
 
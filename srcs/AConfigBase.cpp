@@ -1,6 +1,7 @@
 #include "HttpConfig.hpp"
 #include "ServerConfig.hpp"
 #include "LocationConfig.hpp"
+#include "UpstreamConfig.hpp"
 
 ConfigBlock AConfigBase::_identify(AConfigBase* elem) {
 	if (HttpConfig* httpConf = dynamic_cast<HttpConfig*>(elem)) {
@@ -9,6 +10,8 @@ ConfigBlock AConfigBase::_identify(AConfigBase* elem) {
 		return SERVER;
 	} else if (LocationConfig* locConf = dynamic_cast<LocationConfig*>(elem)) {
 		return LOCATION;
+	} else if (dynamic_cast<UpstreamConfig*>(elem)) {
+		return UPSTREAM;
 	}
 	return ERROR;
 }
@@ -0,0 +1,265 @@
+#include "AccessLog.hpp"
+#include "Request.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include "Clock.hpp"
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <strings.h>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+
+enum LogVariable {
+	VAR_REMOTE_ADDR,
+	VAR_REMOTE_PORT,
+	VAR_TIME_LOCAL,
+	VAR_TIME_ISO8601,
+	VAR_MSEC,
+	VAR_REQUEST,
+	VAR_REQUEST_METHOD,
+	VAR_REQUEST_URI,
+	VAR_SERVER_PROTOCOL,
+	VAR_STATUS,
+	VAR_BYTES_SENT,
+	VAR_BODY_BYTES_SENT,
+	VAR_REQUEST_TIME,
+	VAR_REQUEST_LENGTH,
+	VAR_HOST,
+	VAR_HTTP,			// $http_<header>, dashes written as underscores
+	VAR_COUNT
+};
+
+static const char *variable_names[VAR_HTTP] = {
+	"remote_addr", "remote_port", "time_local", "time_iso8601", "msec", "request",
+	"request_method", "request_uri", "server_protocol", "status", "bytes_sent",
+	"body_bytes_sent", "request_time", "request_length", "host"
+};
+
+STR							AccessLog::_path = "";
+int							AccessLog::_fd = -1;
+VECTOR<AccessLog::Segment>	AccessLog::_segments;
+VECTOR<char>				AccessLog::_ring;
+size_t						AccessLog::_head = 0;
+size_t						AccessLog::_used = 0;
+int							AccessLog::_flush_ms = 1000;
+long long					AccessLog::_oldest_ms = 0;
+
+// splits the format into literal text and variables, false on an unknown variable
+bool AccessLog::compile(const STR &format, VECTOR<Segment> &segments) {
+	segments.clear();
+	size_t pos = 0;
+	while (pos < format.size()) {
+		size_t dollar = format.find('$', pos);
+		if (dollar != pos) {
+			Segment literal;
+			literal.variable = -1;
+			literal.text = format.substr(pos, dollar == STR::npos ? STR::npos : dollar - pos);
+			segments.push_back(literal);
+			if (dollar == STR::npos)
+				break;
+		}
+
+		size_t end = dollar + 1;
+		while (end < format.size() && (isalnum(format[end]) || format[end] == '_'))
+			end++;
+		STR name = format.substr(dollar + 1, end - dollar - 1);
+		Segment variable;
+		variable.variable = -1;
+		if (name.compare(0, 5, "http_") == 0 && name.size() > 5) {
+			variable.variable = VAR_HTTP;
+			variable.text = name.substr(5);
+			for (size_t i = 0; i < variable.text.size(); i++)
+				variable.text[i] = variable.text[i] == '_' ? '-' : variable.text[i];
+		}
+		for (int i = 0; i < VAR_HTTP && variable.variable == -1; i++) {
+			if (name == variable_names[i])
+				variable.variable = i;
+		}
+		if (variable.variable == -1) {
+			LOG(Logger::ERROR, "Unknown log_format variable $" + name);
+			return false;
+		}
+		segments.push_back(variable);
+		pos = end;
+	}
+	return true;
+}
+
+// also on reload: what the old configuration buffered is written to the old file first
+void AccessLog::init(HttpConfig *config) {
+	flush();
+	close();
+	_path = config->_access_log;
+	_flush_ms = config->_access_log_flush * 1000;
+	_ring.assign(config->_access_log_buffer, 0);
+	_head = 0;
+	_used = 0;
+	if (_path == "")
+		return;
+
+	STR format = ACCESS_LOG_COMBINED;
+	if (config->_access_log_format != "combined")
+		format = config->_log_formats[config->_access_log_format];
+	compile(format, _segments);	// checked by the parser already
+	open();
+}
+
+void AccessLog::open() {
+	_fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd < 0)
+		LOG(Logger::ERROR, "AccessLog: cannot open " + _path + ": " + STR(strerror(errno)));
+}
+
+void AccessLog::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
+
+// SIGUSR1: the file was moved away by log rotation, continue in a new one
+void AccessLog::reopen() {
+	if (_path == "")
+		return;
+	flush();
+	close();
+	open();
+	LOG(Logger::INFO, "AccessLog: reopened " + _path);
+}
+
+void AccessLog::log(const AccessLogEntry &entry) {
+	if (_path == "")
+		return;
+
+	const Request &request = *entry.request;
+	STR request_line = request._full_request.substr(0, request._full_request.find("\r\n"));
+	STR line;
+	for (size_t i = 0; i < _segments.size(); i++) {
+		const Segment &segment = _segments[i];
+		STR value;
+		switch (segment.variable) {
+			case -1: line += segment.text; continue;
+			case VAR_REMOTE_ADDR: value = entry.remote_addr; break;
+			case VAR_REMOTE_PORT: value = Utils::intToString(entry.remote_port); break;
+			case VAR_TIME_LOCAL: value = Clock::timeLocal(); break;
+			case VAR_TIME_ISO8601: value = Clock::timeIso8601(); break;
+			case VAR_MSEC: {
+				struct timeval tv;
+				char buf[32];
+				gettimeofday(&tv, NULL);
+				snprintf(buf, sizeof(buf), "%ld.%03ld", (long)tv.tv_sec, (long)tv.tv_usec / 1000);
+				value = buf;
+				break;
+			}
+			case VAR_REQUEST: value = request_line; break;
+			case VAR_REQUEST_METHOD: value = request._method; break;
+			case VAR_REQUEST_URI: {
+				size_t start = request_line.find(' ');
+				size_t end = request_line.rfind(' ');
+				if (start != STR::npos && end > start)
+					value = request_line.substr(start + 1, end - start - 1);
+				break;
+			}
+			case VAR_SERVER_PROTOCOL: value = request._http_version; break;
+			case VAR_STATUS: value = entry.status ? Utils::intToString(entry.status) : "000"; break;
+			case VAR_BYTES_SENT: {
+				std::ostringstream out;
+				out << entry.bytes_sent;
+				value = out.str();
+				break;
+			}
+			case VAR_BODY_BYTES_SENT: {
+				std::ostringstream out;
+				out << entry.body_bytes_sent;
+				value = out.str();
+				break;
+			}
+			case VAR_REQUEST_TIME: {
+				char buf[32];
+				snprintf(buf, sizeof(buf), "%lld.%03lld", entry.request_time_us / 1000000,
+					entry.request_time_us / 1000 % 1000);
+				value = buf;
+				break;
+			}
+			case VAR_REQUEST_LENGTH: value = Utils::intToString(request._full_request.size()); break;
+			case VAR_HOST: value = request._host; break;
+			case VAR_HTTP: value = headerValue(request, segment.text); break;
+		}
+		line += value == "" ? "-" : value;
+	}
+	append(line + "\n");
+}
+
+// headers of the request as received, looked up only when the format asks for one
+STR AccessLog::headerValue(const Request &request, const STR &name) {
+	const STR &raw = request._full_request;
+	size_t head_end = raw.find("\r\n\r\n");
+	size_t pos = raw.find("\r\n");
+	while (pos != STR::npos && pos < head_end) {
+		pos += 2;
+		size_t colon = pos + name.size();
+		if (colon < raw.size() && raw[colon] == ':' && strncasecmp(raw.c_str() + pos, name.c_str(), name.size()) == 0) {
+			size_t start = raw.find_first_not_of(" \t", colon + 1);
+			size_t end = raw.find("\r\n", colon);
+			if (start == STR::npos || start >= end)
+				return "";
+			return raw.substr(start, end - start);
+		}
+		pos = raw.find("\r\n", pos);
+	}
+	return "";
+}
+
+void AccessLog::append(const STR &line) {
+	if (line.size() > _ring.size() - _used)
+		flush();
+	if (line.size() > _ring.size() - _used) {
+		// longer than the whole buffer, straight to the file
+		if (_fd >= 0 && write(_fd, line.data(), line.size()) < 0)
+			LOG(Logger::ERROR, "AccessLog: write failed: " + STR(strerror(errno)));
+		return;
+	}
+
+	if (_used == 0)
+		_oldest_ms = Utils::nowMs();
+	size_t tail = (_head + _used) % _ring.size();
+	size_t first = std::min(line.size(), _ring.size() - tail);
+	memcpy(&_ring[tail], line.data(), first);
+	memcpy(&_ring[0], line.data() + first, line.size() - first);
+	_used += line.size();
+}
+
+void AccessLog::tick(long long now_ms) {
+	if (_used > 0 && now_ms - _oldest_ms >= _flush_ms)
+		flush();
+}
+
+// the buffered lines in at most two pieces, what a short write leaves stays for the next flush
+void AccessLog::flush() {
+	if (_used == 0)
+		return;
+	if (_fd < 0) {
+		_head = 0;
+		_used = 0;
+		return;
+	}
+
+	struct iovec iov[2];
+	size_t first = std::min(_used, _ring.size() - _head);
+	iov[0].iov_base = &_ring[_head];
+	iov[0].iov_len = first;
+	iov[1].iov_base = &_ring[0];
+	iov[1].iov_len = _used - first;
+	ssize_t written = writev(_fd, iov, iov[1].iov_len ? 2 : 1);
+	if (written < 0) {
+		LOG(Logger::ERROR, "AccessLog: write failed: " + STR(strerror(errno)));
+		written = _used;	// dropped, the buffer must not fill up for good
+	}
+
+	_head = (_head + written) % _ring.size();
+	_used -= written;
+	if (_used == 0)
+		_head = 0;
+	else
+		_oldest_ms = Utils::nowMs();
+}
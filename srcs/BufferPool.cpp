@@ -0,0 +1,61 @@
+#include "BufferPool.hpp"
+
+const size_t		BufferPool::_sizes[BUFFER_POOL_CLASSES] = {4 * 1024, 16 * 1024, 64 * 1024};
+std::vector<char*>	BufferPool::_free[BUFFER_POOL_CLASSES];
+size_t				BufferPool::_used = 0;
+
+// smallest chunk holding wanted bytes, the largest one if none does
+char *BufferPool::acquire(size_t wanted, size_t &size) {
+	int index = 0;
+	while (index < BUFFER_POOL_CLASSES - 1 && _sizes[index] < wanted)
+		index++;
+	size = _sizes[index];
+	_used += size;
+	if (_free[index].empty())
+		return new char[size];
+	char *chunk = _free[index].back();
+	_free[index].pop_back();
+	return chunk;
+}
+
+void BufferPool::release(char *chunk, size_t size) {
+	int index = sizeClass(size);
+	_used -= size;
+	if (index < 0 || _free[index].size() * size >= BUFFER_POOL_KEEP) {
+		delete[] chunk;
+		return;
+	}
+	_free[index].push_back(chunk);
+}
+
+// frees the kept chunks, on shutdown
+void BufferPool::purge() {
+	for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+		for (size_t j = 0; j < _free[i].size(); j++)
+			delete[] _free[i][j];
+		_free[i].clear();
+	}
+}
+
+size_t BufferPool::usedBytes() {
+	return _used;
+}
+
+size_t BufferPool::freeBytes() {
+	size_t bytes = 0;
+	for (int i = 0; i < BUFFER_POOL_CLASSES; i++)
+		bytes += _free[i].size() * _sizes[i];
+	return bytes;
+}
+
+size_t BufferPool::largest() {
+	return _sizes[BUFFER_POOL_CLASSES - 1];
+}
+
+int BufferPool::sizeClass(size_t size) {
+	for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+		if (_sizes[i] == size)
+			return i;
+	}
+	return -1;
+}
@@ -0,0 +1,71 @@
+#include "Clock.hpp"
+
+time_t	Clock::_now = 0;
+time_t	Clock::_formatted = 0;
+STR		Clock::_http_date = "";
+STR		Clock::_log_time = "";
+STR		Clock::_time_local = "";
+STR		Clock::_time_iso8601 = "";
+
+// once per event loop iteration
+void Clock::tick() {
+	_now = time(NULL);
+}
+
+time_t Clock::now() {
+	return _now ? _now : time(NULL);
+}
+
+// IMF-fixdate of RFC 7231, "Sun, 06 Nov 1994 08:49:37 GMT"
+const STR &Clock::httpDate() {
+	update();
+	return _http_date;
+}
+
+// the same format for any other time, Last-Modified
+STR Clock::httpDate(time_t time) {
+	if (time == _formatted && _formatted)
+		return _http_date;
+	struct tm tm;
+	char buf[40];
+	gmtime_r(&time, &tm);
+	strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+// error_log, "2024-11-06 08:49:37"
+const STR &Clock::logTime() {
+	update();
+	return _log_time;
+}
+
+// access_log $time_local, "06/Nov/1994:08:49:37 +0000"
+const STR &Clock::timeLocal() {
+	update();
+	return _time_local;
+}
+
+// access_log $time_iso8601, "1994-11-06T08:49:37+0000"
+const STR &Clock::timeIso8601() {
+	update();
+	return _time_iso8601;
+}
+
+void Clock::update() {
+	time_t current = now();
+	if (current == _formatted)
+		return;
+
+	struct tm local;
+	char buf[64];
+	localtime_r(&current, &local);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %X", &local);
+	_log_time = buf;
+	strftime(buf, sizeof(buf), "%d/%b/%Y:%H:%M:%S %z", &local);
+	_time_local = buf;
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", &local);
+	_time_iso8601 = buf;
+
+	_http_date = httpDate(current);
+	_formatted = current;
+}
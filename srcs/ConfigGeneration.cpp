@@ -0,0 +1,49 @@
+#include "ConfigGeneration.hpp"
+#include "ServerConfig.hpp"
+#include "LocationConfig.hpp"
+#include "RateLimiter.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+ConfigGeneration::ConfigGeneration(HttpConfig *config, int number) : _config(config), _number(number), _refs(1) {}
+
+ConfigGeneration::~ConfigGeneration() {
+	for (std::map<ListenKey, Listener*>::iterator it = _listeners.begin(); it != _listeners.end(); ++it) {
+		delete it->second;
+	}
+	// limit_req buckets are keyed by location, the addresses may be reused
+	for (size_t i = 0; i < _config->_servers.size(); i++) {
+		forgetLocations(_config->_servers[i]->_locations);
+	}
+	_config->_self_destruct();
+}
+
+void ConfigGeneration::retain() {
+	_refs++;
+}
+
+void ConfigGeneration::release() {
+	if (--_refs > 0)
+		return;
+	LOG(Logger::INFO, "Configuration generation " + Utils::intToString(_number) + " released");
+	delete this;
+}
+
+HttpConfig *ConfigGeneration::config() const {
+	return _config;
+}
+
+int ConfigGeneration::number() const {
+	return _number;
+}
+
+std::map<ListenKey, Listener*> &ConfigGeneration::listeners() {
+	return _listeners;
+}
+
+void ConfigGeneration::forgetLocations(MAP<STR, LocationConfig*> &locations) {
+	for (MAP<STR, LocationConfig*>::iterator it = locations.begin(); it != locations.end(); ++it) {
+		RateLimiter::forget(it->second);
+		forgetLocations(it->second->_locations);
+	}
+}
@@ -0,0 +1,406 @@
+#include "DirListing.hpp"
+#include "Clock.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MAP<STR, DirListing::Listing>	DirListing::_cache;
+size_t							DirListing::_cached_entries = 0;
+unsigned long					DirListing::_uses = 0;
+size_t							DirListing::_rescans = 0;
+
+struct DirListing::ByName {
+	bool operator()(const Entry &a, const Entry &b) const {
+		if (a.dir != b.dir)
+			return a.dir;
+		return a.name < b.name;
+	}
+};
+
+struct DirListing::BySize {
+	const VECTOR<Entry> &entries;
+	BySize(const VECTOR<Entry> &e) : entries(e) {}
+	bool operator()(uint32_t a, uint32_t b) const {
+		if (entries[a].size != entries[b].size)
+			return entries[a].size < entries[b].size;
+		return a < b;
+	}
+};
+
+struct DirListing::ByTime {
+	const VECTOR<Entry> &entries;
+	ByTime(const VECTOR<Entry> &e) : entries(e) {}
+	bool operator()(uint32_t a, uint32_t b) const {
+		if (entries[a].mtime != entries[b].mtime)
+			return entries[a].mtime < entries[b].mtime;
+		return a < b;
+	}
+};
+
+/*
+	Fills body with one page of the listing of path, uri being how the client
+	named it. False when the directory cannot be read.
+*/
+bool DirListing::render(const STR &path, const STR &uri, const STR &query, bool json,
+	size_t page_size, STR &body) {
+	Listing *listing = load(path);
+	if (!listing)
+		return false;
+
+	DirSort sort = DIR_SORT_NAME;
+	bool desc = false;
+	size_t page = 1;
+	parseQuery(query, sort, desc, page);
+
+	size_t total = listing->entries.size();
+	size_t pages = 1;
+	size_t first = 0;
+	size_t last = total;
+	if (page_size > 0) {
+		pages = total ? (total + page_size - 1) / page_size : 1;
+		if (page > pages)
+			page = pages;
+		first = (page - 1) * page_size;
+		last = std::min(total, first + page_size);
+	}
+
+	const VECTOR<uint32_t> *sorted = sort == DIR_SORT_NAME ? NULL : &order(*listing, sort);
+	if (json) {
+		renderJson(*listing, sorted, desc, first, last, body);
+		return true;
+	}
+
+	static const char *sort_names[DIR_SORTS] = { "name", "size", "time" };
+	STR query_sort = STR("sort=") + sort_names[sort] + (desc ? "&order=desc" : "");
+	renderHtml(*listing, sorted, desc, first, last, page, pages, uri, query_sort, body);
+	return true;
+}
+
+/*
+	The cached listing, even when the directory changed since: a rescan then
+	starts in the background and tick() swaps it in. Only a directory never
+	listed before, or replaced by another one, is read here in full.
+*/
+DirListing::Listing *DirListing::load(const STR &path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+		LOG(Logger::ERROR, "DirListing: cannot stat " + path + ": " + STR(strerror(errno)));
+		return NULL;
+	}
+
+	MAP<STR, Listing>::iterator it = _cache.find(path);
+	if (it != _cache.end() && it->second.ino == st.st_ino) {
+		Listing &cached = it->second;
+		cached.last_used = ++_uses;
+		if (cached.rescan || (cached.mtime == st.st_mtim.tv_sec && cached.mtime_nsec == st.st_mtim.tv_nsec))
+			return &cached;
+
+		Scan *rescan = new Scan();
+		if (!openScan(path, st, *rescan)) {
+			delete rescan;
+			return &cached;
+		}
+		cached.rescan = rescan;
+		_rescans++;
+		LOG(Logger::DEBUG, "DirListing: " + path + " changed, reading it again");
+		return &cached;
+	}
+	if (it != _cache.end())
+		drop(it);
+
+	Scan scan;
+	size_t budget = (size_t)-1;
+	if (!openScan(path, st, scan))
+		return NULL;
+	readScan(scan, budget);
+	closeScan(scan);
+
+	evict(scan.entries.size(), NULL);
+	Listing &stored = _cache[path];
+	stored.rescan = NULL;
+	stored.last_used = ++_uses;
+	replace(stored, scan);
+	return &stored;
+}
+
+// advances the running rescans by DIR_LISTING_SCAN_STEP entries in all
+void DirListing::tick() {
+	size_t budget = DIR_LISTING_SCAN_STEP;
+	for (MAP<STR, Listing>::iterator it = _cache.begin(); _rescans > 0 && budget > 0 && it != _cache.end(); ++it) {
+		Listing &listing = it->second;
+		if (!listing.rescan || !readScan(*listing.rescan, budget))
+			continue;
+
+		Scan *done = listing.rescan;
+		listing.rescan = NULL;
+		_rescans--;
+		closeScan(*done);
+		_cached_entries -= listing.entries.size();
+		evict(done->entries.size(), &listing);
+		replace(listing, *done);
+		delete done;
+	}
+}
+
+// true while a rescan still has entries to read, the loop should not sleep
+bool DirListing::scanning() {
+	return _rescans > 0;
+}
+
+// on shutdown, with the rescans still open
+void DirListing::clear() {
+	while (!_cache.empty())
+		drop(_cache.begin());
+}
+
+bool DirListing::openScan(const STR &path, const struct stat &st, Scan &scan) {
+	scan.fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	scan.dir = scan.fd >= 0 ? fdopendir(scan.fd) : NULL;
+	if (!scan.dir) {
+		LOG(Logger::ERROR, "Failed to open directory: " + path + " Reason: " + strerror(errno));
+		if (scan.fd >= 0)
+			close(scan.fd);
+		scan.fd = -1;
+		return false;
+	}
+	scan.st = st;
+	return true;
+}
+
+/*
+	readdir() hands out what one getdents64 call returned before it makes the
+	next; each entry is looked up relative to the open directory, no path is
+	built or resolved again. Entries that vanish in between are left out.
+	Reads until budget entries are used up; true once the directory is done.
+*/
+bool DirListing::readScan(Scan &scan, size_t &budget) {
+	struct dirent *entry;
+	struct stat st;
+	while (budget > 0) {
+		if ((entry = readdir(scan.dir)) == NULL)
+			return true;
+		budget--;
+		const char *name = entry->d_name;
+		if ((name[0] == '.' && name[1] == '\0') || (name[0] == '.' && name[1] == '.' && name[2] == '\0'))
+			continue;
+		if (fstatat(scan.fd, name, &st, 0) < 0)
+			continue;
+
+		scan.entries.push_back(Entry());
+		Entry &added = scan.entries.back();
+		added.name = name;
+		added.dir = S_ISDIR(st.st_mode);
+		added.size = st.st_size;
+		added.mtime = st.st_mtime;
+	}
+	return false;
+}
+
+void DirListing::closeScan(Scan &scan) {
+	if (scan.dir)
+		closedir(scan.dir);
+	scan.dir = NULL;
+	scan.fd = -1;
+}
+
+// the entries of a finished scan become the listing, stamped with the directory as it was when the scan began
+void DirListing::replace(Listing &listing, Scan &scan) {
+	std::sort(scan.entries.begin(), scan.entries.end(), ByName());
+	listing.entries.swap(scan.entries);
+	for (int i = 0; i < DIR_SORTS; i++)
+		VECTOR<uint32_t>().swap(listing.orders[i]);
+	listing.mtime = scan.st.st_mtim.tv_sec;
+	listing.mtime_nsec = scan.st.st_mtim.tv_nsec;
+	listing.ino = scan.st.st_ino;
+	_cached_entries += listing.entries.size();
+	LOG(Logger::DEBUG, "DirListing: read " + Utils::intToString(listing.entries.size()) + " entries");
+}
+
+void DirListing::drop(MAP<STR, Listing>::iterator it) {
+	if (it->second.rescan) {
+		closeScan(*it->second.rescan);
+		delete it->second.rescan;
+		_rescans--;
+	}
+	_cached_entries -= it->second.entries.size();
+	_cache.erase(it);
+}
+
+// makes room for a listing of incoming entries, the one being added (or keep) always stays
+void DirListing::evict(size_t incoming, const Listing *keep) {
+	while (_cache.size() >= DIR_LISTING_CACHE + (keep != NULL) ||
+		_cached_entries + incoming > DIR_LISTING_CACHE_ENTRIES) {
+		MAP<STR, Listing>::iterator oldest = _cache.end();
+		for (MAP<STR, Listing>::iterator it = _cache.begin(); it != _cache.end(); ++it) {
+			if (&it->second != keep && (oldest == _cache.end() || it->second.last_used < oldest->second.last_used))
+				oldest = it;
+		}
+		if (oldest == _cache.end())
+			return;
+		drop(oldest);
+	}
+}
+
+const VECTOR<uint32_t> &DirListing::order(Listing &listing, DirSort sort) {
+	VECTOR<uint32_t> &sorted = listing.orders[sort];
+	if (sorted.size() == listing.entries.size())
+		return sorted;
+
+	sorted.resize(listing.entries.size());
+	for (size_t i = 0; i < sorted.size(); i++)
+		sorted[i] = i;
+	if (sort == DIR_SORT_SIZE)
+		std::sort(sorted.begin(), sorted.end(), BySize(listing.entries));
+	else
+		std::sort(sorted.begin(), sorted.end(), ByTime(listing.entries));
+	return sorted;
+}
+
+// unknown parameters and values are ignored
+void DirListing::parseQuery(const STR &query, DirSort &sort, bool &desc, size_t &page) {
+	VECTOR<STR> params = Utils::split(query, '&', 0);
+	for (size_t i = 0; i < params.size(); i++) {
+		size_t eq = params[i].find('=');
+		if (eq == STR::npos)
+			continue;
+		STR name = params[i].substr(0, eq);
+		STR value = params[i].substr(eq + 1);
+
+		if (name == "sort" && value == "name")
+			sort = DIR_SORT_NAME;
+		else if (name == "sort" && value == "size")
+			sort = DIR_SORT_SIZE;
+		else if (name == "sort" && value == "time")
+			sort = DIR_SORT_TIME;
+		else if (name == "order")
+			desc = value == "desc";
+		else if (name == "page" && atol(value.c_str()) > 0)
+			page = atol(value.c_str());
+	}
+}
+
+void DirListing::renderHtml(const Listing &listing, const VECTOR<uint32_t> *order, bool desc,
+	size_t first, size_t last, size_t page, size_t pages,
+	const STR &uri, const STR &query_sort, STR &body) {
+	STR base;
+	appendUri(base, uri);
+	if (base.empty() || base[base.size() - 1] != '/')
+		base += '/';
+	STR title;
+	appendHtml(title, uri);
+
+	body.clear();
+	body.reserve((last - first) * 128 + 512);
+	body += "<html><head><title>Index of " + title + "</title></head><body>\n";
+	body += "<h1>Index of " + title + "</h1><hr>";
+	body += "<a href=\"?sort=name\">Name</a> <a href=\"?sort=time&order=desc\">Modified</a> "
+		"<a href=\"?sort=size&order=desc\">Size</a><pre>\n";
+	body += "<a href=\"" + base + "../\">../</a>\n";
+
+	char line[96];
+	struct tm tm;
+	size_t total = listing.entries.size();
+	for (size_t i = first; i < last; i++) {
+		size_t pos = desc ? total - 1 - i : i;
+		const Entry &entry = listing.entries[order ? (*order)[pos] : pos];
+
+		body += "<a href=\"" + base;
+		appendUri(body, entry.name);
+		body += entry.dir ? "/\">" : "\">";
+		appendHtml(body, entry.name);
+		body += entry.dir ? "/</a> " : "</a> ";
+		localtime_r(&entry.mtime, &tm);
+		size_t n = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm);
+		snprintf(line + n, sizeof(line) - n, " %lld\n", entry.size);
+		body += line;
+	}
+
+	body += "</pre><hr>";
+	if (pages > 1) {
+		if (page > 1)
+			body += "<a href=\"?" + query_sort + "&page=" + Utils::intToString(page - 1) + "\">previous</a> ";
+		body += "page " + Utils::intToString(page) + " of " + Utils::intToString(pages);
+		if (page < pages)
+			body += " <a href=\"?" + query_sort + "&page=" + Utils::intToString(page + 1) + "\">next</a>";
+	}
+	body += "</body></html>";
+}
+
+// like nginx autoindex_format json
+void DirListing::renderJson(const Listing &listing, const VECTOR<uint32_t> *order, bool desc,
+	size_t first, size_t last, STR &body) {
+	body.clear();
+	body.reserve((last - first) * 112 + 8);
+	body += "[";
+
+	char line[64];
+	size_t total = listing.entries.size();
+	for (size_t i = first; i < last; i++) {
+		size_t pos = desc ? total - 1 - i : i;
+		const Entry &entry = listing.entries[order ? (*order)[pos] : pos];
+
+		body += i == first ? "\n{ \"name\":\"" : ",\n{ \"name\":\"";
+		appendJson(body, entry.name);
+		body += entry.dir ? "\", \"type\":\"directory\", \"mtime\":\"" : "\", \"type\":\"file\", \"mtime\":\"";
+		body += Clock::httpDate(entry.mtime);
+		if (entry.dir) {
+			body += "\" }";
+			continue;
+		}
+		snprintf(line, sizeof(line), "\", \"size\":%lld }", entry.size);
+		body += line;
+	}
+	body += "\n]\n";
+}
+
+void DirListing::appendHtml(STR &out, const STR &text) {
+	for (size_t i = 0; i < text.size(); i++) {
+		switch (text[i]) {
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			case '&': out += "&amp;"; break;
+			case '"': out += "&quot;"; break;
+			default: out += text[i];
+		}
+	}
+}
+
+// everything but unreserved characters and '/'
+void DirListing::appendUri(STR &out, const STR &text) {
+	static const char digits[] = "0123456789ABCDEF";
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = text[i];
+		if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/') {
+			out += c;
+			continue;
+		}
+		out += '%';
+		out += digits[c >> 4];
+		out += digits[c & 0xf];
+	}
+}
+
+void DirListing::appendJson(STR &out, const STR &text) {
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = text[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (c < 0x20) {
+			out += "\\u00";
+			out += digits[c >> 4];
+			out += digits[c & 0xf];
+		} else {
+			out += c;
+		}
+	}
+}
@@ -1,5 +1,6 @@
 #include "HttpConfig.hpp"
 #include "ServerConfig.hpp"
+#include "UpstreamConfig.hpp"
 
 void HttpConfig::_self_destruct() {
 	for (size_t i = 0; i < _servers.size(); i++) {
@@ -7,5 +8,10 @@ void HttpConfig::_self_destruct() {
 			_servers[i]->_self_destruct();
 		_servers[i] = NULL;
 	}
+	for (size_t i = 0; i < _upstreams.size(); i++) {
+		if (_upstreams[i])
+			_upstreams[i]->_self_destruct();
+		_upstreams[i] = NULL;
+	}
 	delete (this);
 }
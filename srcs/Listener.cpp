@@ -0,0 +1,168 @@
+#include "Listener.hpp"
+#include "ServerConfig.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+
+Listener::Listener(const STR &address, int port, ConfigGeneration *generation) : _address(address), _port(port),
+	_generation(generation), _default_server(NULL),
+	_buckets(16), _names(0) {}
+
+Listener::~Listener() {
+	destroy(&_suffix);
+	destroy(&_prefix);
+}
+
+const STR &Listener::address() const {
+	return _address;
+}
+
+int Listener::port() const {
+	return _port;
+}
+
+ServerConfig *Listener::defaultServer() const {
+	return _default_server;
+}
+
+ConfigGeneration *Listener::generation() const {
+	return _generation;
+}
+
+bool Listener::isWildcard() const {
+	return _address == "0.0.0.0" || _address == "::";
+}
+
+void Listener::addServer(ServerConfig *server) {
+	if (!_default_server || server->_listen_default)
+		_default_server = server;
+	for (size_t i = 0; i < server->_server_name.size(); i++) {
+		addName(server->_server_name[i], server);
+	}
+}
+
+/*
+	Names are case-insensitive. A name already taken on this listener keeps
+	its first server; ".example.com" stands for example.com and *.example.com.
+*/
+void Listener::addName(STR name, ServerConfig *server) {
+	for (size_t i = 0; i < name.size(); i++)
+		name[i] = tolower(name[i]);
+	if (name.size() > 1 && name[name.size() - 1] == '.')
+		name.erase(name.size() - 1);
+	if (name == "")
+		return;
+
+	if (name[0] == '.') {
+		addName(name.substr(1), server);
+		name = "*" + name;
+	}
+	if (name.size() > 2 && name.compare(0, 2, "*.") == 0)
+		addWildcard(&_suffix, splitLabels(name.substr(2), true), server);
+	else if (name.size() > 2 && name.compare(name.size() - 2, 2, ".*") == 0)
+		addWildcard(&_prefix, splitLabels(name.substr(0, name.size() - 2), false), server);
+	else if (name.find('*') != STR::npos)
+		LOG(Logger::WARNING, "Unsupported wildcard server_name \"" + name + "\" ignored");
+	else
+		addExact(name, server);
+}
+
+ServerConfig *Listener::findServer(const STR &host) const {
+	STR name = host;
+	for (size_t i = 0; i < name.size(); i++)
+		name[i] = tolower(name[i]);
+	if (name.size() > 1 && name[name.size() - 1] == '.')
+		name.erase(name.size() - 1);
+
+	ServerConfig *server = findExact(name);
+	if (server)
+		return server;
+
+	server = findWildcard(&_suffix, splitLabels(name, true));
+	if (server)
+		return server;
+	server = findWildcard(&_prefix, splitLabels(name, false));
+	if (server)
+		return server;
+	return _default_server;
+}
+
+void Listener::addExact(const STR &name, ServerConfig *server) {
+	if (findExact(name)) {
+		LOG(Logger::DEBUG, "Conflicting server_name \"" + name + "\" on " + _address + ":" +
+			Utils::intToString(_port) + ", ignored");
+		return;
+	}
+	if (_names >= _buckets.size())
+		grow();
+	_buckets[Utils::hash(name) & (_buckets.size() - 1)].push_back(std::make_pair(name, server));
+	_names++;
+}
+
+ServerConfig *Listener::findExact(const STR &name) const {
+	const Bucket &bucket = _buckets[Utils::hash(name) & (_buckets.size() - 1)];
+	for (size_t i = 0; i < bucket.size(); i++) {
+		if (bucket[i].first == name)
+			return bucket[i].second;
+	}
+	return NULL;
+}
+
+// keeps at most one name per bucket on average, the size stays a power of two
+void Listener::grow() {
+	VECTOR<Bucket> buckets(_buckets.size() * 2);
+	for (size_t i = 0; i < _buckets.size(); i++) {
+		for (size_t j = 0; j < _buckets[i].size(); j++) {
+			buckets[Utils::hash(_buckets[i][j].first) & (buckets.size() - 1)].push_back(_buckets[i][j]);
+		}
+	}
+	_buckets.swap(buckets);
+}
+
+void Listener::addWildcard(Node *node, const VECTOR<STR> &labels, ServerConfig *server) {
+	for (size_t i = 0; i < labels.size(); i++) {
+		Node *&child = node->children[labels[i]];
+		if (!child)
+			child = new Node();
+		node = child;
+	}
+	if (!node->server)
+		node->server = server;
+}
+
+// deepest wildcard that still leaves at least one label of the name for the '*'
+ServerConfig *Listener::findWildcard(const Node *node, const VECTOR<STR> &labels) {
+	ServerConfig *found = NULL;
+	for (size_t i = 0; i + 1 < labels.size(); i++) {
+		MAP<STR, Node*>::const_iterator it = node->children.find(labels[i]);
+		if (it == node->children.end())
+			break;
+		node = it->second;
+		if (node->server)
+			found = node->server;
+	}
+	return found;
+}
+
+void Listener::destroy(Node *node) {
+	for (MAP<STR, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+		destroy(it->second);
+		delete it->second;
+	}
+	node->children.clear();
+}
+
+VECTOR<STR> Listener::splitLabels(const STR &name, bool reverse) {
+	VECTOR<STR> labels;
+	size_t start = 0;
+	while (start <= name.size()) {
+		size_t dot = name.find('.', start);
+		if (dot == STR::npos)
+			dot = name.size();
+		labels.push_back(name.substr(start, dot - start));
+		start = dot + 1;
+	}
+	if (reverse)
+		std::reverse(labels.begin(), labels.end());
+	return labels;
+}
@@ -0,0 +1,255 @@
+#include "LoadBalancer.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <cerrno>
+
+static STR serverName(const UpstreamServer &server) {
+	return server._host + ":" + Utils::intToString(server._port);
+}
+
+bool LoadBalancer::isAvailable(const UpstreamServer &server, time_t now) {
+	return server._healthy && now >= server._down_until;
+}
+
+// index of the server for this request, -1 when every server is down
+int LoadBalancer::pick(UpstreamConfig *upstream, const STR &hash_value) {
+	time_t now = time(NULL);
+	int server;
+
+	if (upstream->_balance == BALANCE_HASH)
+		server = pickHash(upstream, hash_value, now);
+	else
+		server = pickWeighted(upstream, now, upstream->_balance == BALANCE_LEAST_CONN);
+
+	if (server == -1) {
+		LOG(Logger::ERROR, "LoadBalancer: no live servers in upstream " + upstream->_name);
+		return -1;
+	}
+	upstream->_upstream_servers[server]._active++;
+	return server;
+}
+
+/*
+	Smooth weighted round robin: every available server gains its weight, the
+	one with the most is picked and pays back the total. With least_conn only
+	the servers with the fewest requests per weight take part.
+*/
+int LoadBalancer::pickWeighted(UpstreamConfig *upstream, time_t now, bool least_conn) {
+	VECTOR<UpstreamServer> &servers = upstream->_upstream_servers;
+	int least = -1;
+
+	if (least_conn) {
+		for (size_t i = 0; i < servers.size(); i++) {
+			if (!isAvailable(servers[i], now))
+				continue;
+			if (least == -1 || (long long)servers[i]._active * servers[least]._weight <
+					(long long)servers[least]._active * servers[i]._weight)
+				least = i;
+		}
+	}
+
+	int best = -1;
+	int total = 0;
+	for (size_t i = 0; i < servers.size(); i++) {
+		if (!isAvailable(servers[i], now))
+			continue;
+		if (least != -1 && (long long)servers[i]._active * servers[least]._weight !=
+				(long long)servers[least]._active * servers[i]._weight)
+			continue;
+		servers[i]._current_weight += servers[i]._weight;
+		total += servers[i]._weight;
+		if (best == -1 || servers[i]._current_weight > servers[best]._current_weight)
+			best = i;
+	}
+	if (best != -1)
+		servers[best]._current_weight -= total;
+	return best;
+}
+
+// first available server clockwise from the key's point on the ring
+int LoadBalancer::pickHash(UpstreamConfig *upstream, const STR &hash_value, time_t now) {
+	if (upstream->_hash_ring.empty())
+		buildRing(upstream);
+
+	VECTOR<std::pair<uint32_t, int> > &ring = upstream->_hash_ring;
+	std::pair<uint32_t, int> point(hash(hash_value), -1);
+	size_t start = std::lower_bound(ring.begin(), ring.end(), point) - ring.begin();
+
+	for (size_t i = 0; i < ring.size(); i++) {
+		int server = ring[(start + i) % ring.size()].second;
+		if (isAvailable(upstream->_upstream_servers[server], now))
+			return server;
+	}
+	return -1;
+}
+
+// points depend only on the server's address, adding a server moves few keys
+void LoadBalancer::buildRing(UpstreamConfig *upstream) {
+	VECTOR<UpstreamServer> &servers = upstream->_upstream_servers;
+
+	for (size_t i = 0; i < servers.size(); i++) {
+		int points = servers[i]._weight * HASH_POINTS_PER_WEIGHT;
+		for (int j = 0; j < points; j++) {
+			upstream->_hash_ring.push_back(std::make_pair(hash(serverName(servers[i]) + "-" + Utils::intToString(j)), (int)i));
+		}
+	}
+	std::sort(upstream->_hash_ring.begin(), upstream->_hash_ring.end());
+}
+
+// Utils::hash folded to 32 bits, with a final mix so close keys land far apart on the ring
+uint32_t LoadBalancer::hash(const STR &value) {
+	uint64_t full = Utils::hash(value);
+	uint32_t h = (uint32_t)(full ^ (full >> 32));
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+// request on the server is over; failures count towards max_fails
+void LoadBalancer::release(UpstreamConfig *upstream, int server_index, bool failed) {
+	if (server_index < 0 || server_index >= (int)upstream->_upstream_servers.size())
+		return;
+	UpstreamServer &server = upstream->_upstream_servers[server_index];
+	time_t now = time(NULL);
+
+	if (server._active > 0)
+		server._active--;
+
+	if (!failed) {
+		server._fails = 0;
+		return;
+	}
+	if (server._max_fails == 0)
+		return;
+
+	if (now - server._fail_window_start >= server._fail_timeout) {
+		server._fails = 0;
+		server._fail_window_start = now;
+	}
+	if (++server._fails >= server._max_fails) {
+		server._fails = 0;
+		server._down_until = now + server._fail_timeout;
+		LOG(Logger::WARNING, "LoadBalancer: " + serverName(server) + " in upstream " + upstream->_name +
+			" failed, skipping it for " + Utils::intToString(server._fail_timeout) + "s");
+	}
+}
+
+/*
+	Called once per loop tick. Each probe is a non-blocking HTTP/1.0 GET of the
+	health_check uri that moves one step per tick; 2xx and 3xx count as good.
+*/
+void LoadBalancer::runHealthChecks(VECTOR<UpstreamConfig*> &upstreams, time_t now) {
+	for (size_t i = 0; i < upstreams.size(); i++) {
+		if (upstreams[i]->_health_check_uri == "")
+			continue;
+		VECTOR<UpstreamServer> &servers = upstreams[i]->_upstream_servers;
+		for (size_t j = 0; j < servers.size(); j++) {
+			if (servers[j]._probe_fd < 0 && now >= servers[j]._next_probe)
+				startProbe(upstreams[i], servers[j], now);
+			if (servers[j]._probe_fd >= 0)
+				stepProbe(upstreams[i], servers[j], now);
+		}
+	}
+}
+
+// configuration replaced, probes still in flight are dropped
+void LoadBalancer::stopHealthChecks(VECTOR<UpstreamConfig*> &upstreams) {
+	for (size_t i = 0; i < upstreams.size(); i++) {
+		VECTOR<UpstreamServer> &servers = upstreams[i]->_upstream_servers;
+		for (size_t j = 0; j < servers.size(); j++) {
+			if (servers[j]._probe_fd >= 0)
+				close(servers[j]._probe_fd);
+			servers[j]._probe_fd = -1;
+		}
+	}
+}
+
+void LoadBalancer::startProbe(UpstreamConfig *upstream, UpstreamServer &server, time_t now) {
+	// the address was resolved with the configuration
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (connect(fd, (struct sockaddr *)&server._addr, sizeof(server._addr)) < 0 && errno != EINPROGRESS) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	server._probe_fd = fd;
+	server._probe_started = now;
+	server._probe_sent = false;
+	server._probe_buffer.clear();
+	if (fd < 0)
+		probeResult(upstream, server, false, now);
+}
+
+void LoadBalancer::stepProbe(UpstreamConfig *upstream, UpstreamServer &server, time_t now) {
+	if (!server._probe_sent) {
+		struct pollfd pfd;
+		pfd.fd = server._probe_fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 0) > 0) {
+			int error = 0;
+			socklen_t len = sizeof(error);
+			getsockopt(server._probe_fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+			STR probe = "GET " + upstream->_health_check_uri + " HTTP/1.0\r\n"
+						"Host: " + server._host + "\r\n"
+						"User-Agent: webserv-health-check\r\n\r\n";
+			if (error != 0 || send(server._probe_fd, probe.c_str(), probe.size(), MSG_NOSIGNAL) != (ssize_t)probe.size()) {
+				probeResult(upstream, server, false, now);
+				return;
+			}
+			server._probe_sent = true;
+		}
+	}
+
+	if (server._probe_sent) {
+		char buffer[512];
+		ssize_t nbytes = recv(server._probe_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (nbytes > 0)
+			server._probe_buffer.append(buffer, nbytes);
+
+		if (server._probe_buffer.find("\r\n") != STR::npos) {
+			int code = server._probe_buffer.size() > 12 ? atoi(server._probe_buffer.substr(9, 3).c_str()) : 0;
+			probeResult(upstream, server, code >= 200 && code < 400, now);
+			return;
+		}
+		if (nbytes == 0 || (nbytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			probeResult(upstream, server, false, now);
+			return;
+		}
+	}
+
+	if (now - server._probe_started >= upstream->_health_check_interval)
+		probeResult(upstream, server, false, now);
+}
+
+void LoadBalancer::probeResult(UpstreamConfig *upstream, UpstreamServer &server, bool ok, time_t now) {
+	if (server._probe_fd >= 0)
+		close(server._probe_fd);
+	server._probe_fd = -1;
+	server._probe_buffer.clear();
+	server._next_probe = now + upstream->_health_check_interval;
+
+	if (ok) {
+		server._probe_fails = 0;
+		if (++server._probe_passes >= upstream->_health_check_passes && !server._healthy) {
+			server._healthy = true;
+			LOG(Logger::INFO, "LoadBalancer: " + serverName(server) + " in upstream " + upstream->_name + " is up");
+		}
+	} else {
+		server._probe_passes = 0;
+		if (++server._probe_fails >= upstream->_health_check_fails && server._healthy) {
+			server._healthy = false;
+			LOG(Logger::WARNING, "LoadBalancer: " + serverName(server) + " in upstream " + upstream->_name + " failed its health check");
+		}
+	}
+}
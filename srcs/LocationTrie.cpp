@@ -0,0 +1,67 @@
+#include "LocationTrie.hpp"
+
+LocationTrie::LocationTrie() : _root(new Node()) {
+}
+
+LocationTrie::~LocationTrie() {
+	destroy(_root);
+}
+
+void LocationTrie::destroy(Node *node) {
+	for (MAP<STR, Node*>::iterator it = node->children.begin(); it != node->children.end(); ++it)
+		destroy(it->second);
+	delete node;
+}
+
+void LocationTrie::insert(const STR &path, LocationConfig *location) {
+	Node *node = _root;
+	size_t end = path.size();
+	bool slash = end > 1 && path[end - 1] == '/';
+	if (slash)
+		end--;
+
+	size_t start = (path[0] == '/') ? 1 : 0;
+	while (start < end) {
+		size_t next = path.find('/', start);
+		if (next == STR::npos || next > end)
+			next = end;
+		Node *&child = node->children[path.substr(start, next - start)];
+		if (!child)
+			child = new Node();
+		node = child;
+		start = next + 1;
+	}
+
+	if (slash)
+		node->slash = location;
+	else
+		node->exact = location;
+}
+
+// matched_path: the request path up to the matched location, without trailing slash ("/" for the root)
+LocationConfig *LocationTrie::match(const STR &uri, STR &matched_path) const {
+	const Node *node = _root;
+	const Node *best = (_root->exact || _root->slash) ? _root : NULL;
+	size_t best_end = 0;
+
+	size_t start = (!uri.empty() && uri[0] == '/') ? 1 : 0;
+	while (start < uri.size()) {
+		size_t next = uri.find('/', start);
+		if (next == STR::npos)
+			next = uri.size();
+		MAP<STR, Node*>::const_iterator it = node->children.find(uri.substr(start, next - start));
+		if (it == node->children.end())
+			break;
+		node = it->second;
+		if (node->exact || node->slash) {
+			best = node;
+			best_end = next;
+		}
+		start = next + 1;
+	}
+
+	if (!best)
+		return NULL;
+	matched_path = (best == _root) ? "/" : uri.substr(0, best_end);
+	return best->exact ? best->exact : best->slash;
+}
@@ -1,39 +1,75 @@
 #include "../includes/Logger.hpp"
 #include "../includes/AConfigBase.hpp"
+#include "../includes/Clock.hpp"
+#include <cerrno>
 
-// get current time
-STR Logger::getCurrentTime() {
-	time_t now = time(0);
-	struct tm tstruct;
-	char buf[80];
-
-	tstruct = *localtime(&now);
-	strftime(buf, sizeof(buf), "%Y-%m-%d %X", &tstruct);
-
-	return STR(buf);
-}
-
+bool	Logger::_enabled[4] = {true, true, true, false};	// INFO, WARNING, ERROR, DEBUG
+STR		Logger::_path = "";
+int		Logger::_fd = -1;
 // convert log level to string
 STR Logger::logLevelToString(LogLevel level) {
+	bool color = _fd < 0;
 	switch(level) {
-		case INFO: return STR(BLUE) + "INFO" + STR(END);
-		case WARNING: return STR(YELLOW) + "WARNING" + STR(END);
-		case ERROR: return STR(RED) + "ERROR" + STR(END);
-		case DEBUG: return STR(GREEN) + "DEBUG" + STR(END);
+		case INFO: return color ? STR(BLUE) + "INFO" + STR(END) : "INFO";
+		case WARNING: return color ? STR(YELLOW) + "WARNING" + STR(END) : "WARNING";
+		case ERROR: return color ? STR(RED) + "ERROR" + STR(END) : "ERROR";
+		case DEBUG: return color ? STR(GREEN) + "DEBUG" + STR(END) : "DEBUG";
 		default: return "UNKNOWN";
 	}
 }
 
-// Just print the log cout
+// error_log levels, each one enables itself and everything more severe
+bool Logger::parseLevel(const STR &name, LogLevel &level) {
+	if (name == "debug")
+		level = DEBUG;
+	else if (name == "info")
+		level = INFO;
+	else if (name == "warn")
+		level = WARNING;
+	else if (name == "error")
+		level = ERROR;
+	else
+		return false;
+	return true;
+}
+
+void Logger::configure(const STR &path, LogLevel level) {
+	_enabled[DEBUG] = level == DEBUG;
+	_enabled[INFO] = level == DEBUG || level == INFO;
+	_enabled[WARNING] = level != ERROR;
+	_enabled[ERROR] = true;
+	if (path == _path && _fd >= 0)
+		return;
+	_path = path;
+	reopen();
+}
+
+// SIGUSR1 after log rotation, and when error_log names another file
+void Logger::reopen() {
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+	open();
+}
+
+void Logger::open() {
+	if (_path == "" || _path == "stderr")
+		return;
+	_fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd < 0)
+		log(WARNING, "Cannot open error_log " + _path + ": " + STR(strerror(errno)) + ", logging to the terminal");
+}
+
+// one write per line, no stream flush
 void Logger::log(LogLevel level, const STR &message) {
-	if (level == DEBUG) {
+	if (!_enabled[level]) {
 		return ;
 	}
-	STR logEntry = "[" + Logger::getCurrentTime() + "] " + "[" + Logger::logLevelToString(level) + "] " + ": " + message;
+	STR logEntry = "[" + Clock::logTime() + "] " + "[" + Logger::logLevelToString(level) + "] " + ": " + message + "\n";
 
-	if (level == ERROR)
-		std::cerr << logEntry << std::endl;
-	else
-		std::cout << logEntry << std::endl;
+	int fd = _fd;
+	if (fd < 0)
+		fd = level == ERROR ? STDERR_FILENO : STDOUT_FILENO;
+	ssize_t written = write(fd, logEntry.data(), logEntry.size());
+	(void)written;
 }
-
@@ -0,0 +1,148 @@
+#include "Metrics.hpp"
+#include "RequestsManager.hpp"
+#include "BufferPool.hpp"
+#include <sstream>
+
+unsigned long long	Metrics::_accepted = 0;
+unsigned long long	Metrics::_handled = 0;
+unsigned long long	Metrics::_requests = 0;
+unsigned long long	Metrics::_bytes_in = 0;
+unsigned long long	Metrics::_bytes_out = 0;
+unsigned long long	Metrics::_cgi_spawned = 0;
+unsigned long long	Metrics::_cgi_timeouts = 0;
+unsigned long long	Metrics::_cgi_errors = 0;
+long				Metrics::_phases[5] = {0, 0, 0, 0, 0};
+unsigned long long	Metrics::_responses[METRICS_MAX_STATUS] = {0};
+unsigned long long	Metrics::_latency[LATENCY_PHASES][METRICS_LATENCY_BUCKETS] = {{0}};
+unsigned long long	Metrics::_latency_sum[LATENCY_PHASES] = {0};
+const long long		Metrics::_latency_bounds[METRICS_LATENCY_BUCKETS - 1] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+const char			*Metrics::_latency_names[LATENCY_PHASES] = {
+	"accept", "header", "routing", "handler", "cgi", "ttfb", "write", "total"
+};
+
+void Metrics::connectionAccepted() {
+	_accepted++;
+}
+
+void Metrics::connectionHandled() {
+	_handled++;
+}
+
+void Metrics::phaseChanged(int from, int to) {
+	if (from >= 0)
+		_phases[from]--;
+	if (to >= 0)
+		_phases[to]++;
+}
+
+void Metrics::bytesReceived(long long bytes) {
+	_bytes_in += bytes;
+}
+
+void Metrics::bytesSent(long long bytes) {
+	_bytes_out += bytes;
+}
+
+void Metrics::responseSent(int status_code) {
+	if (status_code < 100 || status_code >= METRICS_MAX_STATUS)
+		status_code = 0;
+	_responses[status_code]++;
+	_requests++;
+}
+
+void Metrics::cgiSpawned() {
+	_cgi_spawned++;
+}
+
+void Metrics::cgiTimedOut() {
+	_cgi_timeouts++;
+}
+
+void Metrics::cgiFailed() {
+	_cgi_errors++;
+}
+
+void Metrics::observe(LatencyPhase phase, long long micros) {
+	if (micros < 0)
+		micros = 0;
+	int bucket = 0;
+	while (bucket < METRICS_LATENCY_BUCKETS - 1 && micros > _latency_bounds[bucket])
+		bucket++;
+	_latency[phase][bucket]++;
+	_latency_sum[phase] += micros;
+}
+
+// microseconds as seconds without going through a double
+static STR seconds(unsigned long long micros) {
+	std::ostringstream out;
+	out << micros / 1000000;
+	unsigned long long fraction = micros % 1000000;
+	if (fraction) {
+		STR digits = Utils::intToString(1000000 + fraction).substr(1);
+		out << "." << digits.substr(0, digits.find_last_not_of('0') + 1);
+	}
+	return out.str();
+}
+
+static void counter(std::ostringstream &out, const char *name, const char *help, unsigned long long value) {
+	out << "# HELP " << name << " " << help << "\n"
+		<< "# TYPE " << name << " counter\n"
+		<< name << " " << value << "\n";
+}
+
+// Prometheus text exposition format, version 0.0.4
+STR Metrics::render() {
+	long reading = _phases[PHASE_HEADER] + _phases[PHASE_BODY];
+	long writing = _phases[PHASE_HANDLER] + _phases[PHASE_WRITE];
+	long waiting = _phases[PHASE_IDLE];
+	std::ostringstream out;
+
+	out << "# HELP webserv_connections_active Open client connections.\n"
+		<< "# TYPE webserv_connections_active gauge\n"
+		<< "webserv_connections_active " << reading + writing + waiting << "\n"
+		<< "# HELP webserv_connections Open client connections by state.\n"
+		<< "# TYPE webserv_connections gauge\n"
+		<< "webserv_connections{state=\"reading\"} " << reading << "\n"
+		<< "webserv_connections{state=\"writing\"} " << writing << "\n"
+		<< "webserv_connections{state=\"waiting\"} " << waiting << "\n";
+	counter(out, "webserv_connections_accepted_total", "Connections accepted.", _accepted);
+	counter(out, "webserv_connections_handled_total", "Connections handled, accepted minus those rejected by limits.", _handled);
+	counter(out, "webserv_http_requests_total", "Responses started.", _requests);
+
+	out << "# HELP webserv_http_responses_total Responses started by status code.\n"
+		<< "# TYPE webserv_http_responses_total counter\n";
+	for (int code = 0; code < METRICS_MAX_STATUS; code++) {
+		if (_responses[code])
+			out << "webserv_http_responses_total{code=\"" << (code ? Utils::intToString(code) : STR("other"))
+				<< "\"} " << _responses[code] << "\n";
+	}
+
+	counter(out, "webserv_cgi_spawned_total", "CGI processes started.", _cgi_spawned);
+	counter(out, "webserv_cgi_timeouts_total", "CGI processes killed after the timeout.", _cgi_timeouts);
+	counter(out, "webserv_cgi_errors_total", "CGI processes that failed to start, exited with an error or sent no headers.", _cgi_errors);
+	counter(out, "webserv_bytes_received_total", "Bytes read from clients.", _bytes_in);
+	counter(out, "webserv_bytes_sent_total", "Bytes written to clients.", _bytes_out);
+	out << "# HELP webserv_buffer_pool_bytes Output chunks held by connections and kept for reuse.\n"
+		<< "# TYPE webserv_buffer_pool_bytes gauge\n"
+		<< "webserv_buffer_pool_bytes{state=\"used\"} " << BufferPool::usedBytes() << "\n"
+		<< "webserv_buffer_pool_bytes{state=\"free\"} " << BufferPool::freeBytes() << "\n";
+
+	out << "# HELP webserv_request_duration_seconds Time spent in each request phase.\n"
+		<< "# TYPE webserv_request_duration_seconds histogram\n";
+	for (int phase = 0; phase < LATENCY_PHASES; phase++) {
+		STR label = STR("phase=\"") + _latency_names[phase] + "\"";
+		unsigned long long count = 0;
+		for (int bucket = 0; bucket < METRICS_LATENCY_BUCKETS; bucket++) {
+			count += _latency[phase][bucket];
+			out << "webserv_request_duration_seconds_bucket{" << label << ",le=\""
+				<< (bucket < METRICS_LATENCY_BUCKETS - 1 ? seconds(_latency_bounds[bucket]) : STR("+Inf"))
+				<< "\"} " << count << "\n";
+		}
+		out << "webserv_request_duration_seconds_sum{" << label << "} " << seconds(_latency_sum[phase]) << "\n"
+			<< "webserv_request_duration_seconds_count{" << label << "} " << count << "\n";
+	}
+	return out.str();
+}
@@ -0,0 +1,242 @@
+#include "MimeTypes.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <fstream>
+#include <sstream>
+
+// sorted by extension, find() relies on it
+const MimeTypes::Builtin MimeTypes::_builtin[] = {
+	{"3gp",		"video/3gpp"},
+	{"3gpp",	"video/3gpp"},
+	{"7z",		"application/x-7z-compressed"},
+	{"ai",		"application/postscript"},
+	{"asf",		"video/x-ms-asf"},
+	{"asx",		"video/x-ms-asf"},
+	{"atom",	"application/atom+xml"},
+	{"avi",		"video/x-msvideo"},
+	{"avif",	"image/avif"},
+	{"bin",		"application/octet-stream"},
+	{"bmp",		"image/x-ms-bmp"},
+	{"cco",		"application/x-cocoa"},
+	{"crt",		"application/x-x509-ca-cert"},
+	{"css",		"text/css"},
+	{"deb",		"application/octet-stream"},
+	{"der",		"application/x-x509-ca-cert"},
+	{"dll",		"application/octet-stream"},
+	{"dmg",		"application/octet-stream"},
+	{"doc",		"application/msword"},
+	{"docx",	"application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+	{"ear",		"application/java-archive"},
+	{"eot",		"application/vnd.ms-fontobject"},
+	{"eps",		"application/postscript"},
+	{"exe",		"application/octet-stream"},
+	{"flv",		"video/x-flv"},
+	{"gif",		"image/gif"},
+	{"hqx",		"application/mac-binhex40"},
+	{"htc",		"text/x-component"},
+	{"htm",		"text/html"},
+	{"html",	"text/html"},
+	{"ico",		"image/x-icon"},
+	{"img",		"application/octet-stream"},
+	{"iso",		"application/octet-stream"},
+	{"jad",		"text/vnd.sun.j2me.app-descriptor"},
+	{"jar",		"application/java-archive"},
+	{"jardiff",	"application/x-java-archive-diff"},
+	{"jng",		"image/x-jng"},
+	{"jnlp",	"application/x-java-jnlp-file"},
+	{"jpeg",	"image/jpeg"},
+	{"jpg",		"image/jpeg"},
+	{"js",		"text/javascript"},
+	{"json",	"application/json"},
+	{"kar",		"audio/midi"},
+	{"kml",		"application/vnd.google-earth.kml+xml"},
+	{"kmz",		"application/vnd.google-earth.kmz"},
+	{"m3u8",	"application/vnd.apple.mpegurl"},
+	{"m4a",		"audio/x-m4a"},
+	{"m4v",		"video/x-m4v"},
+	{"mid",		"audio/midi"},
+	{"midi",	"audio/midi"},
+	{"mjs",		"text/javascript"},
+	{"mml",		"text/mathml"},
+	{"mng",		"video/x-mng"},
+	{"mov",		"video/quicktime"},
+	{"mp3",		"audio/mpeg"},
+	{"mp4",		"video/mp4"},
+	{"mpeg",	"video/mpeg"},
+	{"mpg",		"video/mpeg"},
+	{"msi",		"application/octet-stream"},
+	{"msm",		"application/octet-stream"},
+	{"msp",		"application/octet-stream"},
+	{"odg",		"application/vnd.oasis.opendocument.graphics"},
+	{"odp",		"application/vnd.oasis.opendocument.presentation"},
+	{"ods",		"application/vnd.oasis.opendocument.spreadsheet"},
+	{"odt",		"application/vnd.oasis.opendocument.text"},
+	{"ogg",		"audio/ogg"},
+	{"pdb",		"application/x-pilot"},
+	{"pdf",		"application/pdf"},
+	{"pem",		"application/x-x509-ca-cert"},
+	{"pl",		"application/x-perl"},
+	{"pm",		"application/x-perl"},
+	{"png",		"image/png"},
+	{"ppt",		"application/vnd.ms-powerpoint"},
+	{"pptx",	"application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+	{"prc",		"application/x-pilot"},
+	{"ps",		"application/postscript"},
+	{"ra",		"audio/x-realaudio"},
+	{"rar",		"application/x-rar-compressed"},
+	{"rpm",		"application/x-redhat-package-manager"},
+	{"rss",		"application/rss+xml"},
+	{"rtf",		"application/rtf"},
+	{"run",		"application/x-makeself"},
+	{"sea",		"application/x-sea"},
+	{"shtml",	"text/html"},
+	{"sit",		"application/x-stuffit"},
+	{"svg",		"image/svg+xml"},
+	{"svgz",	"image/svg+xml"},
+	{"swf",		"application/x-shockwave-flash"},
+	{"tcl",		"application/x-tcl"},
+	{"tif",		"image/tiff"},
+	{"tiff",	"image/tiff"},
+	{"tk",		"application/x-tcl"},
+	{"ts",		"video/mp2t"},
+	{"txt",		"text/plain"},
+	{"war",		"application/java-archive"},
+	{"wasm",	"application/wasm"},
+	{"wbmp",	"image/vnd.wap.wbmp"},
+	{"webm",	"video/webm"},
+	{"webp",	"image/webp"},
+	{"wml",		"text/vnd.wap.wml"},
+	{"wmlc",	"application/vnd.wap.wmlc"},
+	{"wmv",		"video/x-ms-wmv"},
+	{"woff",	"font/woff"},
+	{"woff2",	"font/woff2"},
+	{"xhtml",	"application/xhtml+xml"},
+	{"xls",		"application/vnd.ms-excel"},
+	{"xlsx",	"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+	{"xpi",		"application/x-xpinstall"},
+	{"xspf",	"application/xspf+xml"},
+	{"zip",		"application/zip"},
+	{NULL,		NULL}
+};
+
+VECTOR<MimeTypes::Entry>	MimeTypes::_table;
+MimeTypes::Entry			MimeTypes::_default = MimeTypes::entry("", MIME_DEFAULT_TYPE);
+
+/*
+	nginx mime.types syntax: "types {" optional, then "type ext ext ...;"
+	statements, # starts a comment. A later statement naming the same
+	extension wins.
+*/
+bool MimeTypes::load(const STR &path, MAP<STR, STR> &types) {
+	std::ifstream file(path.c_str());
+	if (!file) {
+		Logger::log(Logger::ERROR, "Cannot open types_file " + path);
+		return false;
+	}
+
+	VECTOR<STR> tokens;
+	STR line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		for (size_t i = 0; i < line.size(); i++) {
+			if (line[i] == '{' || line[i] == '}' || line[i] == ';') {
+				line.insert(i + 1, " ");
+				line.insert(i, " ");
+				i += 2;
+			}
+		}
+		std::istringstream words(line);
+		STR word;
+		while (words >> word)
+			tokens.push_back(word);
+	}
+
+	size_t i = 0;
+	if (tokens.size() >= 2 && tokens[0] == "types" && tokens[1] == "{")
+		i = 2;
+	while (i < tokens.size() && tokens[i] != "}") {
+		STR type = tokens[i++];
+		if (type.find('/') == STR::npos || type == ";") {
+			Logger::log(Logger::ERROR, "Invalid type \"" + type + "\" in " + path);
+			return false;
+		}
+		while (i < tokens.size() && tokens[i] != ";" && tokens[i] != "}") {
+			STR extension = tokens[i++];
+			for (size_t j = 0; j < extension.size(); j++)
+				extension[j] = tolower(extension[j]);
+			types[extension] = type;
+		}
+		if (i == tokens.size() || tokens[i] != ";") {
+			Logger::log(Logger::ERROR, "Missing \";\" after type " + type + " in " + path);
+			return false;
+		}
+		i++;
+	}
+	return true;
+}
+
+// the built-in list again when types_file is not set, or is gone since the configuration was checked
+void MimeTypes::init(HttpConfig *config) {
+	MAP<STR, STR> types;
+	if (config->_types_file == "" || !load(config->_types_file, types)) {
+		types.clear();
+		for (size_t i = 0; _builtin[i].extension; i++)
+			types[_builtin[i].extension] = _builtin[i].type;
+	}
+	install(types);
+	LOG(Logger::DEBUG, "MimeTypes: " + Utils::intToString(_table.size()) + " extensions");
+}
+
+const STR &MimeTypes::type(const STR &path) {
+	return find(path).type;
+}
+
+const STR &MimeTypes::contentType(const STR &path) {
+	return find(path).content_type;
+}
+
+void MimeTypes::install(const MAP<STR, STR> &types) {
+	VECTOR<Entry> table;
+	table.reserve(types.size());
+	for (MAP<STR, STR>::const_iterator it = types.begin(); it != types.end(); ++it)
+		table.push_back(entry(it->first, it->second));
+	_table.swap(table);
+}
+
+// extension of the last path segment, case-insensitive
+const MimeTypes::Entry &MimeTypes::find(const STR &path) {
+	if (_table.empty()) {
+		for (size_t i = 0; _builtin[i].extension; i++)
+			_table.push_back(entry(_builtin[i].extension, _builtin[i].type));
+	}
+
+	size_t dot = path.find_last_of("./");
+	if (dot == STR::npos || path[dot] != '.')
+		return _default;
+	STR extension = path.substr(dot + 1);
+	for (size_t i = 0; i < extension.size(); i++)
+		extension[i] = tolower(extension[i]);
+
+	size_t low = 0;
+	size_t high = _table.size();
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (_table[middle].extension < extension)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < _table.size() && _table[low].extension == extension)
+		return _table[low];
+	return _default;
+}
+
+MimeTypes::Entry MimeTypes::entry(const STR &extension, const STR &type) {
+	Entry entry;
+	entry.extension = extension;
+	entry.type = type;
+	entry.content_type = type;
+	if (type.compare(0, 5, "text/") == 0 || type == "application/json" || type == "application/javascript")
+		entry.content_type += "; charset=utf-8";
+	return entry;
+}
@@ -0,0 +1,161 @@
+#include "OutputChain.hpp"
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+#include "BufferPool.hpp"
+
+OutputChain::OutputChain() : _size(0) {}
+
+// file regions get their own descriptor and chunks are copied, each copy frees what it owns
+OutputChain::OutputChain(const OutputChain &obj) : _size(0) {
+	*this = obj;
+}
+
+OutputChain &OutputChain::operator=(const OutputChain &obj) {
+	if (this == &obj)
+		return *this;
+	clear();
+	for (size_t i = 0; i < obj._segments.size(); i++) {
+		Segment segment = obj._segments[i];
+		if (segment.fd >= 0) {
+			segment.fd = fcntl(segment.fd, F_DUPFD_CLOEXEC, 0);
+		} else {
+			segment.chunk = BufferPool::acquire(segment.capacity, segment.capacity);
+			memcpy(segment.chunk, obj._segments[i].chunk, segment.end);
+		}
+		_segments.push_back(segment);
+	}
+	_size = obj._size;
+	return *this;
+}
+
+OutputChain &OutputChain::operator=(const STR &data) {
+	clear();
+	append(data);
+	return *this;
+}
+
+OutputChain &OutputChain::operator+=(const STR &data) {
+	append(data);
+	return *this;
+}
+
+OutputChain::~OutputChain() {
+	clear();
+}
+
+// fills the free end of the last chunk first, then takes chunks from the pool
+void OutputChain::append(const STR &data) {
+	size_t done = 0;
+	while (done < data.size()) {
+		if (_segments.empty() || _segments.back().fd >= 0 || _segments.back().end == _segments.back().capacity) {
+			Segment segment;
+			segment.chunk = BufferPool::acquire(data.size() - done, segment.capacity);
+			segment.offset = 0;
+			segment.end = 0;
+			segment.fd = -1;
+			segment.length = 0;
+			_segments.push_back(segment);
+		}
+		Segment &last = _segments.back();
+		size_t step = std::min(data.size() - done, last.capacity - last.end);
+		memcpy(last.chunk + last.end, data.data() + done, step);
+		last.end += step;
+		done += step;
+	}
+	_size += data.size();
+}
+
+void OutputChain::appendFile(int fd, off_t offset, size_t length) {
+	if (length == 0) {
+		close(fd);
+		return;
+	}
+	Segment segment;
+	segment.chunk = NULL;
+	segment.capacity = 0;
+	segment.end = 0;
+	segment.offset = offset;
+	segment.fd = fd;
+	segment.length = length;
+	_segments.push_back(segment);
+	_size += length;
+}
+
+void OutputChain::clear() {
+	for (size_t i = 0; i < _segments.size(); i++)
+		release(_segments[i]);
+	_segments.clear();
+	_size = 0;
+}
+
+size_t OutputChain::size() const {
+	return _size;
+}
+
+bool OutputChain::empty() const {
+	return _size == 0;
+}
+
+// first unsent bytes held in memory, for looking at the status line and headers
+STR OutputChain::head(size_t max) const {
+	STR result;
+	for (size_t i = 0; i < _segments.size() && result.size() < max && _segments[i].fd < 0; i++)
+		result.append(_segments[i].chunk + _segments[i].offset,
+			std::min(_segments[i].end - _segments[i].offset, max - result.size()));
+	return result;
+}
+
+// one writev or sendfile, same return value as write
+ssize_t OutputChain::writeTo(int fd) {
+	if (_segments.empty())
+		return 0;
+
+	ssize_t written;
+	if (_segments.front().fd >= 0) {
+		Segment &file = _segments.front();
+		off_t offset = file.offset;
+		written = sendfile(fd, file.fd, &offset, file.length);
+	} else {
+		struct iovec iov[OUTPUT_CHAIN_IOV];
+		int count = 0;
+		for (size_t i = 0; i < _segments.size() && count < OUTPUT_CHAIN_IOV && _segments[i].fd < 0; i++) {
+			iov[count].iov_base = _segments[i].chunk + _segments[i].offset;
+			iov[count].iov_len = _segments[i].end - _segments[i].offset;
+			count++;
+		}
+		written = writev(fd, iov, count);
+	}
+	if (written > 0)
+		advance(written);
+	return written;
+}
+
+void OutputChain::advance(size_t bytes) {
+	_size -= bytes;
+	while (bytes > 0) {
+		Segment &segment = _segments.front();
+		size_t left = segment.fd >= 0 ? segment.length : segment.end - segment.offset;
+		size_t step = bytes < left ? bytes : left;
+		segment.offset += step;
+		if (segment.fd >= 0)
+			segment.length -= step;
+		bytes -= step;
+		if (step == left) {
+			release(segment);
+			_segments.pop_front();
+		}
+	}
+}
+
+void OutputChain::release(Segment &segment) {
+	if (segment.fd >= 0)
+		close(segment.fd);
+	else if (segment.chunk)
+		BufferPool::release(segment.chunk, segment.capacity);
+	segment.fd = -1;
+	segment.chunk = NULL;
+}
@@ -24,6 +24,10 @@ AConfigBase	*Parser::CreateBlock(STR line, int start) {
 		LocationConfig *conf = new LocationConfig();
 		conf->_path = tokens[1];
 		block = conf;
+	} else if (tokens[0] == "upstream") {
+		UpstreamConfig *conf = new UpstreamConfig();
+		conf->_name = tokens[1];
+		block = conf;
 	}
 
 	return block;
@@ -40,6 +44,19 @@ AConfigBase	*Parser::AddBlock(AConfigBase *prev_block, STR line, int start) {
 		ServerConfig* serverConf;
 
 		child = CreateBlock(line, start);
+		if (child && httpConf && httpConf->_identify(child) == UPSTREAM) {
+			UpstreamConfig* upstreamConf = dynamic_cast<UpstreamConfig*>(child);
+			for (size_t i = 0; i < httpConf->_upstreams.size(); i++) {
+				if (httpConf->_upstreams[i]->_name == upstreamConf->_name) {
+					Logger::log(Logger::ERROR, "AConfigBase *AddBlock UPSTREAM DUPLICATE " + upstreamConf->_name);
+					child->_self_destruct();
+					return NULL;
+				}
+			}
+			httpConf->_upstreams.push_back(upstreamConf);
+			child->back_ref = prev_block;
+			return child;
+		}
 		if (!child || !httpConf || httpConf->_identify(child) != SERVER) {
 			if (child)
 				child->_self_destruct();
@@ -8,10 +8,138 @@ bool ParserFiller::FillHttp(HttpConfig* httpConf, VECTOR<STR> tokens){
 		httpConf->_global_worker_process = tokens[1];
 	} else if (tokens[0] == "DEBUG_log") {
 		httpConf->_global_error_log = tokens[1];
+	} else if (tokens[0] == "error_log") {
+		// error_log path|stderr [debug|info|warn|error]
+		httpConf->_global_error_log = tokens[1];
+		if (tokens.size() > 3 || (tokens.size() == 3 && !Logger::parseLevel(tokens[2], httpConf->_error_log_level))) {
+			Logger::log(Logger::ERROR, "Invalid error_log value");
+			return false;
+		}
 	} else if (tokens[0] == "pid") {
 		httpConf->_global_pid = tokens[1];
 	} else if (tokens[0] == "keepalive_timeout") {
 		httpConf->_keepalive_timeout = tokens[1];
+	} else if (tokens[0] == "client_header_timeout") {
+		httpConf->_client_header_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_client_header_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid client_header_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "client_body_timeout") {
+		httpConf->_client_body_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_client_body_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid client_body_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "send_timeout") {
+		httpConf->_send_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_send_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid send_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "client_min_rate") {
+		httpConf->_client_min_rate = ParserUtils::verifyClientMaxBodySize(tokens[1]);  // same units: b, k, m, g
+		if (httpConf->_client_min_rate == -1) {
+			Logger::log(Logger::ERROR, "Invalid client_min_rate value");
+			return false;
+		}
+	} else if (tokens[0] == "worker_connections") {
+		httpConf->_worker_connections = ParserUtils::verifyCount(tokens[1]);
+		if (httpConf->_worker_connections <= 0) {
+			Logger::log(Logger::ERROR, "Invalid worker_connections value");
+			return false;
+		}
+	} else if (tokens[0] == "worker_shutdown_timeout") {
+		httpConf->_worker_shutdown_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_worker_shutdown_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid worker_shutdown_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "limit_conn_per_ip") {
+		httpConf->_limit_conn_per_ip = ParserUtils::verifyCount(tokens[1]);
+		if (httpConf->_limit_conn_per_ip == -1) {
+			Logger::log(Logger::ERROR, "Invalid limit_conn_per_ip value");
+			return false;
+		}
+	} else if (tokens[0] == "proxy_connect_timeout") {
+		httpConf->_proxy_connect_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_proxy_connect_timeout <= 0) {
+			Logger::log(Logger::ERROR, "Invalid proxy_connect_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "proxy_read_timeout") {
+		httpConf->_proxy_read_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_proxy_read_timeout <= 0) {
+			Logger::log(Logger::ERROR, "Invalid proxy_read_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "proxy_cache_path") {
+		// proxy_cache_path /path [levels=1:2] [max_size=100m] [inactive=10m]
+		httpConf->_proxy_cache_path = tokens[1];
+		for (size_t j = 2; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, 7, "levels=") == 0) {
+				VECTOR<STR> levels = Utils::split(tokens[j].substr(7), ':', 0);
+				httpConf->_proxy_cache_levels.clear();
+				for (size_t k = 0; k < levels.size(); k++) {
+					int level = ParserUtils::verifyCount(levels[k]);
+					if (level < 1 || level > 2 || levels.size() > 3) {
+						Logger::log(Logger::ERROR, "Invalid proxy_cache_path levels " + tokens[j]);
+						return false;
+					}
+					httpConf->_proxy_cache_levels.push_back(level);
+				}
+			} else if (tokens[j].compare(0, 9, "max_size=") == 0) {
+				httpConf->_proxy_cache_max_size = ParserUtils::verifyClientMaxBodySize(tokens[j].substr(9));
+			} else if (tokens[j].compare(0, 9, "inactive=") == 0) {
+				httpConf->_proxy_cache_inactive = ParserUtils::verifyTimeout(tokens[j].substr(9));
+			} else {
+				Logger::log(Logger::ERROR, "Invalid proxy_cache_path parameter " + tokens[j]);
+				return false;
+			}
+		}
+		if (httpConf->_proxy_cache_max_size == -1 || httpConf->_proxy_cache_inactive <= 0) {
+			Logger::log(Logger::ERROR, "Invalid proxy_cache_path value");
+			return false;
+		}
+	} else if (tokens[0] == "proxy_cache_lock_timeout") {
+		httpConf->_proxy_cache_lock_timeout = ParserUtils::verifyTimeout(tokens[1]);
+		if (httpConf->_proxy_cache_lock_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid proxy_cache_lock_timeout value");
+			return false;
+		}
+	} else if (tokens[0] == "log_format") {
+		// log_format name $remote_addr "$request" ...; the rest of the line, one quoting level removed
+		if (tokens.size() < 3) {
+			Logger::log(Logger::ERROR, "log_format needs a name and a format");
+			return false;
+		}
+		STR format = tokens[2];
+		for (size_t j = 3; j < tokens.size(); j++)
+			format += " " + tokens[j];
+		if (format.size() >= 2 && format[0] == '\'' && format[format.size() - 1] == '\'')
+			format = format.substr(1, format.size() - 2);
+		httpConf->_log_formats[tokens[1]] = format;
+	} else if (tokens[0] == "access_log") {
+		// access_log off | path [format] [buffer=64k] [flush=1s]
+		httpConf->_access_log = tokens[1] == "off" ? "" : tokens[1];
+		for (size_t j = 2; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, 7, "buffer=") == 0) {
+				httpConf->_access_log_buffer = ParserUtils::verifyClientMaxBodySize(tokens[j].substr(7));
+			} else if (tokens[j].compare(0, 6, "flush=") == 0) {
+				httpConf->_access_log_flush = ParserUtils::verifyTimeout(tokens[j].substr(6));
+			} else if (j == 2) {
+				httpConf->_access_log_format = tokens[j];
+			} else {
+				Logger::log(Logger::ERROR, "Invalid access_log parameter " + tokens[j]);
+				return false;
+			}
+		}
+		if (httpConf->_access_log_buffer == -1 || httpConf->_access_log_flush <= 0) {
+			Logger::log(Logger::ERROR, "Invalid access_log value");
+			return false;
+		}
+	} else if (tokens[0] == "types_file") {
+		httpConf->_types_file = tokens[1];
 	} else if (tokens[0] == "add_header") {
 		httpConf->_add_header = tokens[1];
 	} else if (tokens[0] == "client_max_body_size") {
@@ -50,28 +178,16 @@ bool ParserFiller::FillHttp(HttpConfig* httpConf, VECTOR<STR> tokens){
 bool ParserFiller::FillServer(ServerConfig* serverConf, VECTOR<STR> tokens){
 	if (tokens[0] == "add_header") {
 		serverConf->_add_header = tokens[1];
-	} else if (tokens[0] == "listen") {  // change listen server and port
-		// parse server address and port
-		size_t position = tokens[1].find(':');
-		if (position == STR::npos) {
-			serverConf->_listen_port = ParserUtils::verifyPort(tokens[1]);
-			if (serverConf->_listen_port == -1) {
-				Logger::log(Logger::ERROR, "Invalid port value");
-				return false;
-			}
-		} else {
-			serverConf->_listen_server = tokens[1].substr(0, position);
-			if (serverConf->_listen_server == "") {
-				Logger::log(Logger::ERROR, "Invalid server address");
-				return false;
-			}
-			serverConf->_listen_port = ParserUtils::verifyPort(tokens[1].substr(position + 1));
-			if (serverConf->_listen_port == -1) {
-				Logger::log(Logger::ERROR, "Invalid port value");
-				return false;
-			}
+	} else if (tokens[0] == "listen") {  // listen [address:]port [default_server]
+		if (tokens.size() > 3 || (tokens.size() == 3 && tokens[2] != "default_server")) {
+			Logger::log(Logger::ERROR, "Invalid listen parameters");
+			return false;
 		}
-
+		if (!ParserUtils::verifyListen(tokens[1], serverConf->_listen_server, serverConf->_listen_port)) {
+			Logger::log(Logger::ERROR, "Invalid listen address or port: " + tokens[1]);
+			return false;
+		}
+		serverConf->_listen_default = (tokens.size() == 3);
 	} else if (tokens[0] == "server_name") {
 		for (size_t j = 1; j < tokens.size(); j++) {
 			serverConf->_server_name.push_back(tokens[j]);
@@ -126,25 +242,10 @@ bool ParserFiller::FillServer(ServerConfig* serverConf, VECTOR<STR> tokens){
 //  -- to fill location config --
 bool ParserFiller::FillLocation(LocationConfig* locConf, VECTOR<STR> tokens){
 	if (tokens[0] == "proxy_pass") {
-		int	host_start;
-		int	host_end;
-		int	delim_position;
-		int	port_end;
-
-		//extracting host and port from		Host: localhost:8080
-		host_start = tokens[1].find_first_of(':') + 3;
-		delim_position = tokens[1].find(':', tokens[1].find_first_of(':') + 1);
-
-		if (delim_position == (int)STR::npos) {
-		//host without port
-			host_end = tokens[1].find_last_not_of(' ');
-			locConf->_proxy_pass_host = tokens[1].substr(host_start, host_end - host_start);
-		} else {
-		//host with port
-			host_end = delim_position;
-			port_end = tokens[1].find_last_not_of(' ');
-			locConf->_proxy_pass_host = tokens[1].substr(host_start, host_end - host_start);
-			locConf->_proxy_pass_port = atoi(tokens[1].substr(delim_position + 1, delim_position + 1 - port_end).c_str());
+		if (!ParserUtils::verifyProxyPass(tokens[1], locConf->_proxy_pass_host,
+				locConf->_proxy_pass_port, locConf->_proxy_pass_uri)) {
+			Logger::log(Logger::ERROR, "Invalid proxy_pass value " + tokens[1]);
+			return false;
 		}
 	} else if (tokens[0] == "path") {
 		locConf->_path = tokens[1];
@@ -203,6 +304,54 @@ bool ParserFiller::FillLocation(LocationConfig* locConf, VECTOR<STR> tokens){
 		locConf->_upload_store = tokens[1];
 	} else if (tokens[0] == "alias") {
 		locConf->_alias = tokens[1];
+	} else if (tokens[0] == "autoindex_format") {
+		if (tokens[1] != "html" && tokens[1] != "json") {
+			Logger::log(Logger::ERROR, "Invalid autoindex_format value");
+			return false;
+		}
+		locConf->_autoindex_json = tokens[1] == "json";
+	} else if (tokens[0] == "autoindex_page_size") {
+		if (tokens[1].find_first_not_of("0123456789") != STR::npos || tokens[1].size() > 9) {
+			Logger::log(Logger::ERROR, "Invalid autoindex_page_size value");
+			return false;
+		}
+		locConf->_autoindex_page_size = atol(tokens[1].c_str());
+	} else if (tokens[0] == "stub_status") {
+		if (tokens.size() != 1) {
+			Logger::log(Logger::ERROR, "stub_status takes no value");
+			return false;
+		}
+		locConf->_stub_status = true;
+	} else if (tokens[0] == "proxy_cache") {
+		if (tokens[1] != "on" && tokens[1] != "off") {
+			Logger::log(Logger::ERROR, "Invalid proxy_cache value");
+			return false;
+		}
+		locConf->_proxy_cache = tokens[1] == "on";
+	} else if (tokens[0] == "proxy_cache_valid") {
+		locConf->_proxy_cache_valid = ParserUtils::verifyTimeout(tokens[1]);
+		if (locConf->_proxy_cache_valid == -1) {
+			Logger::log(Logger::ERROR, "Invalid proxy_cache_valid value");
+			return false;
+		}
+	} else if (tokens[0] == "limit_req") {
+		// limit_req rate=10r/s [burst=20] [nodelay]
+		for (size_t j = 1; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, 5, "rate=") == 0) {
+				locConf->_limit_req_rate = ParserUtils::verifyRate(tokens[j].substr(5));
+			} else if (tokens[j].compare(0, 6, "burst=") == 0) {
+				locConf->_limit_req_burst = ParserUtils::verifyCount(tokens[j].substr(6));
+			} else if (tokens[j] == "nodelay") {
+				locConf->_limit_req_nodelay = true;
+			} else {
+				Logger::log(Logger::ERROR, "Invalid limit_req parameter " + tokens[j]);
+				return false;
+			}
+		}
+		if (locConf->_limit_req_rate <= 0 || locConf->_limit_req_burst == -1) {
+			Logger::log(Logger::ERROR, "Invalid limit_req value");
+			return false;
+		}
 	} else {
 		Logger::log(Logger::ERROR, "CHECKFillDirective LocationConfig extra type " + tokens[0]);
 		return false;
@@ -210,6 +359,80 @@ bool ParserFiller::FillLocation(LocationConfig* locConf, VECTOR<STR> tokens){
 	return true;
 }
 
+//  -- to fill upstream config --
+bool ParserFiller::FillUpstream(UpstreamConfig* upstreamConf, VECTOR<STR> tokens){
+	if (tokens[0] == "server") {
+		// server host[:port] [weight=N] [max_fails=N] [fail_timeout=T]
+		UpstreamServer server;
+		STR uri;
+		if (!ParserUtils::verifyProxyPass("http://" + tokens[1], server._host, server._port, uri) || uri != "") {
+			Logger::log(Logger::ERROR, "Invalid upstream server " + tokens[1]);
+			return false;
+		}
+		for (size_t j = 2; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, 7, "weight=") == 0) {
+				server._weight = ParserUtils::verifyCount(tokens[j].substr(7));
+				if (server._weight <= 0) {
+					Logger::log(Logger::ERROR, "Invalid upstream weight " + tokens[j]);
+					return false;
+				}
+			} else if (tokens[j].compare(0, 10, "max_fails=") == 0) {
+				server._max_fails = ParserUtils::verifyCount(tokens[j].substr(10));
+			} else if (tokens[j].compare(0, 13, "fail_timeout=") == 0) {
+				server._fail_timeout = ParserUtils::verifyTimeout(tokens[j].substr(13));
+			} else {
+				Logger::log(Logger::ERROR, "Invalid upstream server parameter " + tokens[j]);
+				return false;
+			}
+		}
+		if (server._max_fails == -1 || server._fail_timeout == -1) {
+			Logger::log(Logger::ERROR, "Invalid upstream server value");
+			return false;
+		}
+		upstreamConf->_upstream_servers.push_back(server);
+	} else if (tokens[0] == "least_conn") {
+		upstreamConf->_balance = BALANCE_LEAST_CONN;
+	} else if (tokens[0] == "hash") {
+		// hash $remote_addr|$request_uri|$host [consistent], always a consistent ring
+		if (tokens[1] != "$remote_addr" && tokens[1] != "$request_uri" && tokens[1] != "$host") {
+			Logger::log(Logger::ERROR, "Invalid hash key " + tokens[1]);
+			return false;
+		}
+		if (tokens.size() > 3 || (tokens.size() == 3 && tokens[2] != "consistent")) {
+			Logger::log(Logger::ERROR, "Invalid hash directive");
+			return false;
+		}
+		upstreamConf->_balance = BALANCE_HASH;
+		upstreamConf->_hash_key = tokens[1];
+	} else if (tokens[0] == "health_check") {
+		// health_check uri=/health [interval=5s] [fails=1] [passes=1]
+		for (size_t j = 1; j < tokens.size(); j++) {
+			if (tokens[j].compare(0, 4, "uri=") == 0) {
+				upstreamConf->_health_check_uri = tokens[j].substr(4);
+			} else if (tokens[j].compare(0, 9, "interval=") == 0) {
+				upstreamConf->_health_check_interval = ParserUtils::verifyTimeout(tokens[j].substr(9));
+			} else if (tokens[j].compare(0, 6, "fails=") == 0) {
+				upstreamConf->_health_check_fails = ParserUtils::verifyCount(tokens[j].substr(6));
+			} else if (tokens[j].compare(0, 7, "passes=") == 0) {
+				upstreamConf->_health_check_passes = ParserUtils::verifyCount(tokens[j].substr(7));
+			} else {
+				Logger::log(Logger::ERROR, "Invalid health_check parameter " + tokens[j]);
+				return false;
+			}
+		}
+		if (upstreamConf->_health_check_uri == "" || upstreamConf->_health_check_uri[0] != '/' ||
+			upstreamConf->_health_check_interval <= 0 || upstreamConf->_health_check_fails <= 0 ||
+			upstreamConf->_health_check_passes <= 0) {
+			Logger::log(Logger::ERROR, "Invalid health_check value");
+			return false;
+		}
+	} else {
+		Logger::log(Logger::ERROR, "CHECKFillDirective UpstreamConfig extra type " + tokens[0]);
+		return false;
+	}
+	return true;
+}
+
 bool ParserFiller::FillDirective(AConfigBase* block, STR line, int position) {
 	VECTOR<STR> tokens;
 	STR 		trimmed_line;
@@ -226,6 +449,9 @@ bool ParserFiller::FillDirective(AConfigBase* block, STR line, int position) {
     }
     else if (LocationConfig* locConf = dynamic_cast<LocationConfig*>(block)) {
 		return FillLocation(locConf, tokens);
+    }
+    else if (UpstreamConfig* upstreamConf = dynamic_cast<UpstreamConfig*>(block)) {
+		return FillUpstream(upstreamConf, tokens);
     }
 	Logger::log(Logger::ERROR, "CHECKFillDirective Unknown block type " + tokens[0]);
 
@@ -1,4 +1,10 @@
 #include "ParserUtils.hpp"
+#include "AccessLog.hpp"
+#include "MimeTypes.hpp"
+#include "Response.hpp"
+#include <fstream>
+#include <arpa/inet.h>
+#include <netdb.h>
 
 int ParserUtils::verifyPort(std::string port_str) {
 	std::stringstream ss(port_str);
@@ -64,12 +70,148 @@ long long ParserUtils::verifyClientMaxBodySize(std::string client_max_body_size_
 	return value;
 }
 
+/*
+ * timeouts are given in seconds by default
+ * 30 = 30s = 30 seconds
+ * 2m = 120 seconds
+ * 1h = 3600 seconds
+*/
+int ParserUtils::verifyTimeout(std::string timeout_str) {
+	std::stringstream ss(timeout_str);
+	long value;
+	std::string unit;
+
+	if (!(ss >> value) || value < 0) {
+		return -1;
+	}
+	ss >> unit;
+
+	if (unit.empty() || unit == "s") {
+		value *= 1;
+	}
+	else if (unit == "m") {
+		value *= 60;
+	}
+	else if (unit == "h") {
+		value *= 3600;
+	}
+	else {
+		return -1;
+	}
+
+	if (value > INT_MAX) {
+		return -1;
+	}
+	return static_cast<int>(value);
+}
+
+// plain non-negative integer (connection counts, limits...)
+int ParserUtils::verifyCount(std::string count_str) {
+	std::stringstream ss(count_str);
+	long value;
+	std::string rest;
+
+	if (!(ss >> value) || value < 0 || value > INT_MAX || (ss >> rest)) {
+		return -1;
+	}
+	return static_cast<int>(value);
+}
+
+/*
+ * request rate, per second or per minute
+ * 10r/s = 10 requests per second
+ * 30r/m = 0.5 requests per second
+*/
+double ParserUtils::verifyRate(std::string rate_str) {
+	std::stringstream ss(rate_str);
+	long value;
+	std::string unit;
+
+	if (!(ss >> value) || value <= 0) {
+		return -1;
+	}
+	ss >> unit;
+
+	if (unit == "r/s") {
+		return static_cast<double>(value);
+	}
+	else if (unit == "r/m") {
+		return static_cast<double>(value) / 60;
+	}
+	return -1;
+}
+
+/*
+ * proxy_pass http://host[:port][/uri]
+ * port defaults to 80, uri is empty when the request URI is passed unchanged
+*/
+bool ParserUtils::verifyProxyPass(std::string url, STR &host, int &port, STR &uri) {
+	if (url.compare(0, 7, "http://") != 0) {
+		return false;
+	}
+	url = url.substr(7);
+
+	size_t uri_start = url.find('/');
+	uri = (uri_start == STR::npos) ? "" : url.substr(uri_start);
+	STR authority = url.substr(0, uri_start);
+
+	size_t colon = authority.find(':');
+	port = 80;
+	if (colon != STR::npos) {
+		port = verifyPort(authority.substr(colon + 1));
+		if (port == -1) {
+			return false;
+		}
+	}
+	host = authority.substr(0, colon);
+	return !host.empty();
+}
+
+/*
+ * listen port | address:port | [ipv6]:port, "*" is any IPv4 address
+ * the address is stored the way inet_ntop prints it, accepted sockets are matched against that form
+*/
+bool ParserUtils::verifyListen(STR value, STR &address, int &port) {
+	address = "0.0.0.0";
+	size_t colon = value.rfind(':');
+	if (value[0] == '[') {
+		size_t bracket = value.find(']');
+		if (bracket == STR::npos || (bracket + 1 != value.size() && bracket + 1 != colon)) {
+			return false;
+		}
+		address = value.substr(1, bracket - 1);
+		value = (bracket + 1 == value.size()) ? "80" : value.substr(colon + 1);
+	} else if (colon != STR::npos) {
+		address = value.substr(0, colon);
+		value = value.substr(colon + 1);
+		if (address == "*") {
+			address = "0.0.0.0";
+		}
+	}
+
+	port = verifyPort(value);
+	if (port == -1 || value.find_first_not_of("0123456789") != STR::npos) {
+		return false;
+	}
+
+	unsigned char buf[sizeof(struct in6_addr)];
+	char printable[INET6_ADDRSTRLEN];
+	int family = (address.find(':') != STR::npos) ? AF_INET6 : AF_INET;
+	if (inet_pton(family, address.c_str(), buf) != 1 || !inet_ntop(family, buf, printable, sizeof(printable))) {
+		return false;
+	}
+	address = printable;
+	return true;
+}
+
 bool ParserUtils::isDirectiveOk(STR line, int start, int end) {
 	VECTOR<STR>	tokens;
 	STR			trimmed_line;
 
 	trimmed_line = line.substr(start, end - start);
 	tokens = Utils::split(trimmed_line, ' ', 1);
+	if (tokens.size() == 1 && (tokens[0] == "least_conn" || tokens[0] == "stub_status"))	// flag directives
+		return true;
 	if (tokens.size() < 2)
 		return false;
 	return true;
@@ -92,13 +234,14 @@ bool ParserUtils::isBlockOk(STR line, int start, int end) {
 	if (tokens.size() != 1 && tokens.size() != 2)
 		return false;
 
-	if (tokens[0] != "events" && tokens[0] != "http" && tokens[0] != "server" && tokens[0] != "location")
+	if (tokens[0] != "events" && tokens[0] != "http" && tokens[0] != "server" && tokens[0] != "location" &&
+		tokens[0] != "upstream")
 		return false;
 
-	if (tokens[0] == "location" && tokens.size() != 2)
+	if ((tokens[0] == "location" || tokens[0] == "upstream") && tokens.size() != 2)
 		return false;
 
-	if (tokens[0] != "location" && tokens.size() != 1)
+	if (tokens[0] != "location" && tokens[0] != "upstream" && tokens.size() != 1)
 		return false;
 
 	return true;
@@ -160,5 +303,207 @@ bool	ParserUtils::minimum_value_check(HttpConfig *conf) {
 			return false;
 		}
 	}
+	for (size_t i = 0; i < conf->_servers.size(); i++) {
+		for (size_t j = 0; j < i; j++) {
+			if (conf->_servers[i]->_listen_default && conf->_servers[j]->_listen_default &&
+				conf->_servers[i]->_listen_port == conf->_servers[j]->_listen_port &&
+				conf->_servers[i]->_listen_server == conf->_servers[j]->_listen_server) {
+				Logger::log(Logger::ERROR, "Duplicate default_server for " + conf->_servers[i]->_listen_server + ":" +
+					Utils::intToString(conf->_servers[i]->_listen_port));
+				return false;
+			}
+		}
+	}
+	if (conf->_access_log != "") {
+		VECTOR<AccessLog::Segment> segments;
+		if (conf->_access_log_format != "combined" &&
+			conf->_log_formats.find(conf->_access_log_format) == conf->_log_formats.end()) {
+			Logger::log(Logger::ERROR, "Unknown log_format " + conf->_access_log_format);
+			return false;
+		}
+		if (!AccessLog::compile(conf->_access_log_format == "combined" ? STR(ACCESS_LOG_COMBINED) :
+				conf->_log_formats[conf->_access_log_format], segments))
+			return false;
+	}
+	if (conf->_types_file != "") {
+		MAP<STR, STR> types;
+		if (!MimeTypes::load(conf->_types_file, types))
+			return false;
+	}
+	for (size_t i = 0; i < conf->_upstreams.size(); i++) {
+		if (conf->_upstreams[i]->_upstream_servers.empty()) {
+			Logger::log(Logger::ERROR, "Upstream " + conf->_upstreams[i]->_name + " without servers found");
+			return false;
+		}
+		for (size_t j = 0; j < conf->_upstreams[i]->_upstream_servers.size(); j++) {
+			UpstreamServer &server = conf->_upstreams[i]->_upstream_servers[j];
+			if (!resolve_address(server._host, server._port, server._addr))
+				return false;
+		}
+	}
+	for (size_t i = 0; i < conf->_servers.size(); i++) {
+		link_upstreams(conf, conf->_servers[i]->_locations);
+		if (!resolve_proxy_pass(conf->_servers[i]->_locations))
+			return false;
+		if (!check_proxy_cache(conf, conf->_servers[i]->_locations))
+			return false;
+		conf->_servers[i]->_location_trie = new LocationTrie();
+		build_location_trie(conf->_servers[i]->_location_trie, conf->_servers[i]->_locations);
+	}
+	compile_effective(conf);
+	return true;
+}
+
+// proxy_pass http://name/ points at the upstream block of that name, if there is one
+void	ParserUtils::link_upstreams(HttpConfig *conf, MAP<STR, LocationConfig*> &locs) {
+	for (MAP<STR, LocationConfig*>::iterator it = locs.begin(); it != locs.end(); ++it) {
+		LocationConfig *location = it->second;
+		for (size_t i = 0; i < conf->_upstreams.size() && location->_proxy_pass_host != ""; i++) {
+			if (conf->_upstreams[i]->_name == location->_proxy_pass_host)
+				location->_upstream = conf->_upstreams[i];
+		}
+		link_upstreams(conf, location->_locations);
+	}
+}
+
+// proxy_pass to a host rather than an upstream block
+bool	ParserUtils::resolve_proxy_pass(MAP<STR, LocationConfig*> &locs) {
+	for (MAP<STR, LocationConfig*>::iterator it = locs.begin(); it != locs.end(); ++it) {
+		LocationConfig *location = it->second;
+		if (location->_proxy_pass_host != "" && !location->_upstream &&
+			!resolve_address(location->_proxy_pass_host, location->_proxy_pass_port, location->_proxy_pass_addr))
+			return false;
+		if (!resolve_proxy_pass(location->_locations))
+			return false;
+	}
+	return true;
+}
+
+/*
+	Upstream addresses are looked up here, at startup and on reload, never
+	per request: getaddrinfo blocks and the event loop would wait on DNS.
+*/
+bool	ParserUtils::resolve_address(const STR &host, int port, struct sockaddr_in &addr) {
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int status = getaddrinfo(host.c_str(), Utils::intToString(port).c_str(), &hints, &result);
+	if (status != 0) {
+		Logger::log(Logger::ERROR, "Host not found in upstream " + host + ": " + STR(gai_strerror(status)));
+		return false;
+	}
+	memcpy(&addr, result->ai_addr, sizeof(addr));
+	freeaddrinfo(result);
+	return true;
+}
+
+// nested locations go in the same trie, their keys are full paths
+void	ParserUtils::build_location_trie(LocationTrie *trie, MAP<STR, LocationConfig*> &locs) {
+	for (MAP<STR, LocationConfig*>::iterator it = locs.begin(); it != locs.end(); ++it) {
+		trie->insert(it->first, it->second);
+		build_location_trie(trie, it->second->_locations);
+	}
+}
+
+// every block gets its EffectiveLocation, parents first so children only copy and override
+void	ParserUtils::compile_effective(HttpConfig *conf) {
+	conf->_effective = inherit_effective(conf, NULL, true);
+	load_error_pages(conf, conf->_effective);
+	for (size_t i = 0; i < conf->_servers.size(); i++) {
+		ServerConfig *server = conf->_servers[i];
+		server->_effective = inherit_effective(server, conf->_effective, false);
+		load_error_pages(conf, server->_effective);
+		if (server->_return_url != "") {
+			server->_effective->_return_code = server->_return_code == -1 ? 301 : server->_return_code;
+			server->_effective->_return_url = server->_return_url;
+		}
+		compile_locations(conf, server->_locations, server->_effective);
+	}
+}
+
+void	ParserUtils::compile_locations(HttpConfig *conf, MAP<STR, LocationConfig*> &locs, EffectiveLocation *parent) {
+	for (MAP<STR, LocationConfig*>::iterator it = locs.begin(); it != locs.end(); ++it) {
+		LocationConfig *location = it->second;
+		EffectiveLocation *effective = inherit_effective(location, parent, false);
+		load_error_pages(conf, effective);
+
+		for (MAP<STR, bool>::iterator method = location->_allowed_methods.begin(); method != location->_allowed_methods.end(); ++method) {
+			if (method->second)
+				effective->_methods |= EffectiveLocation::methodBit(method->first);
+		}
+		if (location->_return_url != "") {
+			effective->_return_code = location->_return_code == -1 ? 301 : location->_return_code;
+			effective->_return_url = location->_return_url;
+		}
+		if (location->_limit_req_rate > 0)
+			effective->_limit_req_zone = location;
+
+		location->_effective = effective;
+		compile_locations(conf, location->_locations, effective);
+	}
+}
+
+// settings every block kind has; default_errors/ pages only count at http level
+EffectiveLocation	*ParserUtils::inherit_effective(AConfigBase *block, EffectiveLocation *parent, bool is_http) {
+	EffectiveLocation *effective = parent ? new EffectiveLocation(*parent) : new EffectiveLocation();
+
+	if (block->_client_max_body_size > 0)
+		effective->_client_max_body_size = block->_client_max_body_size;
+	if (block->_root != "")
+		effective->_root = block->_root;
+	if (!block->_index.empty())
+		effective->_index_levels.insert(effective->_index_levels.begin(), block->_index);
+	for (MAP<int, STR>::iterator it = block->_error_pages.begin(); it != block->_error_pages.end(); ++it) {
+		if (it->second != "" && (it->second.compare(0, 15, "default_errors/") != 0 || is_http)) {
+			VECTOR<STR> &pages = effective->_error_pages[it->first];
+			pages.insert(pages.begin(), it->second);
+		}
+	}
+	return effective;
+}
+
+/*
+	Error pages are read here, once per configuration: every (code, page) pair
+	becomes a response kept in the HttpConfig, all but the status line, Date
+	and Server, and each block points at the first readable one of its list.
+	Edited pages show up on reload.
+*/
+void	ParserUtils::load_error_pages(HttpConfig *conf, EffectiveLocation *effective) {
+	effective->_error_responses.clear();
+	for (MAP<int, VECTOR<STR> >::iterator it = effective->_error_pages.begin(); it != effective->_error_pages.end(); ++it) {
+		for (size_t i = 0; i < it->second.size(); i++) {
+			std::pair<int, STR> key(it->first, it->second[i]);
+			MAP<std::pair<int, STR>, STR>::iterator document = conf->_error_documents.find(key);
+			if (document == conf->_error_documents.end()) {
+				STR response;
+				std::ifstream file(key.second.c_str(), std::ios::binary);
+				if (file) {
+					std::stringstream content;
+					content << file.rdbuf();
+					response = Response::entityHeaders(MimeTypes::contentType(key.second), content.str().size(), "") +
+						content.str();
+				}
+				document = conf->_error_documents.insert(std::make_pair(key, response)).first;
+			}
+			if (document->second != "") {
+				effective->_error_responses[it->first] = &document->second;
+				break;
+			}
+		}
+	}
+}
+
+// proxy_cache needs the http level proxy_cache_path
+bool	ParserUtils::check_proxy_cache(HttpConfig *conf, MAP<STR, LocationConfig*> &locs) {
+	for (MAP<STR, LocationConfig*>::iterator it = locs.begin(); it != locs.end(); ++it) {
+		if (it->second->_proxy_cache && conf->_proxy_cache_path == "") {
+			Logger::log(Logger::ERROR, "proxy_cache in location " + it->first + " without proxy_cache_path");
+			return false;
+		}
+		if (!check_proxy_cache(conf, it->second->_locations))
+			return false;
+	}
 	return true;
 }
@@ -1,33 +1,88 @@
 #include "PollServer.hpp"
 #include "Logger.hpp"
+#include "RateLimiter.hpp"
+#include "UpstreamPool.hpp"
+#include "LoadBalancer.hpp"
+#include "ProxyCache.hpp"
+#include "Parser.hpp"
+#include "Metrics.hpp"
+#include "AccessLog.hpp"
+#include "MimeTypes.hpp"
+#include "Clock.hpp"
+#include "BufferPool.hpp"
+#include "DirListing.hpp"
 
 extern volatile sig_atomic_t g_signal_received;
 
+// prebuilt answer for connections we can't afford to serve, sent without parsing anything
+static const char OVERLOAD_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                        "Content-Type: text/plain\r\n"
+                                        "Content-Length: 19\r\n"
+                                        "Retry-After: 1\r\n"
+                                        "Connection: close\r\n"
+                                        "\r\n"
+                                        "Service Unavailable";
+
 PollServer::PollServer() : MAX_EVENTS(64) {
+    _upgrade_pid = -1;
+    _upgrade_fd = -1;
+    _draining = false;
+    _drain_deadline = 0;
     config = NULL;
+    _generation = NULL;
     running = false;
-    _epoll_fd = epoll_create1(0);
+    _manager = NULL;
+    _last_timeout_check = 0;
+    _last_upstream_check = 0;
+    _accept_paused = false;
+    _accept_resume_at = 0;
+    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (_epoll_fd < 0) {
-        Logger::log(Logger::ERROR, "Failed to create epoll file descriptor");
+        LOG(Logger::ERROR, "Failed to create epoll file descriptor");
     }
     _events.resize(MAX_EVENTS);
 }
 
 PollServer::PollServer(const PollServer &obj) : MAX_EVENTS(64) {
+    _upgrade_pid = -1;
+    _upgrade_fd = -1;
+    _draining = false;
+    _drain_deadline = 0;
     this->config = obj.config;
+    _generation = NULL;
+    _config_path = obj._config_path;
     running = false;
-    _epoll_fd = epoll_create1(0);
+    _manager = NULL;
+    _last_timeout_check = 0;
+    _last_upstream_check = 0;
+    _accept_paused = false;
+    _accept_resume_at = 0;
+    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (_epoll_fd < 0) {
-        Logger::log(Logger::ERROR, "Failed to create epoll file descriptor");
+        LOG(Logger::ERROR, "Failed to create epoll file descriptor");
     }
     _events.resize(MAX_EVENTS);
 }
 
 PollServer::PollServer(HttpConfig *config) : MAX_EVENTS(64) {
+    _upgrade_pid = -1;
+    _upgrade_fd = -1;
+    _draining = false;
+    _drain_deadline = 0;
+    this->config = NULL;
+    _generation = NULL;
     running = false;
-    _epoll_fd = epoll_create1(0);
+    _manager = NULL;
+    _last_timeout_check = 0;
+    _last_upstream_check = 0;
+    _accept_paused = false;
+    _accept_resume_at = 0;
+    _spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if (_epoll_fd < 0) {
-        Logger::log(Logger::ERROR, "Failed to create epoll file descriptor");
+        LOG(Logger::ERROR, "Failed to create epoll file descriptor");
     }
     _events.resize(MAX_EVENTS);
     setConfig(config);
@@ -37,154 +92,452 @@ PollServer::~PollServer() {
     if (_epoll_fd >= 0) {
         close(_epoll_fd);
     }
+    if (_spare_fd >= 0) {
+        close(_spare_fd);
+    }
+    for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+        close(it->first);
+    }
+    if (_upgrade_fd >= 0) {
+        close(_upgrade_fd);
+    }
+    if (_generation) {
+        _generation->release();
+    }
 }
 
-// Helper function setConfig
-void PollServer::getUniqueServers(const HttpConfig *hcf, MAP<int, STR>& unique_servers) {
-	if (!hcf)
-		throw std::runtime_error("Config does not exist");
+// Helper function setConfig: one listener per (address, port), servers in config order
+void PollServer::getUniqueServers(ConfigGeneration *generation) {
+	const HttpConfig *hcf = generation->config();
+	std::map<ListenKey, Listener*> &listeners = generation->listeners();
 
-	// iterate through the servers and add them to the map. changed to map
     for (size_t i = 0; i < hcf->_servers.size(); i++) {
-		bool is_port_found = false;
-        try {
-			if (unique_servers[(hcf->_servers[i]->_listen_port)] != "") {
-				is_port_found = true;
-			}
-		}
-		catch(const std::exception& e) {
-			is_port_found = false;
-		}
-
-		if (!is_port_found) {
-			unique_servers[(hcf->_servers[i]->_listen_port)] = config->_servers[i]->_listen_server;
-		}
+		ListenKey key(hcf->_servers[i]->_listen_server, hcf->_servers[i]->_listen_port);
+		std::map<ListenKey, Listener*>::iterator it = listeners.find(key);
+		if (it == listeners.end())
+			it = listeners.insert(std::make_pair(key, new Listener(key.first, key.second, generation))).first;
+		it->second->addServer(hcf->_servers[i]);
     }
 }
 
-// new helper function to initialize server sockets
-void PollServer::initializeServerSockets(MAP<int, STR>& unique_servers) {
-    for (MAP<int, STR>::iterator it = unique_servers.begin(); it != unique_servers.end(); ++it) {
-        int port = it->first;
-        STR server_addr_str = it->second;
-
-        Logger::log(Logger::INFO, "Setting up server on " + server_addr_str + ":" + Utils::intToString(port));
+/*
+	A wildcard address takes the whole port for its family, so specific
+	addresses on the same port are not bound themselves: their connections
+	come in on the wildcard socket and are sorted out by local address when
+	accepted. IPv6 sockets are v6only, [::]:80 and 0.0.0.0:80 can coexist.
+*/
+bool PollServer::isCoveredByWildcard(ConfigGeneration *generation, const Listener *listener) {
+	if (listener->isWildcard())
+		return false;
+	STR any = (listener->address().find(':') != STR::npos) ? "::" : "0.0.0.0";
+	return generation->listeners().count(ListenKey(any, listener->port())) != 0;
+}
 
-        // Create socket
-        int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_socket < 0) {
-            throw std::runtime_error("Failed to create socket: " + STR(strerror(errno)));
+/*
+	Sockets for the listeners of a generation, into sockets (fd -> listener).
+	An address already bound keeps its socket, so a reload never closes a
+	port that stays configured. Sockets opened here are closed again if any
+	bind fails, the running ones are left alone.
+*/
+void PollServer::initializeServerSockets(ConfigGeneration *generation, std::map<int, Listener*> &sockets) {
+	std::map<ListenKey, Listener*> &listeners = generation->listeners();
+
+    for (std::map<ListenKey, Listener*>::iterator it = listeners.begin(); it != listeners.end(); ++it) {
+        Listener *listener = it->second;
+        if (isCoveredByWildcard(generation, listener)) {
+            LOG(Logger::INFO, "Serving " + listener->address() + ":" + Utils::intToString(listener->port()) + " through the wildcard socket");
+            continue;
         }
 
-        // Set reuse address option
-        int reuse = 1;
-        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
-            close(server_socket);
-            throw std::runtime_error("Failed to set reuse address: " + STR(strerror(errno)));
+        int server_socket = -1;
+        for (std::map<int, Listener*>::iterator bound = _server_sockets.begin(); bound != _server_sockets.end(); ++bound) {
+            if (bound->second->address() == listener->address() && bound->second->port() == listener->port())
+                server_socket = bound->first;
         }
-
-        // Set non-blocking mode
-        int flags = fcntl(server_socket, F_GETFL, 0);
-        if (flags == -1) {
-            close(server_socket);
-            throw std::runtime_error("Failed to get socket flags: " + STR(strerror(errno)));
+        std::map<ListenKey, int>::iterator inherited = _inherited_sockets.find(it->first);
+        if (server_socket < 0 && inherited != _inherited_sockets.end()) {
+            LOG(Logger::INFO, "Listening on " + listener->address() + ":" + Utils::intToString(listener->port()) +
+                " with the socket of the previous binary");
+            server_socket = inherited->second;
+            fcntl(server_socket, F_SETFD, FD_CLOEXEC);
+            _inherited_sockets.erase(inherited);
         }
-
-        if (fcntl(server_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
-            close(server_socket);
-            throw std::runtime_error("Failed to set non-blocking mode: " + STR(strerror(errno)));
+        try {
+            if (server_socket < 0)
+                server_socket = openServerSocket(listener->address(), listener->port());
+        } catch (const std::exception &e) {
+            for (std::map<int, Listener*>::iterator opened = sockets.begin(); opened != sockets.end(); ++opened) {
+                if (_server_sockets.find(opened->first) == _server_sockets.end())
+                    close(opened->first);
+            }
+            sockets.clear();
+            throw;
         }
+        sockets[server_socket] = listener;
+    }
+}
 
-        // Set up server address
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
+// new helper function to open one listening socket
+int PollServer::openServerSocket(const STR &server_addr_str, int port) {
+    LOG(Logger::INFO, "Setting up server on " + server_addr_str + ":" + Utils::intToString(port));
 
-        if (server_addr_str == "0.0.0.0") {
-            addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        } else {
-            struct addrinfo hints, *result;
-            memset(&hints, 0, sizeof(hints));
-            hints.ai_family = AF_INET;
-            hints.ai_socktype = SOCK_STREAM;
-            hints.ai_flags = AI_NUMERICHOST;
-
-            int status = getaddrinfo(server_addr_str.c_str(), NULL, &hints, &result);
-            if (status != 0) {
-                close(server_socket);
-                throw std::runtime_error("Failed to parse IP address: " +
-                                         STR(gai_strerror(status)));
-            }
+    // Resolve the address, already numeric after parsing
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_PASSIVE;
 
-            memcpy(&addr.sin_addr,
-                   &((struct sockaddr_in*)result->ai_addr)->sin_addr,
-                   sizeof(struct in_addr));
+    int status = getaddrinfo(server_addr_str.c_str(), Utils::intToString(port).c_str(), &hints, &result);
+    if (status != 0) {
+        throw std::runtime_error("Failed to parse IP address: " + STR(gai_strerror(status)));
+    }
 
-            freeaddrinfo(result);
-        }
+    // Create socket
+    int server_socket = socket(result->ai_family, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        freeaddrinfo(result);
+        throw std::runtime_error("Failed to create socket: " + STR(strerror(errno)));
+    }
 
-        // Bind socket
-        if (bind(server_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            close(server_socket);
-            throw std::runtime_error("Failed to bind to " + server_addr_str + ":" +
-                                     Utils::intToString(port) + " - " + STR(strerror(errno)));
-        }
+    // Set reuse address option
+    int reuse = 1;
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        freeaddrinfo(result);
+        close(server_socket);
+        throw std::runtime_error("Failed to set reuse address: " + STR(strerror(errno)));
+    }
 
-        // Listen for connections
-        if (listen(server_socket, SOMAXCONN) < 0) {
-            close(server_socket);
-            throw std::runtime_error("Failed to listen on port " + Utils::intToString(port) +
-                                     ": " + STR(strerror(errno)));
-        }
+    int v6only = 1;
+    if (result->ai_family == AF_INET6 &&
+        setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+        freeaddrinfo(result);
+        close(server_socket);
+        throw std::runtime_error("Failed to set IPV6_V6ONLY: " + STR(strerror(errno)));
+    }
+
+    // Set non-blocking mode
+    int flags = fcntl(server_socket, F_GETFL, 0);
+    if (flags == -1) {
+        freeaddrinfo(result);
+        close(server_socket);
+        throw std::runtime_error("Failed to get socket flags: " + STR(strerror(errno)));
+    }
 
-        // Store socket in map
-        _server_sockets[port] = server_socket;
+    if (fcntl(server_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        freeaddrinfo(result);
+        close(server_socket);
+        throw std::runtime_error("Failed to set non-blocking mode: " + STR(strerror(errno)));
+    }
+    // CGI children don't get it, a binary upgrade clears the flag for the new binary
+    fcntl(server_socket, F_SETFD, FD_CLOEXEC);
+
+    // Bind socket
+    int bound = bind(server_socket, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (bound < 0) {
+        close(server_socket);
+        throw std::runtime_error("Failed to bind to " + server_addr_str + ":" +
+                                 Utils::intToString(port) + " - " + STR(strerror(errno)));
+    }
 
-        // for better handling of large requests
-		if (!AddFd(server_socket, EPOLLIN, SERVER_FD)) {
-			close(server_socket);
-			throw std::runtime_error("Failed to add server socket to epoll");
-		}
+    // Listen for connections
+    if (listen(server_socket, SOMAXCONN) < 0) {
+        close(server_socket);
+        throw std::runtime_error("Failed to listen on port " + Utils::intToString(port) +
+                                 ": " + STR(strerror(errno)));
+    }
 
-        Logger::log(Logger::INFO, "Server listening on " + server_addr_str + ":" + Utils::intToString(port));
+    LOG(Logger::INFO, "Server listening on " + server_addr_str + ":" + Utils::intToString(port));
+    return server_socket;
+}
+
+/*
+	Makes sockets the set of listening sockets: new ones join epoll, the ones
+	no longer configured are closed. Connections already accepted on them
+	are not affected.
+*/
+void PollServer::switchServerSockets(std::map<int, Listener*> &sockets) {
+    for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+        if (sockets.find(it->first) == sockets.end()) {
+            LOG(Logger::INFO, "Closing listener " + it->second->address() + ":" + Utils::intToString(it->second->port()));
+            RemoveFd(it->first);
+            close(it->first);
+        }
     }
+    for (std::map<int, Listener*>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
+        if (_server_sockets.find(it->first) == _server_sockets.end() &&
+            !AddFd(it->first, _accept_paused ? 0u : (uint32_t)EPOLLIN, SERVER_FD)) {
+            LOG(Logger::ERROR, "Failed to add server socket to epoll");
+        }
+    }
+    _server_sockets = sockets;
 }
 
+// takes ownership of config, it becomes the first generation
 void PollServer::setConfig(HttpConfig *config) {
 	if (!config)
 		throw std::runtime_error("Config does not exist");
 
+	_generation = new ConfigGeneration(config, 1);
 	this->config = config;
 
-    MAP<int, STR> unique_servers;
+	getUniqueServers(_generation);
+
+	loadInheritedSockets();
+	std::map<int, Listener*> sockets;
+	initializeServerSockets(_generation, sockets);
+	switchServerSockets(sockets);
+
+	// inherited sockets the config no longer listens on
+	for (std::map<ListenKey, int>::iterator it = _inherited_sockets.begin(); it != _inherited_sockets.end(); ++it) {
+		close(it->second);
+	}
+	_inherited_sockets.clear();
+}
+
+/*
+	Executed again on SIGUSR2. Resolved now: argv[0] has no slash when the
+	server was started through PATH, and once the binary is replaced on disk
+	/proc/self/exe only names the deleted file.
+*/
+void PollServer::setBinaryPath(const STR &binary_path) {
+	char resolved[PATH_MAX];
+	ssize_t length = readlink("/proc/self/exe", resolved, sizeof(resolved) - 1);
+	if (length > 0) {
+		resolved[length] = '\0';
+		_binary_path = resolved;
+	} else if (realpath(binary_path.c_str(), resolved)) {
+		_binary_path = resolved;
+	} else {
+		_binary_path = binary_path;
+	}
+}
+
+// file read again on SIGHUP
+void PollServer::setConfigPath(const STR &config_path) {
+	_config_path = config_path;
+}
+
+/*
+	SIGHUP: parse the file into a new generation and switch to it. New
+	connections get the new servers right away, connections already open
+	finish on theirs. Any error keeps the running configuration.
+*/
+void PollServer::reloadConfig(RequestsManager &manager) {
+	if (_draining) {
+		LOG(Logger::WARNING, "Draining connections, reload ignored");
+		return;
+	}
+	LOG(Logger::INFO, "Reloading configuration from " + _config_path);
+
+	HttpConfig *next = NULL;
+	try {
+		Parser parser(_config_path);
+		next = parser.Parse();
+	} catch (const std::exception &e) {
+		LOG(Logger::ERROR, "Reload parsing failure: " + STR(e.what()));
+	}
+	if (!next) {
+		LOG(Logger::ERROR, "Reload failed, keeping configuration generation " + Utils::intToString(_generation->number()));
+		return;
+	}
+
+	ConfigGeneration *generation = new ConfigGeneration(next, _generation->number() + 1);
+	getUniqueServers(generation);
+
+	std::map<int, Listener*> sockets;
+	try {
+		initializeServerSockets(generation, sockets);
+	} catch (const std::exception &e) {
+		LOG(Logger::ERROR, "Reload failed: " + STR(e.what()) + ", keeping configuration generation " +
+			Utils::intToString(_generation->number()));
+		generation->release();
+		return;
+	}
+	switchServerSockets(sockets);
+
+	LoadBalancer::stopHealthChecks(config->_upstreams);
+	ConfigGeneration *previous = _generation;
+	_generation = generation;
+	config = next;
+	manager.setConfig(config);
+	Logger::configure(config->_global_error_log, config->_error_log_level);
+	ProxyCache::init(config);
+	AccessLog::init(config);
+	MimeTypes::init(config);
+	LOG(Logger::INFO, "Configuration generation " + Utils::intToString(_generation->number()) + " active");
+	previous->release();
+}
+
+/*
+	Binary upgrade, SIGUSR2: the binary is executed again with the listening
+	sockets left open and listed in WEBSERV_LISTEN_FDS ("fd,address,port;"...).
+	The new process takes them over instead of binding and writes to the
+	WEBSERV_READY_FD pipe once it is serving. Only then does this process stop
+	accepting and drain its connections; if the pipe closes without that, the
+	new binary failed and this one carries on.
+*/
+void PollServer::startUpgrade() {
+	if (_upgrade_pid > 0 || _draining) {
+		LOG(Logger::WARNING, "Binary upgrade already in progress, SIGUSR2 ignored");
+		return;
+	}
+
+	int ready[2];
+	if (pipe(ready) < 0) {
+		LOG(Logger::ERROR, "Binary upgrade: pipe failed: " + STR(strerror(errno)));
+		return;
+	}
+	fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+
+	STR listen_fds;
+	for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+		listen_fds += Utils::intToString(it->first) + "," + it->second->address() + "," +
+			Utils::intToString(it->second->port()) + ";";
+	}
+
+	LOG(Logger::INFO, "Binary upgrade: starting " + _binary_path);
+	pid_t pid = fork();
+	if (pid < 0) {
+		LOG(Logger::ERROR, "Binary upgrade: fork failed: " + STR(strerror(errno)));
+		close(ready[0]);
+		close(ready[1]);
+		return;
+	}
+	if (pid == 0) {
+		for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+			fcntl(it->first, F_SETFD, 0);
+		}
+		setenv("WEBSERV_LISTEN_FDS", listen_fds.c_str(), 1);
+		setenv("WEBSERV_READY_FD", Utils::intToString(ready[1]).c_str(), 1);
+		char *argv[] = { const_cast<char*>(_binary_path.c_str()), const_cast<char*>(_config_path.c_str()), NULL };
+		execv(argv[0], argv);
+		_exit(1);
+	}
+
+	close(ready[1]);
+	_upgrade_pid = pid;
+	_upgrade_fd = ready[0];
+	if (!AddFd(_upgrade_fd, EPOLLIN, UPGRADE_FD)) {
+		LOG(Logger::ERROR, "Binary upgrade: cannot watch the new process, keeping this one");
+		close(_upgrade_fd);
+		_upgrade_fd = -1;
+	}
+}
+
+// the new binary reported in, or its end of the pipe closed
+void PollServer::finishUpgrade() {
+	char status = 0;
+	ssize_t nbytes = read(_upgrade_fd, &status, 1);
+	if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	RemoveFd(_upgrade_fd);
+	close(_upgrade_fd);
+	_upgrade_fd = -1;
+
+	if (nbytes == 1 && status == '1') {
+		LOG(Logger::INFO, "Binary upgrade: new process " + Utils::intToString(_upgrade_pid) +
+			" is serving, draining connections");
+		beginDrain(*_manager);
+		return;
+	}
+	LOG(Logger::ERROR, "Binary upgrade: new process failed to start, keeping this one");
+	waitpid(_upgrade_pid, NULL, 0);	// closing the pipe means it is exiting
+	_upgrade_pid = -1;
+}
+
+/*
+	Graceful stop (SIGQUIT/SIGTERM, or after a binary upgrade): listeners are
+	closed, idle keep-alive connections too, and every other connection is
+	closed once its response is sent. The loop ends when none are left or
+	worker_shutdown_timeout runs out.
+*/
+void PollServer::beginDrain(RequestsManager &manager) {
+	if (_draining)
+		return;
+	LOG(Logger::INFO, "Draining " + Utils::intToString(_client_ips.size()) + " connections" +
+		(config->_worker_shutdown_timeout ? " for at most " + Utils::intToString(config->_worker_shutdown_timeout) + "s" : ""));
+
+	std::map<int, Listener*> none;
+	switchServerSockets(none);
+	_draining = true;
+	_drain_deadline = config->_worker_shutdown_timeout ? time(NULL) + config->_worker_shutdown_timeout : 0;
+
+	VECTOR<int> idle;
+	manager.Drain(idle);
+	for (size_t i = 0; i < idle.size(); i++) {
+		CloseClient(idle[i]);
+	}
+}
+
+bool PollServer::isDrained() {
+	if (_client_ips.empty()) {
+		LOG(Logger::INFO, "All connections drained");
+		return true;
+	}
+	if (_drain_deadline && time(NULL) >= _drain_deadline) {
+		LOG(Logger::WARNING, "worker_shutdown_timeout reached, closing " +
+			Utils::intToString(_client_ips.size()) + " connections");
+		return true;
+	}
+	return false;
+}
+
+// sockets handed over by the previous binary, see startUpgrade
+void PollServer::loadInheritedSockets() {
+	const char *env = getenv("WEBSERV_LISTEN_FDS");
+	if (!env)
+		return;
 
-	getUniqueServers(config, unique_servers);
+	VECTOR<STR> entries = Utils::split(env, ';', false);
+	for (size_t i = 0; i < entries.size(); i++) {
+		VECTOR<STR> fields = Utils::split(entries[i], ',', false);
+		if (fields.size() != 3)
+			continue;
+		int fd = atoi(fields[0].c_str());
+		if (fd < 0 || fcntl(fd, F_GETFD) == -1)
+			continue;
+		_inherited_sockets[ListenKey(fields[1], atoi(fields[2].c_str()))] = fd;
+	}
+	unsetenv("WEBSERV_LISTEN_FDS");
+}
+
+// tell the previous binary we are serving, it stops accepting and drains
+void PollServer::signalReady() {
+	const char *env = getenv("WEBSERV_READY_FD");
+	if (!env)
+		return;
 
-	initializeServerSockets(unique_servers);
+	int fd = atoi(env);
+	unsetenv("WEBSERV_READY_FD");
+	if (write(fd, "1", 1) != 1)
+		LOG(Logger::ERROR, "Binary upgrade: cannot notify the previous process: " + STR(strerror(errno)));
+	close(fd);
 }
 
 bool PollServer::AddFd(int fd, uint32_t events, FdType type) {
     if (fd < 0) {
-        Logger::log(Logger::ERROR, "Attempted to add invalid file descriptor: " + Utils::intToString(fd));
+        LOG(Logger::ERROR, "Attempted to add invalid file descriptor: " + Utils::intToString(fd));
         return false;
     }
 
     // Set non-blocking mode for the fd
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags == -1) {
-        Logger::log(Logger::ERROR, "Failed to get flags for fd " + Utils::intToString(fd) + ": " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to get flags for fd " + Utils::intToString(fd) + ": " + STR(strerror(errno)));
         return false;
     }
 
     if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        Logger::log(Logger::ERROR, "Failed to set non-blocking mode for fd " + Utils::intToString(fd) + ": " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to set non-blocking mode for fd " + Utils::intToString(fd) + ": " + STR(strerror(errno)));
         return false;
     }
 
     // Check if the fd is already being tracked
     if (_fd_types.find(fd) != _fd_types.end()) {
-        Logger::log(Logger::WARNING, "File descriptor " + Utils::intToString(fd) + " is already tracked as type " +
+        LOG(Logger::WARNING, "File descriptor " + Utils::intToString(fd) + " is already tracked as type " +
                        Utils::intToString(_fd_types[fd]) + ", changing to " + Utils::intToString(type));
     }
 
@@ -193,7 +546,7 @@ bool PollServer::AddFd(int fd, uint32_t events, FdType type) {
     event.data.fd = fd;
 
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
-        Logger::log(Logger::ERROR, "Failed to add fd " + Utils::intToString(fd) + " to epoll: " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to add fd " + Utils::intToString(fd) + " to epoll: " + STR(strerror(errno)));
         return false;
     }
 
@@ -207,10 +560,11 @@ bool PollServer::AddFd(int fd, uint32_t events, FdType type) {
         case CLIENT_FD: type_name = "client"; break;
         case CGI_FD: type_name = "CGI"; break;
         case POST_FD: type_name = "POST"; break;
+        case UPSTREAM_FD: type_name = "upstream"; break;
         default: type_name = "unknown"; break;
     }
 
-    Logger::log(Logger::DEBUG, "Added " + type_name + " fd " + Utils::intToString(fd) + " to epoll");
+    LOG(Logger::DEBUG, "Added " + type_name + " fd " + Utils::intToString(fd) + " to epoll");
 
     return true;
 }
@@ -218,19 +572,19 @@ bool PollServer::AddFd(int fd, uint32_t events, FdType type) {
 bool PollServer::AddCgiFd(int cgi_fd, int client_fd) {
     // Validate file descriptors
     if (cgi_fd < 0 || client_fd < 0) {
-        Logger::log(Logger::ERROR, "Invalid file descriptors in AddCgiFd");
+        LOG(Logger::ERROR, "Invalid file descriptors in AddCgiFd");
         return false;
     }
 
     // Make sure the CGI fd is valid
     if (fcntl(cgi_fd, F_GETFD) == -1) {
-        Logger::log(Logger::ERROR, "CGI fd " + Utils::intToString(cgi_fd) + " is not valid");
+        LOG(Logger::ERROR, "CGI fd " + Utils::intToString(cgi_fd) + " is not valid");
         return false;
     }
 
     // Make sure the client fd is still valid
     if (fcntl(client_fd, F_GETFD) == -1) {
-        Logger::log(Logger::ERROR, "Client fd " + Utils::intToString(client_fd) + " is not valid");
+        LOG(Logger::ERROR, "Client fd " + Utils::intToString(client_fd) + " is not valid");
         return false;
     }
 
@@ -238,7 +592,7 @@ bool PollServer::AddCgiFd(int cgi_fd, int client_fd) {
     int flags = fcntl(cgi_fd, F_GETFL, 0);
     if ((flags & O_NONBLOCK) == 0) {
         if (fcntl(cgi_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-            Logger::log(Logger::ERROR, "Failed to set non-blocking mode for CGI fd");
+            LOG(Logger::ERROR, "Failed to set non-blocking mode for CGI fd");
             return false;
         }
     }
@@ -246,7 +600,7 @@ bool PollServer::AddCgiFd(int cgi_fd, int client_fd) {
     // Add the fd to epoll
     if (AddFd(cgi_fd, EPOLLIN | EPOLLET, CGI_FD)) { // Using edge-triggered mode
         _cgi_to_client[cgi_fd] = client_fd;
-        Logger::log(Logger::INFO, "Successfully added CGI fd " + Utils::intToString(cgi_fd) +
+        LOG(Logger::DEBUG, "Successfully added CGI fd " + Utils::intToString(cgi_fd) +
                        " for client " + Utils::intToString(client_fd));
         return true;
     }
@@ -256,19 +610,19 @@ bool PollServer::AddCgiFd(int cgi_fd, int client_fd) {
 
 bool PollServer::ModifyFd(int fd, uint32_t events) {
     if (fd < 0) {
-        Logger::log(Logger::WARNING, "Invalid fd in ModifyFd: " + Utils::intToString(fd));
+        LOG(Logger::WARNING, "Invalid fd in ModifyFd: " + Utils::intToString(fd));
         return false;
     }
 
     // CRITICAL FIX: Check if fd is still valid
     if (fcntl(fd, F_GETFD) == -1) {
-        Logger::log(Logger::ERROR, "Attempted to modify closed fd: " + Utils::intToString(fd));
+        LOG(Logger::ERROR, "Attempted to modify closed fd: " + Utils::intToString(fd));
         return false;
     }
 
     // Make sure we're tracking this fd
     if (_fd_types.find(fd) == _fd_types.end()) {
-        Logger::log(Logger::ERROR, "Attempted to modify untracked fd: " + Utils::intToString(fd));
+        LOG(Logger::ERROR, "Attempted to modify untracked fd: " + Utils::intToString(fd));
         return false;
     }
 
@@ -277,7 +631,7 @@ bool PollServer::ModifyFd(int fd, uint32_t events) {
     event.data.fd = fd;
 
     if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
-        Logger::log(Logger::ERROR, "Failed to modify fd in epoll: " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to modify fd in epoll: " + STR(strerror(errno)));
         return false;
     }
 
@@ -286,13 +640,13 @@ bool PollServer::ModifyFd(int fd, uint32_t events) {
 
 bool PollServer::RemoveFd(int fd) {
     if (fd < 0) {
-        Logger::log(Logger::WARNING, "Invalid fd in RemoveFd: " + Utils::intToString(fd));
+        LOG(Logger::WARNING, "Invalid fd in RemoveFd: " + Utils::intToString(fd));
         return false;
     }
 
     // Check if we're tracking this fd
     if (_fd_types.find(fd) == _fd_types.end()) {
-        Logger::log(Logger::DEBUG, "RemoveFd: File descriptor " + Utils::intToString(fd) +
+        LOG(Logger::DEBUG, "RemoveFd: File descriptor " + Utils::intToString(fd) +
                       " not found in tracking map");
         return true; // Not an error if we weren't tracking it
     }
@@ -304,20 +658,21 @@ bool PollServer::RemoveFd(int fd) {
         case CLIENT_FD: type_name = "client"; break;
         case CGI_FD: type_name = "CGI"; break;
         case POST_FD: type_name = "POST"; break;
+        case UPSTREAM_FD: type_name = "upstream"; break;
         default: type_name = "unknown"; break;
     }
 
-    Logger::log(Logger::DEBUG, "Removing " + type_name + " fd: " + Utils::intToString(fd));
+    LOG(Logger::DEBUG, "Removing " + type_name + " fd: " + Utils::intToString(fd));
 
     // CRITICAL: Check if fd is still valid before trying to use it
     if (fcntl(fd, F_GETFD) != -1) {
         // Only try to remove from epoll if the fd is valid
         if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
-            Logger::log(Logger::DEBUG, "RemoveFd: " + type_name + " fd " + Utils::intToString(fd) +
+            LOG(Logger::DEBUG, "RemoveFd: " + type_name + " fd " + Utils::intToString(fd) +
                           " could not be removed from epoll: " + STR(strerror(errno)));
         }
     } else {
-        Logger::log(Logger::DEBUG, "RemoveFd: " + type_name + " fd " + Utils::intToString(fd) +
+        LOG(Logger::DEBUG, "RemoveFd: " + type_name + " fd " + Utils::intToString(fd) +
                       " was already closed or removed from epoll");
     }
 
@@ -327,20 +682,30 @@ bool PollServer::RemoveFd(int fd) {
     return true;
 }
 
-// Add server socket
-bool PollServer::AddServerSocket(int port, int socket_fd) {
-    _server_sockets[port] = socket_fd;
-    return AddFd(socket_fd, EPOLLIN, SERVER_FD);
-}
-
 // Accept new client connection
-void PollServer::AcceptClient(int server_fd) {
-	struct sockaddr_in client_addr;
+void PollServer::AcceptClient(int server_fd, RequestsManager &manager) {
+	struct sockaddr_storage client_addr;
 	socklen_t client_len = sizeof(client_addr);
 
-	int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+	int client_fd = accept4(server_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
 	if (client_fd < 0) {
-		Logger::log(Logger::ERROR, "Failed to accept client connection");
+		if (errno == EMFILE || errno == ENFILE) {
+			HandleFdExhaustion(server_fd);
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			LOG(Logger::ERROR, "Failed to accept client connection: " + STR(strerror(errno)));
+		}
+		return;
+	}
+	Metrics::connectionAccepted();
+
+	if ((int)_client_ips.size() >= config->_worker_connections) {
+		RejectClient(client_fd, "worker_connections limit reached");
+		return;
+	}
+
+	ClientKey client_ip = Utils::addressKey((struct sockaddr*)&client_addr);
+	if (config->_limit_conn_per_ip > 0 && _connections_per_ip[client_ip] >= config->_limit_conn_per_ip) {
+		RejectClient(client_fd, "limit_conn_per_ip reached");
 		return;
 	}
 
@@ -350,19 +715,98 @@ void PollServer::AcceptClient(int server_fd) {
 
 	// Add to epoll for read events
 	if (!AddFd(client_fd, EPOLLIN , CLIENT_FD)) {
-		Logger::log(Logger::ERROR, "Failed to add client fd to epoll");
+		LOG(Logger::ERROR, "Failed to add client fd to epoll");
 		close(client_fd);
 		return;
 	}
+	manager.RegisterClient(client_fd, (struct sockaddr*)&client_addr, findListener(server_fd, client_fd));
+	_client_ips[client_fd] = client_ip;
+	_connections_per_ip[client_ip]++;
+
+	const ClientState *client_state = manager.getClientState(client_fd);
+	LOG(Logger::DEBUG, "New client connection accepted: " + Utils::intToString(client_fd) +
+		" from " + client_state->remote_addr + ":" + Utils::intToString(client_state->remote_port));
+}
+
+// listener of the socket, or of the local address when a wildcard socket accepts for specific ones
+Listener *PollServer::findListener(int server_fd, int client_fd) {
+	Listener *listener = _server_sockets[server_fd];
+	if (!listener->isWildcard() || _generation->listeners().size() == _server_sockets.size())
+		return listener;
+
+	struct sockaddr_storage local_addr;
+	socklen_t local_len = sizeof(local_addr);
+	if (getsockname(client_fd, (struct sockaddr*)&local_addr, &local_len) < 0)
+		return listener;
+	std::map<ListenKey, Listener*> &listeners = _generation->listeners();
+	std::map<ListenKey, Listener*>::iterator it =
+		listeners.find(ListenKey(Utils::addressToString((struct sockaddr*)&local_addr), listener->port()));
+	return (it != listeners.end()) ? it->second : listener;
+}
+
+// Over capacity: answer with the canned 503 and drop the connection right away
+void PollServer::RejectClient(int client_fd, const STR &reason) {
+	LOG(Logger::WARNING, "Rejecting client " + Utils::intToString(client_fd) + ": " + reason);
+	ssize_t sent = send(client_fd, OVERLOAD_RESPONSE, sizeof(OVERLOAD_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent > 0) {
+		Metrics::responseSent(503);
+		Metrics::bytesSent(sent);
+	}
+	close(client_fd);
+}
 
-	Logger::log(Logger::INFO, "New client connection accepted: " + Utils::intToString(client_fd));
+/*
+	accept() failed with EMFILE/ENFILE: the pending connection stays in the backlog and
+	the level-triggered listener fires again immediately. Free the spare fd, take the
+	connection off the queue, answer 503 and take the spare back. If even that is not
+	possible, stop polling the listeners for a second instead of spinning.
+*/
+void PollServer::HandleFdExhaustion(int server_fd) {
+	LOG(Logger::WARNING, "Out of file descriptors while accepting: " + STR(strerror(errno)));
+
+	if (_spare_fd >= 0) {
+		close(_spare_fd);
+		_spare_fd = -1;
+
+		int client_fd = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client_fd >= 0) {
+			RejectClient(client_fd, "out of file descriptors");
+		}
+		_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (client_fd >= 0)
+			return;
+	}
+	PauseAccepting();
+}
+
+void PollServer::PauseAccepting() {
+	if (_accept_paused)
+		return;
+	LOG(Logger::WARNING, "Pausing accept for a second");
+	for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+		ModifyFd(it->first, 0);
+	}
+	_accept_paused = true;
+	_accept_resume_at = time(NULL) + 1;
+}
+
+void PollServer::ResumeAccepting() {
+	if (!_accept_paused || time(NULL) < _accept_resume_at)
+		return;
+	if (_spare_fd < 0)
+		_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+		ModifyFd(it->first, EPOLLIN);
+	}
+	_accept_paused = false;
+	LOG(Logger::INFO, "Resumed accepting connections");
 }
 
 void PollServer::HandleCgiOutput(int cgi_fd, RequestsManager &manager) {
     // Find the associated client
     MAP<int, int>::iterator it = _cgi_to_client.find(cgi_fd);
     if (it == _cgi_to_client.end()) {
-        Logger::log(Logger::ERROR, "CGI fd without associated client: " + Utils::intToString(cgi_fd));
+        LOG(Logger::ERROR, "CGI fd without associated client: " + Utils::intToString(cgi_fd));
 
         // Safe cleanup since we don't know the client
         if (fcntl(cgi_fd, F_GETFD) != -1) {
@@ -381,7 +825,7 @@ void PollServer::HandleCgiOutput(int cgi_fd, RequestsManager &manager) {
     // CRITICAL FIX: Check if client is still valid
     if (_fd_types.find(client_fd) == _fd_types.end() ||
         fcntl(client_fd, F_GETFD) == -1) {
-        Logger::log(Logger::WARNING, "Client fd " + Utils::intToString(client_fd) +
+        LOG(Logger::WARNING, "Client fd " + Utils::intToString(client_fd) +
                       " associated with CGI fd " + Utils::intToString(cgi_fd) + " is invalid");
 
         // Clean up the orphaned CGI fd
@@ -411,14 +855,14 @@ void PollServer::HandleCgiOutput(int cgi_fd, RequestsManager &manager) {
             if (fcntl(client_fd, F_GETFD) != -1) {
                 if (ModifyFd(client_fd, EPOLLOUT)) {
                     // Successfully modified
-                    Logger::log(Logger::DEBUG, "Client fd " + Utils::intToString(client_fd) +
+                    LOG(Logger::DEBUG, "Client fd " + Utils::intToString(client_fd) +
                                   " switched to write mode");
                 } else {
-                    Logger::log(Logger::ERROR, "Failed to modify client fd for writing, closing");
+                    LOG(Logger::ERROR, "Failed to modify client fd for writing, closing");
                     CloseClient(client_fd);
                 }
             } else {
-                Logger::log(Logger::WARNING, "Client fd invalid in HandleCgiOutput");
+                LOG(Logger::WARNING, "Client fd invalid in HandleCgiOutput");
                 // Client already closed, just clean up CGI
             }
 
@@ -448,7 +892,7 @@ void PollServer::HandleCgiOutput(int cgi_fd, RequestsManager &manager) {
         }
         // result < 0 means CGI still running, keep monitoring
     } catch (const std::exception& e) {
-        Logger::log(Logger::ERROR, "Error handling CGI output: " + STR(e.what()));
+        LOG(Logger::ERROR, "Error handling CGI output: " + STR(e.what()));
 
         // Remove mapping first
         _cgi_to_client.erase(it);
@@ -467,12 +911,106 @@ void PollServer::HandleCgiOutput(int cgi_fd, RequestsManager &manager) {
     }
 }
 
+void PollServer::HandleUpstreamEvent(int upstream_fd, uint32_t events, RequestsManager &manager) {
+    MAP<int, int>::iterator it = _upstream_to_client.find(upstream_fd);
+    if (it == _upstream_to_client.end()) {
+        LOG(Logger::ERROR, "Upstream fd without associated client: " + Utils::intToString(upstream_fd));
+        RemoveFd(upstream_fd);
+        return;
+    }
+
+    int client_fd = it->second;
+    manager.setClientFd(client_fd);
+    manager.HandleUpstreamEvent(events);
+    syncUpstream(client_fd, manager);
+}
+
+/*
+	Bring epoll in line with the client's proxy state: the upstream fd gets what
+	the handler waits for (nothing while the client is behind), the client fd is
+	only watched for writing while there is something to send. Also picks up a
+	new upstream fd after a pooled connection was replaced, and hands the client
+	back to the normal flow once the upstream is finished.
+*/
+void PollServer::syncUpstream(int client_fd, RequestsManager &manager) {
+    manager.setClientFd(client_fd);
+    ProxyHandler *proxy = manager.getProxyHandler();
+    int upstream_fd = proxy ? proxy->getFd() : -1;
+
+    int registered_fd = -1;
+    for (MAP<int, int>::iterator it = _upstream_to_client.begin(); it != _upstream_to_client.end(); ++it) {
+        if (it->second == client_fd) {
+            registered_fd = it->first;
+            break;
+        }
+    }
+    if (registered_fd != -1 && (registered_fd != upstream_fd || !proxy || proxy->isFinished())) {
+        _upstream_to_client.erase(registered_fd);
+        RemoveFd(registered_fd);
+        registered_fd = -1;
+    }
+
+    if (!proxy)
+        return;
+
+    if (proxy->isFinished() || upstream_fd < 0) {
+        int status = manager.FinishUpstream();
+        if (status == 0) {
+            CloseClient(client_fd);
+        } else if (status == 2) {
+            ModifyFd(client_fd, EPOLLOUT);
+        } else if (status == 3) {
+            ModifyFd(client_fd, EPOLLIN);
+        } else if (status == 6) {
+            syncUpstream(client_fd, manager);	// retried on another upstream server
+        }
+        return;
+    }
+
+    uint32_t upstream_events = manager.getUpstreamEvents();
+    if (registered_fd == -1) {
+        if (!AddFd(upstream_fd, upstream_events, UPSTREAM_FD)) {
+            CloseClient(client_fd);
+            return;
+        }
+        _upstream_to_client[upstream_fd] = client_fd;
+    } else {
+        ModifyFd(upstream_fd, upstream_events);
+    }
+    ModifyFd(client_fd, manager.hasPendingOutput() ? (uint32_t)EPOLLOUT : 0u);
+}
+
+// proxy_connect_timeout / proxy_read_timeout, idle pooled connections, health checks and inactive cache entries
+void PollServer::processUpstreamTimeouts(RequestsManager &manager) {
+    time_t now = time(NULL);
+    if (now == _last_upstream_check)
+        return;
+    _last_upstream_check = now;
+
+    std::vector<int> clients;
+    for (MAP<int, int>::iterator it = _upstream_to_client.begin(); it != _upstream_to_client.end(); ++it) {
+        clients.push_back(it->second);
+    }
+    for (size_t i = 0; i < clients.size(); ++i) {
+        manager.setClientFd(clients[i]);
+        if (manager.CheckUpstreamTimeout(now))
+            syncUpstream(clients[i], manager);
+    }
+    UpstreamPool::cleanup(now);
+    LoadBalancer::runHealthChecks(config->_upstreams, now);
+    ProxyCache::cleanup(now);
+}
+
 // check disconnect or timeout cgis (garbage collection)
 void PollServer::processDisconnectOrTimeoutCgis(RequestsManager &manager) {
     std::vector<int> completed_cgis;
-    for (MAP<int, int>::iterator it = _cgi_to_client.begin(); it != _cgi_to_client.end(); ++it) {
-        int cgi_fd = it->first;
-        int client_fd = it->second;
+    // HandleCgiOutput erases finished CGIs from the map, walk a copy
+    std::vector<std::pair<int, int> > cgis(_cgi_to_client.begin(), _cgi_to_client.end());
+    for (size_t i = 0; i < cgis.size(); ++i) {
+        int cgi_fd = cgis[i].first;
+        int client_fd = cgis[i].second;
+        if (_cgi_to_client.find(cgi_fd) == _cgi_to_client.end())
+            continue;
 
         // Skip if client fd is invalid
         if (fcntl(client_fd, F_GETFD) == -1) {
@@ -491,7 +1029,7 @@ void PollServer::processDisconnectOrTimeoutCgis(RequestsManager &manager) {
             manager.setClientFd(client_fd);
             HandleCgiOutput(cgi_fd, manager);
         } catch (const std::exception& e) {
-            Logger::log(Logger::ERROR, "Error checking CGI: " + STR(e.what()));
+            LOG(Logger::ERROR, "Error checking CGI: " + STR(e.what()));
             completed_cgis.push_back(cgi_fd);
         }
     }
@@ -512,16 +1050,79 @@ void PollServer::processDisconnectOrTimeoutCgis(RequestsManager &manager) {
     }
 }
 
+// enforce per-phase client deadlines (slowloris, slow body, slow reader)
+void PollServer::processClientTimeouts(RequestsManager &manager) {
+	time_t now = time(NULL);
+	if (now == _last_timeout_check)
+		return;
+	_last_timeout_check = now;
+
+	std::vector<int> clients;
+	for (std::map<int, FdType>::iterator it = _fd_types.begin(); it != _fd_types.end(); ++it) {
+		if (it->second == CLIENT_FD)
+			clients.push_back(it->first);
+	}
+
+	for (size_t i = 0; i < clients.size(); ++i) {
+		manager.setClientFd(clients[i]);
+		int status = manager.CheckTimeout(now);
+		if (status == 0) {
+			CloseClient(clients[i]);
+		} else if (status == 2) {
+			ModifyFd(clients[i], EPOLLOUT);
+		}
+	}
+}
+
+// serve requests whose limit_req delay is over
+void PollServer::processDelayedClients(RequestsManager &manager) {
+	std::vector<int> ready;
+	manager.getReadyDelayedClients(Utils::nowMs(), ready);
+
+	for (size_t i = 0; i < ready.size(); ++i) {
+		if (_fd_types.find(ready[i]) == _fd_types.end())
+			continue;
+		manager.setClientFd(ready[i]);
+		int status = manager.ResumeDelayed();
+		if (status == 0) {
+			CloseClient(ready[i]);
+		} else if (status == 2) {
+			ModifyFd(ready[i], EPOLLOUT);
+		} else if (status == 4) {
+			int cgi_fd = manager.getCurrentCgiFd();
+			if (cgi_fd > 0)
+				AddCgiFd(cgi_fd, ready[i]);
+		} else if (status == 6) {
+			syncUpstream(ready[i], manager);
+		}
+	}
+	RateLimiter::cleanup(Utils::nowMs());
+}
+
+// wake up in time for the next delayed request, otherwise once per second for the timers
+int PollServer::nextWaitTimeout(RequestsManager &manager) {
+	if (DirListing::scanning())
+		return 0;
+	long long deadline = manager.nextDelayDeadline();
+	if (deadline == -1)
+		return 1000;
+
+	long long wait = deadline - Utils::nowMs();
+	if (wait < 0)
+		return 0;
+	return wait < 1000 ? static_cast<int>(wait) : 1000;
+}
+
 void PollServer::checkingEventError(const epoll_event& current_event, RequestsManager &manager, FdType fd_type, int fd) {
 	if (current_event.events & (EPOLLERR | EPOLLHUP)) {
 		if (fd_type == SERVER_FD) {
-			Logger::log(Logger::ERROR, "Error on server socket: " + Utils::intToString(fd));
+			LOG(Logger::ERROR, "Error on server socket: " + Utils::intToString(fd));
 			// Could try to restart the server socket here
 		} else if (fd_type == CLIENT_FD) {
-			Logger::log(Logger::INFO, "Client connection error or hangup: " + Utils::intToString(fd));
+			LOG(Logger::DEBUG, "Client connection error or hangup: " + Utils::intToString(fd));
 			CloseClient(fd);
 		} else if (fd_type == CGI_FD) {
-			Logger::log(Logger::INFO, "CGI error or hangup: " + Utils::intToString(fd));
+			LOG(Logger::DEBUG, "CGI error or hangup: " + Utils::intToString(fd));
 
 			// Find the associated client
 			MAP<int, int>::iterator it = _cgi_to_client.find(fd);
@@ -533,7 +1134,7 @@ void PollServer::checkingEventError(const epoll_event& current_event, RequestsMa
 					manager.setClientFd(client_fd);
 					HandleCgiOutput(fd, manager);
 				} catch (const std::exception& e) {
-					Logger::log(Logger::ERROR, "Error handling CGI hangup: " + STR(e.what()));
+					LOG(Logger::ERROR, "Error handling CGI hangup: " + STR(e.what()));
 
 					// Clean up CGI resources
 					RemoveFd(fd);
@@ -546,13 +1147,14 @@ void PollServer::checkingEventError(const epoll_event& current_event, RequestsMa
 					       "Content-Length: 9\r\n"
 					       "\r\n"
 					       "CGI Error";
+					Metrics::cgiFailed();
 
 					// Switch to write mode
 					ModifyFd(client_fd, EPOLLOUT);
 				}
 			} else {
 				// Orphaned CGI fd
-				Logger::log(Logger::WARNING, "Orphaned CGI fd: " + Utils::intToString(fd));
+				LOG(Logger::WARNING, "Orphaned CGI fd: " + Utils::intToString(fd));
 				RemoveFd(fd);
 				close(fd);
 			}
@@ -571,12 +1173,18 @@ void PollServer::handleClientEventActivity(const epoll_event& current_event, Req
 		case 3: // Switch to read mode
 			ModifyFd(fd, EPOLLIN);
 			break;
+		case 5: // Request delayed by limit_req, stop polling until it is due
+			ModifyFd(fd, 0);
+			break;
+		case 6: // Register upstream fd, the client waits for the proxied response
+			syncUpstream(fd, manager);
+			break;
 		case 4: { // Register CGI fd
 			int cgi_fd = manager.getCurrentCgiFd();
 			if (cgi_fd > 0) {
 				AddCgiFd(cgi_fd, fd);
 			} else {
-				Logger::log(Logger::ERROR, "Invalid CGI fd returned from manager");
+				LOG(Logger::ERROR, "Invalid CGI fd returned from manager");
 				ModifyFd(fd, EPOLLOUT);
 			}
 			break;
@@ -589,19 +1197,26 @@ void PollServer::handleEventBasedOnFdType(const epoll_event& current_event, Requ
 	try {
 		if (fd_type == SERVER_FD && (current_event.events & EPOLLIN)) {
 			// Server socket has incoming connection
-			AcceptClient(fd);
+			AcceptClient(fd, manager);
 		} else if (fd_type == CLIENT_FD) {
 			// Client activity
 			manager.setClientFd(fd);
 			int status = manager.HandleClient(current_event.events);
 			// handle client event activity
 			handleClientEventActivity(current_event, manager, fd, status);
+			// client drained some of a proxied response, maybe resume the upstream
+			if (status != 0 && status != 6 && manager.getProxyHandler())
+				syncUpstream(fd, manager);
 		} else if (fd_type == CGI_FD && (current_event.events & EPOLLIN)) {
 			// CGI output ready
 			HandleCgiOutput(fd, manager);
+		} else if (fd_type == UPSTREAM_FD) {
+			HandleUpstreamEvent(fd, current_event.events, manager);
+		} else if (fd_type == UPGRADE_FD) {
+			finishUpgrade();
 		}
 	} catch (const std::exception& e) {
-		Logger::log(Logger::ERROR, "Exception in event handling: " + STR(e.what()));
+		LOG(Logger::ERROR, "Exception in event handling: " + STR(e.what()));
 		// Clean up based on fd type
 		if (fd_type == CLIENT_FD) {
 			CloseClient(fd);
@@ -614,6 +1229,14 @@ void PollServer::handleEventBasedOnFdType(const epoll_event& current_event, Requ
 			// Clean up CGI fd
 			RemoveFd(fd);
 			close(fd);
+		} else if (fd_type == UPSTREAM_FD) {
+			// the handler owns the socket, closing the client releases it
+			MAP<int, int>::iterator it = _upstream_to_client.find(fd);
+			if (it != _upstream_to_client.end()) {
+				CloseClient(it->second);
+			} else {
+				RemoveFd(fd);
+			}
 		}
 	}
 }
@@ -623,17 +1246,17 @@ void PollServer::handleSingleEpollEvent(const epoll_event& current_event, Reques
 
 	// Skip invalid file descriptors
 	if (fd < 0) {
-		Logger::log(Logger::WARNING, "Received event for invalid fd");
+		LOG(Logger::WARNING, "Received event for invalid fd");
 		return;
 	}
 
 	// Get the fd type - CRITICAL CHANGE: if not found, try to remove it from epoll
 	if (_fd_types.find(fd) == _fd_types.end()) {
-		Logger::log(Logger::WARNING, "Unknown fd type for fd: " + Utils::intToString(fd));
+		LOG(Logger::WARNING, "Unknown fd type for fd: " + Utils::intToString(fd));
 
 		// Try to remove the fd from epoll to prevent future unknown fd errors
 		if (fcntl(fd, F_GETFD) != -1) { // Check if fd is still valid
-			Logger::log(Logger::DEBUG, "Removing untracked fd " + Utils::intToString(fd) + " from epoll");
+			LOG(Logger::DEBUG, "Removing untracked fd " + Utils::intToString(fd) + " from epoll");
 			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 
 			// If it's a valid fd, close it to prevent leaks
@@ -653,16 +1276,23 @@ void PollServer::handleSingleEpollEvent(const epoll_event& current_event, Reques
 
 bool PollServer::WaitAndService(RequestsManager &manager) {
     // int num_events = epoll_wait(_epoll_fd, &_events[0], MAX_EVENTS, -1); // Use a timeout
-    int num_events = epoll_wait(_epoll_fd, &_events[0], MAX_EVENTS, 1000);  // testing timeout
+    int num_events = epoll_wait(_epoll_fd, &_events[0], MAX_EVENTS, nextWaitTimeout(manager));
+	Clock::tick();
 	processDisconnectOrTimeoutCgis(manager);
+	processDelayedClients(manager);
+	processClientTimeouts(manager);
+	processUpstreamTimeouts(manager);
+	ResumeAccepting();
+	AccessLog::tick(Utils::nowMs());
+	DirListing::tick();
 
     if (num_events < 0) {
         if (errno == EINTR) {
             // Just a signal interruption, not a real error
-            // Logger::log(Logger::DEBUG, "Epoll wait was interrupted by a signal");
+            // LOG(Logger::DEBUG, "Epoll wait was interrupted by a signal");
             return true;
         } else {
-            Logger::log(Logger::ERROR, "Epoll wait failed: " + STR(strerror(errno)));
+            LOG(Logger::ERROR, "Epoll wait failed: " + STR(strerror(errno)));
             return false;
         }
     }
@@ -679,7 +1309,7 @@ void PollServer::CloseClient(int client_fd) {
         return;
     }
 
-    Logger::log(Logger::INFO, "Closing client connection: " + Utils::intToString(client_fd));
+    LOG(Logger::DEBUG, "Closing client connection: " + Utils::intToString(client_fd));
 
     // First find any CGI fds associated with this client
     std::vector<int> cgi_fds;
@@ -689,6 +1319,18 @@ void PollServer::CloseClient(int client_fd) {
         }
     }
 
+    // Upstream sockets belong to the proxy handler, CleanupClient below closes them
+    std::vector<int> upstream_fds;
+    for (MAP<int, int>::iterator it = _upstream_to_client.begin(); it != _upstream_to_client.end(); ++it) {
+        if (it->second == client_fd) {
+            upstream_fds.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < upstream_fds.size(); i++) {
+        _upstream_to_client.erase(upstream_fds[i]);
+        RemoveFd(upstream_fds[i]);
+    }
+
     // Remove client from epoll
     if (_fd_types.find(client_fd) != _fd_types.end()) {
         RemoveFd(client_fd);
@@ -703,11 +1345,19 @@ void PollServer::CloseClient(int client_fd) {
     _partial_requests.erase(client_fd);
     _partial_responses.erase(client_fd);
 
+    // Release the connection slot
+    std::map<int, ClientKey>::iterator ip_it = _client_ips.find(client_fd);
+    if (ip_it != _client_ips.end()) {
+        if (--_connections_per_ip[ip_it->second] <= 0)
+            _connections_per_ip.erase(ip_it->second);
+        _client_ips.erase(ip_it);
+    }
+
     // Handle each orphaned CGI fd
     for (size_t i = 0; i < cgi_fds.size(); i++) {
         int cgi_fd = cgi_fds[i];
 
-        Logger::log(Logger::INFO, "Cleaning up orphaned CGI fd: " + Utils::intToString(cgi_fd));
+        LOG(Logger::DEBUG, "Cleaning up orphaned CGI fd: " + Utils::intToString(cgi_fd));
 
         // Remove from tracking map first
         _cgi_to_client.erase(cgi_fd);
@@ -722,32 +1372,60 @@ void PollServer::CloseClient(int client_fd) {
             close(cgi_fd);
         }
     }
+
+    // Drop the request state (pending responses, CGI handler, delayed request)
+    if (_manager) {
+        _manager->CleanupClient(client_fd);
+    }
 }
 
 void PollServer::start(){
 	RequestsManager					manager;
 
 	if (!config) {
-		Logger::log(Logger::ERROR, "Can't start server: config is not set");
+		LOG(Logger::ERROR, "Can't start server: config is not set");
 	}
 	manager.setConfig(config);
+	Logger::configure(config->_global_error_log, config->_error_log_level);
+	ProxyCache::init(config);
+	AccessLog::init(config);
+	MimeTypes::init(config);
+	_manager = &manager;
 	running = true;
+	signalReady();
 
 	do {
 		if (!WaitAndService(manager))
 			throw std::runtime_error("Poll error");
-		if (g_signal_received != 0) {
-			Logger::log(Logger::INFO, "Signal received: " + Utils::intToString(g_signal_received));
+		if (g_signal_received == SIGHUP) {
+			g_signal_received = 0;
+			reloadConfig(manager);
+		} else if (g_signal_received == SIGUSR1) {
+			g_signal_received = 0;
+			Logger::reopen();
+			AccessLog::reopen();
+		} else if (g_signal_received == SIGUSR2) {
+			g_signal_received = 0;
+			startUpgrade();
+		} else if (g_signal_received == SIGQUIT || g_signal_received == SIGTERM) {
+			g_signal_received = 0;
+			beginDrain(manager);
+		} else if (g_signal_received != 0) {
+			LOG(Logger::INFO, "Signal received: " + Utils::intToString(g_signal_received));
 			running = false;
 			break;
 		}
+		if (_draining && isDrained()) {
+			running = false;
+		}
 	} while (running);
 
-	Logger::log(Logger::INFO, "Stopped server loop. Clearing resources...");
+	LOG(Logger::INFO, "Stopped server loop. Clearing resources...");
+	AccessLog::flush();
 
-    for (std::map<int, int>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
-        RemoveFd(it->second);
-        close(it->second);
+    for (std::map<int, Listener*>::iterator it = _server_sockets.begin(); it != _server_sockets.end(); ++it) {
+        RemoveFd(it->first);
+        close(it->first);
     }
     _server_sockets.clear();
 
@@ -762,13 +1440,18 @@ void PollServer::start(){
     }
     _fd_types.clear();
     _cgi_to_client.clear();
+    _upstream_to_client.clear();
+    UpstreamPool::closeAll();
+    BufferPool::purge();
+    DirListing::clear();
+    _manager = NULL;
 
-    Logger::log(Logger::INFO, "End to terminate server.");
+    LOG(Logger::INFO, "End to terminate server.");
 }
 
 void PollServer::stop() {
 	if (!config) {
-		Logger::log(Logger::ERROR, "Can't stop server: config is not set");
+		LOG(Logger::ERROR, "Can't stop server: config is not set");
 	}
 	running = false;
 }
@@ -0,0 +1,311 @@
+#include "ProxyCache.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+STR								ProxyCache::_path = "";
+VECTOR<int>						ProxyCache::_levels;
+long long						ProxyCache::_max_size = 0;
+int								ProxyCache::_inactive = 600;
+int								ProxyCache::_lock_timeout = 5;
+long long						ProxyCache::_size = 0;
+std::map<STR, ProxyCache::Entry>	ProxyCache::_entries;
+std::list<STR>					ProxyCache::_lru;
+std::map<STR, time_t>			ProxyCache::_locks;
+
+// also on reload: the index is rebuilt from the files of the new proxy_cache_path
+void ProxyCache::init(HttpConfig *config) {
+	_entries.clear();
+	_lru.clear();
+	_size = 0;
+	_path = config->_proxy_cache_path;
+	_levels = config->_proxy_cache_levels;
+	_max_size = config->_proxy_cache_max_size;
+	_inactive = config->_proxy_cache_inactive;
+	_lock_timeout = config->_proxy_cache_lock_timeout;
+	if (_path == "")
+		return;
+
+	if (mkdir(_path.c_str(), 0755) < 0 && errno != EEXIST) {
+		LOG(Logger::ERROR, "ProxyCache: cannot create " + _path + ": " + STR(strerror(errno)) + ", caching disabled");
+		_path = "";
+		return;
+	}
+	loadDir(_path, 0);
+	LOG(Logger::INFO, "ProxyCache: " + Utils::intToString(_entries.size()) + " entries in " + _path);
+}
+
+bool ProxyCache::enabled() {
+	return _path != "";
+}
+
+// entries left by a previous run; only names of our own layout are touched
+void ProxyCache::loadDir(const STR &dir, size_t depth) {
+	DIR *handle = opendir(dir.c_str());
+	if (!handle)
+		return;
+
+	time_t now = time(NULL);
+	struct dirent *entry;
+	while ((entry = readdir(handle)) != NULL) {
+		STR name = entry->d_name;
+		STR full = dir + "/" + name;
+		if (name == "." || name == ".." || name.find_first_not_of("0123456789abcdef.tmp") != STR::npos)
+			continue;
+
+		if (depth < _levels.size()) {
+			if (name.size() == (size_t)_levels[depth])
+				loadDir(full, depth + 1);
+			continue;
+		}
+		if (name.size() == 20 && name.compare(16, 4, ".tmp") == 0) {
+			unlink(full.c_str());	// interrupted store
+			continue;
+		}
+		if (name.size() != 16)
+			continue;
+
+		std::ifstream file(full.c_str(), std::ios::binary);
+		STR key_line, expires_line, header_line, blank;
+		if (!std::getline(file, key_line) || !std::getline(file, expires_line) ||
+			key_line.compare(0, 4, "KEY ") != 0 || expires_line.compare(0, 8, "EXPIRES ") != 0)
+			continue;
+
+		// entries without a HEADER line predate it and cannot be sent from the file
+		time_t expires = atol(expires_line.c_str() + 8);
+		bool valid = std::getline(file, header_line) && header_line.compare(0, 7, "HEADER ") == 0 &&
+			std::getline(file, blank) && blank.empty();
+		off_t header_offset = valid ? (off_t)file.tellg() : 0;
+		off_t body_offset = header_offset + atol(header_line.c_str() + 7);
+		struct stat st;
+		if (!valid || expires <= now || stat(full.c_str(), &st) < 0 || st.st_size < body_offset) {
+			unlink(full.c_str());
+			continue;
+		}
+		add(key_line.substr(4), full, st.st_size, header_offset, body_offset, expires);
+	}
+	closedir(handle);
+}
+
+/*
+	Only the stored header is read; the body is left in the file, fd open on it
+	from offset for length bytes. The caller owns fd.
+*/
+bool ProxyCache::lookup(const STR &key, STR &headers, int &fd, off_t &offset, size_t &length) {
+	std::map<STR, Entry>::iterator it = _entries.find(key);
+	if (it == _entries.end())
+		return false;
+
+	time_t now = time(NULL);
+	if (it->second.expires <= now) {
+		remove(it);
+		return false;
+	}
+
+	Entry &entry = it->second;
+	fd = open(entry.file.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	STR head(entry.body_offset, '\0');
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < entry.body_offset ||
+		pread(fd, &head[0], head.size(), 0) != (ssize_t)head.size() ||
+		head.compare(0, key.size() + 5, "KEY " + key + "\n") != 0) {
+		if (fd >= 0)
+			close(fd);
+		remove(it);
+		return false;
+	}
+
+	headers.assign(head, entry.header_offset, STR::npos);
+	offset = entry.body_offset;
+	length = st.st_size - entry.body_offset;
+	entry.last_used = now;
+	_lru.splice(_lru.begin(), _lru, entry.lru);
+	return true;
+}
+
+/*
+	Concurrent misses on one key: the first request fetches, the others wait
+	for the entry it stores. A fetch still running after proxy_cache_lock_timeout
+	no longer holds the others back.
+*/
+CacheLock ProxyCache::lock(const STR &key) {
+	time_t now = time(NULL);
+	std::map<STR, time_t>::iterator it = _locks.find(key);
+
+	if (it == _locks.end()) {
+		_locks[key] = now;
+		return CACHE_LOCK_ACQUIRED;
+	}
+	if (now - it->second < _lock_timeout)
+		return CACHE_LOCK_WAIT;
+	return CACHE_LOCK_BYPASS;
+}
+
+void ProxyCache::unlock(const STR &key) {
+	_locks.erase(key);
+}
+
+// written to a temporary file first, readers never see a partial entry
+void ProxyCache::store(const STR &key, const STR &response, int valid) {
+	if (_path == "")
+		return;
+	int ttl = freshness(response, valid);
+	if (ttl <= 0 || (_max_size > 0 && (long long)response.size() > _max_size))
+		return;
+
+	STR file = filePath(key, true);
+	STR tmp = file + ".tmp";
+	time_t expires = time(NULL) + ttl;
+	size_t header_size = response.find("\r\n\r\n") + 4;
+
+	std::ostringstream preamble;
+	preamble << "KEY " << key << "\nEXPIRES " << expires << "\nHEADER " << header_size << "\n\n";
+	STR head = preamble.str();
+	std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+	out << head << response;
+	out.close();
+	if (!out || rename(tmp.c_str(), file.c_str()) < 0) {
+		LOG(Logger::ERROR, "ProxyCache: cannot write " + file + ": " + STR(strerror(errno)));
+		unlink(tmp.c_str());
+		return;
+	}
+
+	struct stat st;
+	add(key, file, stat(file.c_str(), &st) == 0 ? st.st_size : (long long)(head.size() + response.size()),
+		head.size(), head.size() + header_size, expires);
+	LOG(Logger::DEBUG, "ProxyCache: stored " + key + " for " + Utils::intToString(ttl) + "s");
+}
+
+/*
+	Seconds the upstream response may be reused. Cache-Control (s-maxage, then
+	max-age) wins over Expires; without either, proxy_cache_valid applies.
+	Private, no-store, no-cache and Set-Cookie are never stored, nor is anything
+	with Vary: the key does not carry the request headers it names.
+*/
+int ProxyCache::freshness(const STR &response, int valid) {
+	size_t head_end = response.find("\r\n\r\n");
+	if (head_end == STR::npos || response.size() < 12)
+		return 0;
+	int code = atoi(response.substr(9, 3).c_str());
+	if (code != 200 && code != 301 && code != 404)
+		return 0;
+
+	long max_age = -1;
+	long s_maxage = -1;
+	long expires = -1;
+	size_t pos = response.find("\r\n") + 2;
+	while (pos < head_end) {
+		size_t next = response.find("\r\n", pos);
+		STR line = response.substr(pos, next - pos);
+		pos = next + 2;
+
+		size_t colon = line.find(':');
+		if (colon == STR::npos)
+			continue;
+		STR name = line.substr(0, colon);
+		STR value = line.substr(colon + 1);
+		value.erase(0, value.find_first_not_of(" \t"));
+		for (size_t i = 0; i < name.size(); ++i)
+			name[i] = tolower(name[i]);
+
+		if (name == "set-cookie" || name == "vary")
+			return 0;
+		if (name == "cache-control") {
+			for (size_t i = 0; i < value.size(); ++i)
+				value[i] = tolower(value[i]);
+			if (value.find("no-store") != STR::npos || value.find("no-cache") != STR::npos ||
+				value.find("private") != STR::npos)
+				return 0;
+			size_t found = value.find("s-maxage=");
+			if (found != STR::npos)
+				s_maxage = atol(value.c_str() + found + 9);
+			found = value.find("max-age=");
+			if (found != STR::npos && (found == 0 || value[found - 1] != '-'))
+				max_age = atol(value.c_str() + found + 8);
+		} else if (name == "expires") {
+			struct tm tm;
+			memset(&tm, 0, sizeof(tm));
+			expires = 0;	// invalid dates mean already expired
+			if (strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL && timegm(&tm) > time(NULL))
+				expires = timegm(&tm) - time(NULL);
+		}
+	}
+
+	if (s_maxage >= 0)
+		return s_maxage;
+	if (max_age >= 0)
+		return max_age;
+	if (expires >= 0)
+		return expires;
+	return valid;
+}
+
+// levels=1:2 -> path/c/29/b6f5...1c29, directory names taken from the end of the hash like nginx
+STR ProxyCache::filePath(const STR &key, bool create_dirs) {
+	static const char digits[] = "0123456789abcdef";
+	uint64_t h = Utils::hash(key);
+	STR name(16, '0');
+	for (int i = 15; i >= 0; i--) {
+		name[i] = digits[h & 0xf];
+		h >>= 4;
+	}
+
+	STR path = _path;
+	size_t end = name.size();
+	for (size_t i = 0; i < _levels.size(); i++) {
+		end -= _levels[i];
+		path += "/" + name.substr(end, _levels[i]);
+		if (create_dirs)
+			mkdir(path.c_str(), 0755);
+	}
+	return path + "/" + name;
+}
+
+void ProxyCache::add(const STR &key, const STR &file, long long size, off_t header_offset,
+	off_t body_offset, time_t expires) {
+	std::map<STR, Entry>::iterator it = _entries.find(key);
+	if (it != _entries.end()) {
+		// replaced on disk already, only the index entry goes
+		_size -= it->second.size;
+		_lru.erase(it->second.lru);
+		_entries.erase(it);
+	}
+
+	_lru.push_front(key);
+	Entry &entry = _entries[key];
+	entry.file = file;
+	entry.size = size;
+	entry.header_offset = header_offset;
+	entry.body_offset = body_offset;
+	entry.expires = expires;
+	entry.last_used = time(NULL);
+	entry.lru = _lru.begin();
+	_size += size;
+
+	while (_max_size > 0 && _size > _max_size && !_lru.empty())
+		remove(_entries.find(_lru.back()));
+}
+
+void ProxyCache::remove(std::map<STR, Entry>::iterator it) {
+	unlink(it->second.file.c_str());
+	_size -= it->second.size;
+	_lru.erase(it->second.lru);
+	_entries.erase(it);
+}
+
+// drops entries nobody asked for during proxy_cache_path inactive=
+void ProxyCache::cleanup(time_t now) {
+	while (!_lru.empty()) {
+		std::map<STR, Entry>::iterator it = _entries.find(_lru.back());
+		if (now - it->second.last_used < _inactive)
+			break;
+		LOG(Logger::DEBUG, "ProxyCache: dropping inactive " + it->first);
+		remove(it);
+	}
+}
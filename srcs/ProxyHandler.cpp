@@ -0,0 +1,365 @@
+#include "ProxyHandler.hpp"
+#include "Logger.hpp"
+#include <sys/epoll.h>
+#include <cerrno>
+
+ProxyHandler::ProxyHandler(const STR &host, int port, const struct sockaddr_in &addr, const STR &request,
+	bool head_only, int connect_timeout, int read_timeout) :
+	_host(host), _port(port), _addr(addr), _key(host + ":" + Utils::intToString(port)), _request(request), _sent(0),
+	_fd(-1), _reused(false), _status(PROXY_CONNECTING), _last_activity(time(NULL)),
+	_connect_timeout(connect_timeout), _read_timeout(read_timeout), _head_only(head_only),
+	_head_done(false), _forwarded(false), _content_left(-1), _chunked(false), _until_close(false),
+	_keep_alive(false), _capture(false), _capture_limit(0), _chunk_state(CHUNK_LINE), _chunk_left(0)
+{
+}
+
+ProxyHandler::~ProxyHandler() {
+	if (_fd >= 0)
+		close(_fd);
+}
+
+bool ProxyHandler::start() {
+	_last_activity = time(NULL);
+	return connectUpstream();
+}
+
+// pooled connection if there is one, otherwise a non-blocking connect
+bool ProxyHandler::connectUpstream() {
+	_fd = UpstreamPool::acquire(_key);
+	if (_fd >= 0) {
+		_reused = true;
+		_status = PROXY_SENDING;
+		return true;
+	}
+	_reused = false;
+
+	// resolved with the configuration
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		LOG(Logger::ERROR, "ProxyHandler: socket failed: " + STR(strerror(errno)));
+		return false;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);	// keep upstream sockets out of CGI children
+
+	int connected = connect(fd, (struct sockaddr *)&_addr, sizeof(_addr));
+	if (connected < 0 && errno != EINPROGRESS) {
+		LOG(Logger::ERROR, "ProxyHandler: connect to " + _key + " failed: " + STR(strerror(errno)));
+		close(fd);
+		return false;
+	}
+
+	_fd = fd;
+	_status = connected == 0 ? PROXY_SENDING : PROXY_CONNECTING;
+	LOG(Logger::DEBUG, "ProxyHandler: connecting to " + _key + " on fd " + Utils::intToString(fd));
+	return true;
+}
+
+/*
+	A pooled connection died before the upstream answered anything (closed while
+	idle, the peek in UpstreamPool can't catch every race): send it again on a new
+	connection. The new socket is opened before the old one is closed so the fd
+	number changes, PollServer relies on that to re-register it.
+*/
+bool ProxyHandler::retryFresh() {
+	LOG(Logger::INFO, "ProxyHandler: pooled connection to " + _key + " was closed, retrying");
+	int stale_fd = _fd;
+	_sent = 0;
+	bool connected = connectUpstream();
+	close(stale_fd);
+	if (!connected)
+		_fd = -1;
+	return connected;
+}
+
+void ProxyHandler::fail(ProxyStatus status, const STR &reason) {
+	LOG(Logger::ERROR, "ProxyHandler: " + reason);
+	_status = status;
+	_keep_alive = false;
+}
+
+void ProxyHandler::handleEvent(uint32_t events) {
+	if (isFinished() || _fd < 0)
+		return;
+
+	if (_status == PROXY_CONNECTING) {
+		if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+			error = errno;
+		if (error != 0) {
+			fail(PROXY_FAILED, "connect to " + _key + " failed: " + STR(strerror(error)));
+			return;
+		}
+		_status = PROXY_SENDING;
+		_last_activity = time(NULL);
+	}
+
+	if (_status == PROXY_SENDING) {
+		sendRequest();
+	} else if (_status == PROXY_READING) {
+		readResponse();
+	}
+}
+
+void ProxyHandler::sendRequest() {
+	ssize_t sent = send(_fd, _request.data() + _sent, _request.size() - _sent, MSG_NOSIGNAL);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		if (_reused && retryFresh())
+			return;
+		fail(PROXY_FAILED, "sending to " + _key + " failed: " + STR(strerror(errno)));
+		return;
+	}
+
+	_sent += sent;
+	_last_activity = time(NULL);
+	if (_sent == _request.size())
+		_status = PROXY_READING;
+}
+
+void ProxyHandler::readResponse() {
+	char buffer[16384];
+	ssize_t nbytes = recv(_fd, buffer, sizeof(buffer), 0);
+
+	if (nbytes < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		if (_reused && !_head_done && _head.empty() && retryFresh())
+			return;
+		fail(PROXY_FAILED, "reading from " + _key + " failed: " + STR(strerror(errno)));
+		return;
+	}
+	if (nbytes == 0) {
+		if (_reused && !_head_done && _head.empty() && retryFresh())
+			return;
+		if (_head_done && _until_close) {
+			_status = PROXY_DONE;
+			return;
+		}
+		fail(PROXY_FAILED, "upstream " + _key + " closed the connection prematurely");
+		return;
+	}
+	_last_activity = time(NULL);
+
+	if (_head_done) {
+		consumeBody(buffer, nbytes);
+		return;
+	}
+
+	_head.append(buffer, nbytes);
+	while (!_head_done) {
+		size_t head_end = _head.find("\r\n\r\n");
+		if (head_end == STR::npos) {
+			if (_head.size() > PROXY_MAX_HEAD)
+				fail(PROXY_FAILED, "response head from " + _key + " is too large");
+			return;
+		}
+		STR rest = _head.substr(head_end + 4);
+		_head.erase(head_end + 4);
+
+		if (!parseHead()) {
+			fail(PROXY_FAILED, "invalid response head from " + _key);
+			return;
+		}
+		if (!_head_done) {
+			_head = rest;	// interim 1xx response, the real one follows
+			continue;
+		}
+		if (rest.empty())
+			break;
+		if (_status == PROXY_DONE)
+			_keep_alive = false;	// bytes after a bodyless response
+		else
+			consumeBody(rest.data(), rest.size());
+	}
+}
+
+/*
+	Status line and headers of the upstream response. Hop-by-hop headers are
+	dropped; the body framing (Content-Length, chunked or until close) is kept
+	as is since the body is passed through untouched.
+*/
+bool ProxyHandler::parseHead() {
+	size_t line_end = _head.find("\r\n");
+	STR status_line = _head.substr(0, line_end);
+	if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12)
+		return false;
+
+	int code = atoi(status_line.substr(9, 3).c_str());
+	if (code < 100 || code > 599 || code == 101)
+		return false;
+	if (code < 200) {
+		_head.clear();
+		return true;
+	}
+
+	_keep_alive = status_line.compare(0, 8, "HTTP/1.1") == 0;
+
+	STR headers;
+	size_t pos = line_end + 2;
+	while (pos < _head.size()) {
+		size_t next = _head.find("\r\n", pos);
+		if (next == STR::npos || next == pos)
+			break;
+		STR line = _head.substr(pos, next - pos);
+		pos = next + 2;
+
+		size_t colon = line.find(':');
+		if (colon == STR::npos)
+			return false;
+		STR name = line.substr(0, colon);
+		STR value = line.substr(colon + 1);
+		value.erase(0, value.find_first_not_of(" \t"));
+		for (size_t i = 0; i < name.size(); ++i)
+			name[i] = tolower(name[i]);
+		for (size_t i = 0; i < value.size(); ++i)
+			value[i] = tolower(value[i]);
+
+		if (name == "connection") {
+			if (value.find("close") != STR::npos)
+				_keep_alive = false;
+			continue;
+		}
+		if (name == "keep-alive" || name == "proxy-connection" || name == "proxy-authenticate" ||
+			name == "te" || name == "upgrade")
+			continue;
+		if (name == "content-length")
+			_content_left = atoll(value.c_str());
+		else if (name == "transfer-encoding" && value.find("chunked") != STR::npos)
+			_chunked = true;
+		headers += line + "\r\n";
+	}
+
+	bool has_body = !_head_only && code != 204 && code != 304;
+	if (has_body && !_chunked && _content_left < 0) {
+		_until_close = true;
+		_keep_alive = false;
+	}
+
+	_output += "HTTP/1.1 " + status_line.substr(9) + "\r\n" + headers;
+	if (_until_close)
+		_output += "Connection: close\r\n";
+	_output += "\r\n";
+	_head.clear();
+	_head_done = true;
+
+	if (!has_body || (!_chunked && _content_left == 0))
+		_status = PROXY_DONE;
+	return true;
+}
+
+void ProxyHandler::consumeBody(const char *data, size_t len) {
+	size_t taken = len;
+	if (_chunked) {
+		taken = advanceChunked(data, len);
+	} else if (_content_left >= 0) {
+		if ((long long)taken > _content_left)
+			taken = _content_left;
+		_content_left -= taken;
+	}
+	_output.append(data, taken);
+
+	if (taken < len) {
+		LOG(Logger::WARNING, "ProxyHandler: " + _key + " sent data past the end of the response");
+		_keep_alive = false;
+	}
+	if ((_chunked && _chunk_state == CHUNK_END) || (!_chunked && _content_left == 0))
+		_status = PROXY_DONE;
+}
+
+// follows the chunked framing to find where the response ends, returns the bytes that belong to it
+size_t ProxyHandler::advanceChunked(const char *data, size_t len) {
+	size_t i = 0;
+
+	while (i < len && _chunk_state != CHUNK_END) {
+		if (_chunk_state == CHUNK_BODY) {
+			size_t n = len - i;
+			if ((long long)n > _chunk_left)
+				n = _chunk_left;
+			i += n;
+			_chunk_left -= n;
+			if (_chunk_left == 0)
+				_chunk_state = CHUNK_BODY_END;
+			continue;
+		}
+
+		char c = data[i++];
+		if (c != '\n') {
+			if (c != '\r' && _chunk_state != CHUNK_BODY_END)
+				_chunk_line += c;
+			continue;
+		}
+
+		if (_chunk_state == CHUNK_BODY_END) {
+			_chunk_state = CHUNK_LINE;
+		} else if (_chunk_state == CHUNK_LINE) {
+			_chunk_left = strtol(_chunk_line.c_str(), NULL, 16);
+			_chunk_state = _chunk_left > 0 ? CHUNK_BODY : CHUNK_TRAILERS;
+		} else if (_chunk_line.empty()) {
+			_chunk_state = CHUNK_END;
+		}
+		_chunk_line.clear();
+	}
+	return i;
+}
+
+uint32_t ProxyHandler::wantedEvents() const {
+	if (_status == PROXY_CONNECTING || _status == PROXY_SENDING)
+		return EPOLLOUT;
+	if (_status == PROXY_READING)
+		return EPOLLIN;
+	return 0;
+}
+
+// paused: the client is not reading, the upstream is not the one being slow
+bool ProxyHandler::checkTimeout(time_t now, bool paused) {
+	if (isFinished())
+		return false;
+	if (paused) {
+		_last_activity = now;
+		return false;
+	}
+
+	int limit = (_status == PROXY_CONNECTING) ? _connect_timeout : _read_timeout;
+	if (now - _last_activity < limit)
+		return false;
+
+	fail(PROXY_TIMEDOUT, "upstream " + _key + " timed out");
+	return true;
+}
+
+STR ProxyHandler::takeOutput() {
+	STR output;
+	output.swap(_output);
+	if (!output.empty())
+		_forwarded = true;
+	if (_capture && _captured.size() + output.size() > _capture_limit) {
+		_capture = false;
+		STR().swap(_captured);
+	} else if (_capture) {
+		_captured += output;
+	}
+	return output;
+}
+
+// everything handed to the client is copied until limit bytes, then capture gives up
+void ProxyHandler::capture(size_t limit) {
+	_capture = true;
+	_capture_limit = limit;
+}
+
+// hand the connection back to the pool if the response was read completely, close it otherwise
+void ProxyHandler::finish() {
+	if (_fd < 0)
+		return;
+	if (_status == PROXY_DONE && _keep_alive)
+		UpstreamPool::release(_key, _fd);
+	else
+		close(_fd);
+	_fd = -1;
+}
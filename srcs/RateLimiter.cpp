@@ -0,0 +1,62 @@
+#include "RateLimiter.hpp"
+#include "Utils.hpp"
+#include "Logger.hpp"
+
+std::map<RateLimiter::BucketKey, RateLimiter::Bucket>	RateLimiter::_buckets;
+long long												RateLimiter::_last_cleanup = 0;
+
+LimitResult RateLimiter::check(const LocationConfig *zone, const ClientKey &client, long long &delay_ms) {
+	long long now = Utils::nowMs();
+	BucketKey key(zone, client);
+	delay_ms = 0;
+
+	std::map<BucketKey, Bucket>::iterator it = _buckets.find(key);
+	if (it == _buckets.end()) {
+		Bucket bucket;
+		bucket.excess = 0;
+		bucket.last_ms = now;
+		_buckets[key] = bucket;
+		return LIMIT_PASS;
+	}
+
+	Bucket &bucket = it->second;
+	double excess = bucket.excess - zone->_limit_req_rate * (now - bucket.last_ms) / 1000.0 + 1;
+	if (excess < 0)
+		excess = 0;
+
+	if (excess > zone->_limit_req_burst) {
+		return LIMIT_REJECT;	// rejected requests don't fill the bucket
+	}
+
+	bucket.excess = excess;
+	bucket.last_ms = now;
+
+	if (excess <= 0 || zone->_limit_req_nodelay) {
+		return LIMIT_PASS;
+	}
+	delay_ms = static_cast<long long>(excess * 1000 / zone->_limit_req_rate);
+	return LIMIT_DELAY;
+}
+
+// drop buckets that have fully drained, so the table only holds active clients
+void RateLimiter::cleanup(long long now_ms) {
+	if (now_ms - _last_cleanup < 60000)
+		return;
+	_last_cleanup = now_ms;
+
+	std::map<BucketKey, Bucket>::iterator it = _buckets.begin();
+	while (it != _buckets.end()) {
+		double drained = it->second.excess - it->first.first->_limit_req_rate * (now_ms - it->second.last_ms) / 1000.0;
+		if (drained <= 0)
+			_buckets.erase(it++);
+		else
+			++it;
+	}
+}
+
+// the location is being freed with its configuration
+void RateLimiter::forget(const LocationConfig *zone) {
+	std::map<BucketKey, Bucket>::iterator it = _buckets.lower_bound(BucketKey(zone, ClientKey()));
+	while (it != _buckets.end() && it->first.first == zone)
+		_buckets.erase(it++);
+}
@@ -14,14 +14,8 @@ static void toLower(STR &str) {
 	}
 }
 
-void remove_trailing_r(STR &str) {
-    if (!str.empty() && str.at(str.length() - 1) == '\r') {
-        str.erase(str.length() - 1);
-    }
-}
-
 void	process_path(STR &full_path, STR &file_name) {
-	Logger::log(Logger::DEBUG, "Request::process_path: full path is " + full_path);
+	LOG(Logger::DEBUG, "Request::process_path: full path is " + full_path);
 
 	if (full_path.find('.') != STR::npos) {
 		file_name = full_path.substr(full_path.find_last_of('/') + 1, full_path.size());
@@ -34,130 +28,160 @@ void	process_path(STR &full_path, STR &file_name) {
 	std::cerr << "File name after: " << file_name << "\n";
 }
 
+/*
+	Reads the request line and the headers in place, up to the empty line:
+	the body is never scanned and no line is copied before it is known to
+	be one of the headers kept.
+*/
 bool Request::parseHeader() {
-	std::istringstream	request_stream(_full_request);
-    STR					temp_line;
-	std::istringstream	temp_line_stream;
-	STR 				temp_token;
-
 	if (_full_request == "")
 		return false;
 
+	const char *data = _full_request.data();
+	size_t head_end = _full_request.find("\r\n\r\n");
+	if (head_end == STR::npos)
+		head_end = _full_request.size();
+
 	//parse first line		GET / HTTP/1.1
-	std::getline(request_stream, temp_line);
-	remove_trailing_r(temp_line);
-	temp_line_stream.str(temp_line);
-	getline(temp_line_stream, temp_token, ' ');
-	_method = temp_token;
-	getline(temp_line_stream, temp_token, ' ');
-	_file_path = temp_token;
+	size_t line_end = _full_request.find('\n');
+	if (line_end == STR::npos || line_end > head_end)
+		line_end = head_end;
+	size_t length = line_end;
+	if (length > 0 && data[length - 1] == '\r')
+		length--;
+	STR request_line(data, length);
+	size_t method_end = request_line.find(' ');
+	size_t path_end = method_end == STR::npos ? STR::npos : request_line.find(' ', method_end + 1);
+	_method = request_line.substr(0, method_end);
+	_file_path = method_end == STR::npos ? "" : request_line.substr(method_end + 1, path_end - method_end - 1);
 	parseQueryString(); // to parse query string, if it exists
-	getline(temp_line_stream, temp_token, ' ');
-	_http_version = temp_token;
+	_http_version = path_end == STR::npos ? "" : request_line.substr(path_end + 1, request_line.find(' ', path_end + 1) - path_end - 1);
+
+	//parse the rest of the header searching for data nedded
+	size_t pos = line_end + 1;
+	while (pos < head_end) {
+		line_end = _full_request.find('\n', pos);
+		if (line_end == STR::npos || line_end > head_end)
+			line_end = head_end;
+		length = line_end - pos;
+		if (length > 0 && data[pos + length - 1] == '\r')
+			length--;
+		parseHeaderLine(data + pos, length);
+		pos = line_end + 1;
+	}
+
+	return true;
+}
+
+static bool isHeader(const char *line, size_t name_length, const char *name) {
+	return strlen(name) == name_length && strncasecmp(line, name, name_length) == 0;
+}
 
-	//parse the rest of request searching for data nedded
-	while (std::getline(request_stream, temp_line)) {
-		if (temp_line.find("\r\n\r\n") != STR::npos) {
-			return true;
+void Request::parseHeaderLine(const char *line, size_t length) {
+	const char *colon = static_cast<const char*>(memchr(line, ':', length));
+	if (!colon)
+		return;
+	size_t name_length = colon - line;
+	size_t value_start = name_length + 1;
+	while (value_start < length && (line[value_start] == ' ' || line[value_start] == '\t'))
+		value_start++;
+	size_t value_end = length;
+	while (value_end > value_start && (line[value_end - 1] == ' ' || line[value_end - 1] == '\t'))
+		value_end--;
+	const char *value = line + value_start;
+	size_t value_length = value_end - value_start;
+
+	//searching for 	Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8
+	if (isHeader(line, name_length, "Accept") && _accepted_count == 0) {
+		parseAccept(value, value_length);
+	} else if (isHeader(line, name_length, "Cookie") && _cookies == "") {
+		_cookies.assign(value, value_length);
+	} else if (isHeader(line, name_length, "Host") && !_has_host) {
+		//extracting host and port from 		Host: localhost:8080
+		_has_host = true;
+		const char *port = static_cast<const char*>(memchr(value, ':', value_length));
+		if (!port) {
+			_host.assign(value, value_length);
+		} else {
+			_host.assign(value, port - value);
+			_port = atoi(STR(port + 1, value + value_length - port - 1).c_str());
 		}
-		remove_trailing_r(temp_line);
-		temp_line_stream.clear();
-		temp_token.clear();
-		temp_line_stream.str(temp_line);
-		getline(temp_line_stream, temp_token, ' ');
-
-		//searching for 	Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8
-		if (temp_token == "Accept:" && _accepted_types.empty()) {
-			STR			filetypes_line;
-			std::istringstream	filetypes_stream;
-			STR 		filetype_token;
-
-			//getting the second part of line line with filetypes
-			getline(temp_line_stream, filetypes_line, ' ');
-			filetypes_stream.str(filetypes_line);
-
-			//getting types from type line one by one
-			while (getline(filetypes_stream, filetype_token, ',')) {
-				std::istringstream	name_quality_stream;
-				STR 		name_quality_token;
-				STR			type_name;
-				float				type_quality = 1.0;
-
-				//separating by name and value (quality/preference)
-				name_quality_stream.str(filetype_token);
-				getline(name_quality_stream, name_quality_token, ';');
-				type_name = name_quality_token.c_str();
-				type_name += '\0';
-				if (getline(name_quality_stream, name_quality_token, ';'))
-					type_quality = atof(name_quality_token.c_str() + 2);
-				_accepted_types[type_name.c_str()] = type_quality;
-			}
-		} else if (temp_token == "Cookie:" && _cookies == "") {
-			//to do cookies
-			_cookies = temp_line.substr(temp_line.find_first_of(':') + 2);
-		} else if (temp_token == "Host:" && _host == "localhost") {
-			int	host_start;
-			int	host_end;
-			int	delim_position;
-			int	port_end;
-
-			//extracting host and port from 		Host: localhost:8080
-			host_start = temp_line.find_first_of(':') + 2;
-			delim_position = temp_line.find(':', temp_line.find_first_of(':') + 1);
-
-			if (delim_position == (int)STR::npos) { //Not tested
-			//host without port
-				host_end = temp_line.find_last_not_of(' '); //		Future check required: newline included or not to remove +1
-				_host = temp_line.substr(host_start, host_end - host_start);
-			} else {
-			//host with port
-				host_end = delim_position;
-				port_end = temp_line.find_last_not_of(' ');
-				_host = temp_line.substr(host_start, host_end - host_start);
-				_port = atoi(temp_line.substr(delim_position + 1, delim_position + 1 - port_end).c_str());
-			}
-		} else if (temp_token == "Content-Type:" && _content_type == "") {	//Not tested
-			int	delim_position;
-			int	end_position;
-			_http_content_type = temp_line.substr(temp_line.find_first_of(':') + 2);  // to test and this is chaned (added)
-
-			delim_position = temp_line.find_first_of(':');
-			end_position = temp_line.find_last_not_of(' ');
-			_content_type = temp_line.substr(delim_position + 2, end_position - delim_position - 2);
-			Logger::log(Logger::DEBUG, "Request::parseHeader() Content-Type: " + _content_type);
-		} else if (temp_token == "Content-Length:" && _body_size == 0) {
-			int	delim_position;
-			int	end_position;
-
-			delim_position = temp_line.find_first_of(':');
-			end_position = temp_line.length();
-			_body_size = atoi((temp_line.substr(delim_position + 1, delim_position + 1 - end_position)).c_str());
-			_chunked_flag = false;  // if content-length is present, chunked transfer encoding is not used
-		} else if (temp_token == "Transfer-Encoding:") {
-			STR encoding_value = temp_line.substr(temp_line.find_first_of(':') + 2);
-			parseTransferEncoding(encoding_value);
-
-			if (_chunked_flag) {  // if chunked transfer encoding ignore content-length
-				_body_size = 0;
+	} else if (isHeader(line, name_length, "Content-Type") && _content_type == "") {
+		_http_content_type.assign(value, value_length);
+		_content_type = _http_content_type;
+		LOG(Logger::DEBUG, "Request::parseHeader() Content-Type: " + _content_type);
+	} else if (isHeader(line, name_length, "Content-Length") && _body_size == 0) {
+		_body_size = strtoull(STR(value, value_length).c_str(), NULL, 10);
+		_chunked_flag = false;  // if content-length is present, chunked transfer encoding is not used
+	} else if (isHeader(line, name_length, "Transfer-Encoding")) {
+		parseTransferEncoding(STR(value, value_length));
+
+		if (_chunked_flag) {  // if chunked transfer encoding ignore content-length
+			_body_size = 0;
+		}
+	}
+}
+
+// media ranges with their q= preference, 1 without one
+void Request::parseAccept(const char *value, size_t length) {
+	if (!_arena)
+		return;
+	size_t count = 1;
+	for (size_t i = 0; i < length; i++) {
+		if (value[i] == ',')
+			count++;
+	}
+	_accepted_types = static_cast<AcceptedType*>(_arena->allocate(count * sizeof(AcceptedType)));
+	_accepted_count = 0;
+
+	size_t pos = 0;
+	while (pos <= length) {
+		const char *comma = static_cast<const char*>(memchr(value + pos, ',', length - pos));
+		size_t end = comma ? comma - value : length;
+		size_t start = pos;
+		while (start < end && (value[start] == ' ' || value[start] == '\t'))
+			start++;
+		const char *params = static_cast<const char*>(memchr(value + start, ';', end - start));
+		size_t type_end = params ? params - value : end;
+		while (type_end > start && (value[type_end - 1] == ' ' || value[type_end - 1] == '\t'))
+			type_end--;
+
+		if (type_end > start) {
+			float quality = 1.0;
+			for (const char *q = params; q && q < value + end; q = static_cast<const char*>(memchr(q + 1, ';', value + end - q - 1))) {
+				const char *name = q + 1;
+				while (name < value + end && (*name == ' ' || *name == '\t'))
+					name++;
+				if (value + end - name > 2 && (name[0] == 'q' || name[0] == 'Q') && name[1] == '=')
+					quality = atof(STR(name + 2, value + end - name - 2).c_str());
 			}
+			AcceptedType &accepted = _accepted_types[_accepted_count++];
+			accepted.type = _arena->copy(value + start, type_end - start);
+			accepted.quality = quality;
 		}
-		temp_line.clear();
-		temp_token.clear();
+		pos = end + 1;
 	}
+}
 
-	return true;
+// 0 for a type the Accept header does not name
+float Request::acceptQuality(const STR &type) const {
+	for (size_t i = 0; i < _accepted_count; i++) {
+		if (type == _accepted_types[i].type)
+			return _accepted_types[i].quality;
+	}
+	return 0;
 }
 
 bool Request::parseBody() {
 	int	body_beginning = -1;
 	if (_full_request == "") {
-		Logger::log(Logger::ERROR, "Request::parseBody: Empty request");
+		LOG(Logger::ERROR, "Request::parseBody: Empty request");
 		return false;
 	}
 
 	body_beginning = _full_request.find("\r\n\r\n");
 	if (body_beginning == CHAR_NOT_FOUND) {
-		Logger::log(Logger::ERROR, "Request::parseBody: No body beginning found");
+		LOG(Logger::ERROR, "Request::parseBody: No body beginning found");
 		return false;
 	}
 
@@ -170,7 +194,7 @@ bool Request::parseBody() {
 		int size_ending = STR(data).find("\r\n");
 		const char *data_end = data + size_ending + 2; // +2 for \r\n
 		if (!processTransferEncoding(data_end)) {
-			Logger::log(Logger::ERROR, "Transfer-Encoding format is incorrect");
+			LOG(Logger::ERROR, "Transfer-Encoding format is incorrect");
 			return false;
 		}
 		return true;
@@ -201,7 +225,7 @@ void Request::parseQueryString(void) {
 void Request::parseTransferEncoding(const STR &header) {
 	VECTOR<STR> encodings;
 	size_t start = 0, end;
-	Logger::log(Logger::INFO, "Request::parseTransferEncoding: Parsing Transfer-Encoding header: " + header);
+	LOG(Logger::DEBUG, "Request::parseTransferEncoding: Parsing Transfer-Encoding header: " + header);
 	while ((end = header.find(',', start)) != STR::npos) {
 		STR encoding = header.substr(start, end - start);
 		trimSpace(encoding);
@@ -316,25 +340,37 @@ bool Request::processTransferEncoding(const char *data) {
 }
 
 Request::Request() {
+	_arena = NULL;
+	_accepted_types = NULL;
+	_accepted_count = 0;
 	_cookies = "";
 	_full_request = "";
 	_file_path = "";
 	_method = "";
 	_http_version = "";
 	_host = "localhost";
+	_has_host = false;
 	_port = 80;
 	_content_type = "";
 	_body = "";
 	_body_size = 0;
+	_chunked_flag = false;
+	_chunked_state = CHUNK_SIZE;
+	_chunk_size = 0;
+	_chunk_data_read = 0;
 }
 
 Request::Request(STR request) {
 	_full_request = request;
+	_arena = NULL;
+	_accepted_types = NULL;
+	_accepted_count = 0;
 	_cookies = "";
 	_file_path = "";
 	_method = "";
 	_http_version = "";
 	_host = "localhost";
+	_has_host = false;
 	_port = 80;
 	_content_type = "";
 	_http_content_type = "";  // added
@@ -354,10 +390,13 @@ Request::Request(const Request &obj) {
 	_method = obj._method;
 	_http_version = obj._http_version;
 	_host = obj._host;
+	_has_host = obj._has_host;
 	_port = obj._port;
 	_content_type = obj._content_type;
 	_http_content_type = obj._http_content_type;
-	_accepted_types = obj._accepted_types;
+	_arena = obj._arena;
+	_accepted_types = obj._accepted_types;	// both use the memory of the original's arena
+	_accepted_count = obj._accepted_count;
 	_body = obj._body;
 	_body_size = obj._body_size;
 	_chunked_flag = obj._chunked_flag;
@@ -376,14 +415,17 @@ Request::~Request() {
 
 void Request::clear() {
 	_cookies = "";
-	_full_request = "";
+	STR().swap(_full_request);	// the memory goes too, idle connections keep nothing
 	_file_path = "";
 	_method = "";
 	_http_version = "";
 	_host = "localhost";
+	_has_host = false;
 	_port = 80;
 	_content_type = "";
-	_body = "";
+	_accepted_types = NULL;
+	_accepted_count = 0;
+	STR().swap(_body);
 	_body_size = 0;
 
 	_chunked_flag = false;
@@ -391,12 +433,12 @@ void Request::clear() {
     _chunk_data_read = 0;
 }
 
-bool Request::setRequest(STR request) {
+bool Request::setRequest(const STR &request) {
 	_full_request = request;
 	_body = "";
 
 	if (!parseHeader()) {
-		Logger::log(Logger::ERROR, "Request::setRequest: Header Parsing error!");
+		LOG(Logger::ERROR, "Request::setRequest: Header Parsing error!");
 		return false;
 	}
 	return true;
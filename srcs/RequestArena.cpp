@@ -0,0 +1,77 @@
+#include "RequestArena.hpp"
+#include "BufferPool.hpp"
+#include <cstring>
+
+static size_t align(size_t size) {
+	return (size + REQUEST_ARENA_ALIGN - 1) & ~(REQUEST_ARENA_ALIGN - 1);
+}
+
+RequestArena::RequestArena() : _blocks(NULL), _free(NULL), _end(NULL), _used(0) {}
+
+RequestArena::RequestArena(const RequestArena &obj) : _blocks(NULL), _free(NULL), _end(NULL), _used(0) {
+	(void)obj;
+}
+
+RequestArena &RequestArena::operator=(const RequestArena &obj) {
+	if (this != &obj)
+		reset();
+	return *this;
+}
+
+RequestArena::~RequestArena() {
+	reset();
+}
+
+void *RequestArena::allocate(size_t size) {
+	size = align(size ? size : 1);
+	if (!_free || (size_t)(_end - _free) < size)
+		grow(size);
+	void *memory = _free;
+	_free += size;
+	_used += size;
+	return memory;
+}
+
+// NUL-terminated copy, for C strings handed on as they are
+char *RequestArena::copy(const char *data, size_t length) {
+	char *memory = static_cast<char*>(allocate(length + 1));
+	memcpy(memory, data, length);
+	memory[length] = '\0';
+	return memory;
+}
+
+void RequestArena::reset() {
+	while (_blocks) {
+		Block *next = _blocks->next;
+		if (_blocks->size > BufferPool::largest())
+			delete[] reinterpret_cast<char*>(_blocks);
+		else
+			BufferPool::release(reinterpret_cast<char*>(_blocks), _blocks->size);
+		_blocks = next;
+	}
+	_free = NULL;
+	_end = NULL;
+	_used = 0;
+}
+
+size_t RequestArena::used() const {
+	return _used;
+}
+
+// the rest of the current chunk is left unused
+void RequestArena::grow(size_t size) {
+	size_t header = align(sizeof(Block));
+	size_t chunk_size = header + size;
+	char *chunk;
+	if (chunk_size > BufferPool::largest())
+		chunk = new char[chunk_size];	// larger than any pooled chunk
+	else
+		chunk = BufferPool::acquire(chunk_size, chunk_size);
+
+	Block *block = reinterpret_cast<Block*>(chunk);
+	block->next = _blocks;
+	block->size = chunk_size;
+	_blocks = block;
+	_free = chunk + header;
+	_end = chunk + chunk_size;
+}
@@ -1,5 +1,7 @@
 #include "RequestsManager.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "AccessLog.hpp"
 #include "sys/epoll.h"
 
 RequestsManager::RequestsManager() {
@@ -43,36 +45,94 @@ RequestsManager::~RequestsManager() {
     _active_responses.clear();
 }
 
+// configuration of the current generation, for what is not tied to one connection
 void RequestsManager::setConfig(HttpConfig *config) {
     _config = config;
-    _partial_requests.erase(_client_fd);
-    _partial_responses.erase(_client_fd);
-    _client_states.erase(_client_fd);
 }
 
 void RequestsManager::setClientFd(int client_fd) {
     _client_fd = client_fd;
 }
 
+// Fresh state for a newly accepted connection (fd numbers get reused)
+void RequestsManager::RegisterClient(int client_fd, const struct sockaddr *client_addr, const Listener *listener) {
+    _client_fd = client_fd;
+    _partial_requests.erase(client_fd);
+    _partial_responses.erase(client_fd);
+    _delayed_clients.erase(client_fd);
+    forgetClientState(client_fd);
+    _client_states[client_fd] = ClientState();
+
+    ClientState &client_state = _client_states[client_fd];
+    client_state.client_ip = Utils::addressKey(client_addr);
+    client_state.remote_addr = Utils::addressToString(client_addr);
+    client_state.remote_port = Utils::addressPort(client_addr);
+    client_state.listener = listener;
+    client_state.request._arena = &client_state.arena;
+    client_state.accepted_us = Utils::nowUs();
+    if (listener)
+        listener->generation()->retain();
+    Metrics::connectionHandled();
+    Metrics::phaseChanged(-1, client_state.phase);
+}
+
+// drops the connection's hold on its configuration generation, after its Response is gone
+void RequestsManager::forgetClientState(int client_fd) {
+    MAP<int, ClientState>::iterator it = _client_states.find(client_fd);
+    if (it == _client_states.end())
+        return;
+    const Listener *listener = it->second.listener;
+    Metrics::phaseChanged(it->second.phase, -1);
+    _client_states.erase(it);
+    if (listener)
+        listener->generation()->release();
+}
+
+const ClientState *RequestsManager::getClientState(int client_fd) const {
+    MAP<int, ClientState>::const_iterator it = _client_states.find(client_fd);
+    if (it == _client_states.end())
+        return NULL;
+    return &it->second;
+}
+
+void RequestsManager::setPhase(ClientState &client_state, ClientPhase phase) {
+    Metrics::phaseChanged(client_state.phase, phase);
+    if (phase == PHASE_IDLE) {
+        client_state.response_status = 0;
+        client_state.response_bytes = 0;
+        client_state.response_header_bytes = 0;
+        client_state.request_start_us = 0;
+        client_state.first_write_us = 0;
+        // nothing of the finished request points into the arena any more
+        client_state.request._accepted_types = NULL;
+        client_state.request._accepted_count = 0;
+        client_state.arena.reset();
+    }
+    client_state.phase = phase;
+    client_state.phase_start = time(NULL);
+    client_state.last_activity = client_state.phase_start;
+    client_state.phase_bytes = 0;
+}
+
 
 int RequestsManager::RegisterCgiFd(int cgi_fd, int client_fd) {
     if (cgi_fd < 0 || client_fd < 0) {
-        Logger::log(Logger::ERROR, "Invalid file descriptors in RegisterCgiFd");
+        LOG(Logger::ERROR, "Invalid file descriptors in RegisterCgiFd");
         return 0;
     }
 
-    Logger::log(Logger::INFO, "Registering CGI fd " + Utils::intToString(cgi_fd) +
+    LOG(Logger::DEBUG, "Registering CGI fd " + Utils::intToString(cgi_fd) +
                    " for client " + Utils::intToString(client_fd));
 
     // Ensure the CGI fd is non-blocking
     int flags = fcntl(cgi_fd, F_GETFL, 0);
     if (flags == -1) {
-        Logger::log(Logger::ERROR, "Failed to get flags for CGI fd: " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to get flags for CGI fd: " + STR(strerror(errno)));
         return 0;
     }
 
     if (fcntl(cgi_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        Logger::log(Logger::ERROR, "Failed to set non-blocking for CGI fd: " + STR(strerror(errno)));
+        LOG(Logger::ERROR, "Failed to set non-blocking for CGI fd: " + STR(strerror(errno)));
         return 0;
     }
 
@@ -90,7 +150,7 @@ Response* RequestsManager::getCgiResponse(int client_fd) {
 
 int RequestsManager::PerformSocketRead() {
     if (_client_fd < 0) {
-        Logger::log(Logger::ERROR, "PerformSocketRead: Invalid client fd");
+        LOG(Logger::ERROR, "PerformSocketRead: Invalid client fd");
         return -1;
     }
 
@@ -99,16 +159,29 @@ int RequestsManager::PerformSocketRead() {
 
     if (nbytes <= 0) {
         if (nbytes == 0) {
-            Logger::log(Logger::INFO, "Client disconnected (read returned 0)");
+            LOG(Logger::DEBUG, "Client disconnected (read returned 0)");
         } else {
-            Logger::log(Logger::ERROR, "Error reading from client: " + STR(strerror(errno)));
+            LOG(Logger::ERROR, "Error reading from client: " + STR(strerror(errno)));
         }
         return 0;
     }
 
     _partial_requests[_client_fd].append(buffer, nbytes);
+    Metrics::bytesReceived(nbytes);
 
     ClientState &client_state = _client_states[_client_fd];
+    if (client_state.phase == PHASE_IDLE) {
+        setPhase(client_state, PHASE_HEADER);
+    }
+    if (!client_state.request_start_us) {
+        client_state.request_start_us = Utils::nowUs();
+        if (client_state.accepted_us) {
+            Metrics::observe(LATENCY_ACCEPT, client_state.request_start_us - client_state.accepted_us);
+            client_state.accepted_us = 0;
+        }
+    }
+    client_state.phase_bytes += nbytes;
+    client_state.last_activity = time(NULL);
     if (client_state.body_read != -1) {
         client_state.body_read += nbytes;
     }
@@ -128,11 +201,15 @@ int RequestsManager::ProcessBufferedData() {
             if (header_end_pos != STR::npos) {
                 request.clear();
                 if (!request.setRequest(_partial_requests[_client_fd])) {
-                    Logger::log(Logger::ERROR, "Failed to parse request headers");
+                    LOG(Logger::ERROR, "Failed to parse request headers");
                     _partial_responses[_client_fd] = createErrorResponse(400, "text/plain", "Bad Request", NULL);
                     return 2;
                 }
                 body_read = 0;
+                Metrics::observe(LATENCY_HEADER, Utils::nowUs() - client_state.request_start_us);
+                if (request._chunked_flag || request._body_size > 0) {
+                    setPhase(client_state, PHASE_BODY);
+                }
             } else {
                 return 1;
             }
@@ -158,68 +235,94 @@ int RequestsManager::ProcessBufferedData() {
         }
 
         if (done) {
-            Logger::log(Logger::INFO, "Complete request received, processing...");
+            LOG(Logger::DEBUG, "Complete request received from " + client_state.remote_addr + ", processing...");
 
-            request.clear();
-            if (!request.setRequest(_partial_requests[_client_fd])) {
-                Logger::log(Logger::ERROR, "Failed to parse complete request (second pass)");
-                _partial_responses[_client_fd] = createErrorResponse(400, "text/plain", "Bad Request", NULL);
-                return 2;
-            }
+            // the headers were parsed as soon as they were complete, only the body is new
+            request._full_request.swap(_partial_requests[_client_fd]);
 
             if (request._body_size > 0 || request._chunked_flag == true) {
                 if (!request.parseBody()) {
-                    Logger::log(Logger::ERROR, "Failed to parse request body");
+                    LOG(Logger::ERROR, "Failed to parse request body");
                     _partial_responses[_client_fd] = createErrorResponse(400, "text/plain", "Bad Request", NULL);
                     return 2;
                 }
             }
 
-            try {
-                Response* res_obj = new Response();
-                res_obj->setConfig(_config);
-                res_obj->setRequest(request);
-
-                STR response_text = res_obj->getResponse();
-
-                if (response_text.empty() && !res_obj->isResponseReady()) {
-                    client_state.processing_cgi = true;
-                    _active_responses[_client_fd] = res_obj;
-                    int cgi_fd = res_obj->getCgiOutputFd();
-                    if (cgi_fd != -1) {
-                        Logger::log(Logger::INFO, "Starting CGI processing for client " + Utils::intToString(_client_fd));
-                        return RegisterCgiFd(cgi_fd, _client_fd);
-                    } else {
-                        Logger::log(Logger::ERROR, "Invalid CGI output fd");
-                        delete res_obj;
-                        _active_responses.erase(_client_fd);
-                        _partial_responses[_client_fd] = createErrorResponse(500, "text/plain", "Internal Server Error", NULL);
-                        return 2;
-                    }
-                } else {
-                    _partial_responses[_client_fd] = response_text;
-                    delete res_obj;
-
-                    client_state.body_read = -1;
-                    client_state.processing_cgi = false;
-                    _partial_requests.erase(_client_fd);
+            // parsed into the request, the read buffer is not needed any more
+            _partial_requests.erase(_client_fd);
+            return DispatchRequest(client_state, false);
+        }
 
-                    return 2;
-                }
-            } catch (const std::exception& e) {
-                Logger::log(Logger::ERROR, "Error processing request: " + STR(e.what()));
+        return 1;
+
+    } catch (const std::exception& e) {
+        LOG(Logger::ERROR, "Exception in ProcessBufferedData: " + STR(e.what()));
+        _partial_responses[_client_fd] = createErrorResponse(500, "text/plain", "Internal Server Error", NULL);
+        client_state.body_read = -1;
+        client_state.processing_cgi = false;
+        _partial_requests.erase(_client_fd);
+        return 2;
+    }
+}
+
+
+// Build the response for a complete request; rate_checked skips limit_req for delayed requests
+int RequestsManager::DispatchRequest(ClientState &client_state, bool rate_checked) {
+    Request &request = client_state.request;
+
+    try {
+        Response* res_obj = new Response();
+        res_obj->setConfig(client_state.listener ? client_state.listener->generation()->config() : _config);
+        res_obj->setRequest(request);
+        res_obj->setPeer(client_state.client_ip, client_state.remote_addr, client_state.remote_port);
+        res_obj->setListener(client_state.listener);
+        res_obj->setRateChecked(rate_checked);
+
+        client_state.dispatch_us = Utils::nowUs();
+        STR response_text = res_obj->getResponse();
+        if (res_obj->getRoutingUs() >= 0)
+            Metrics::observe(LATENCY_ROUTING, res_obj->getRoutingUs());
+
+        if (response_text.empty() && res_obj->isDelayed()) {
+            _delayed_clients[_client_fd] = Utils::nowMs() + res_obj->getDelayMs();
+            delete res_obj;
+            return 5; // park the client until the delay is over
+        } else if (response_text.empty() && res_obj->getProxyHandler()) {
+            _active_responses[_client_fd] = res_obj;
+            LOG(Logger::DEBUG, "Starting proxy for client " + Utils::intToString(_client_fd));
+            return 6; // register the upstream fd
+        } else if (response_text.empty() && !res_obj->isResponseReady()) {
+            client_state.processing_cgi = true;
+            _active_responses[_client_fd] = res_obj;
+            int cgi_fd = res_obj->getCgiOutputFd();
+            if (cgi_fd != -1) {
+                LOG(Logger::DEBUG, "Starting CGI processing for client " + Utils::intToString(_client_fd));
+                return RegisterCgiFd(cgi_fd, _client_fd);
+            } else {
+                LOG(Logger::ERROR, "Invalid CGI output fd");
+                delete res_obj;
+                _active_responses.erase(_client_fd);
                 _partial_responses[_client_fd] = createErrorResponse(500, "text/plain", "Internal Server Error", NULL);
-                client_state.body_read = -1;
-                client_state.processing_cgi = false;
-                _partial_requests.erase(_client_fd);
                 return 2;
             }
-        }
+        } else {
+            Metrics::observe(LATENCY_HANDLER, Utils::nowUs() - client_state.dispatch_us);
+            _partial_responses[_client_fd] = response_text;
+            int body_fd;
+            off_t body_offset;
+            size_t body_length;
+            if (res_obj->takeBodyFile(body_fd, body_offset, body_length))
+                _partial_responses[_client_fd].appendFile(body_fd, body_offset, body_length);
+            delete res_obj;
 
-        return 1;
+            client_state.body_read = -1;
+            client_state.processing_cgi = false;
+            _partial_requests.erase(_client_fd);
 
+            return 2;
+        }
     } catch (const std::exception& e) {
-        Logger::log(Logger::ERROR, "Exception in ProcessBufferedData: " + STR(e.what()));
+        LOG(Logger::ERROR, "Error processing request: " + STR(e.what()));
         _partial_responses[_client_fd] = createErrorResponse(500, "text/plain", "Internal Server Error", NULL);
         client_state.body_read = -1;
         client_state.processing_cgi = false;
@@ -228,10 +331,42 @@ int RequestsManager::ProcessBufferedData() {
     }
 }
 
+// Serve a request that limit_req held back, once its delay is over
+int RequestsManager::ResumeDelayed() {
+    _delayed_clients.erase(_client_fd);
+
+    MAP<int, ClientState>::iterator it = _client_states.find(_client_fd);
+    if (it == _client_states.end()) {
+        return 0;
+    }
+
+    int status = DispatchRequest(it->second, true);
+    if (status == 2) {
+        setPhase(it->second, PHASE_WRITE);
+    }
+    return status;
+}
+
+void RequestsManager::getReadyDelayedClients(long long now_ms, VECTOR<int> &ready) const {
+    for (MAP<int, long long>::const_iterator it = _delayed_clients.begin(); it != _delayed_clients.end(); ++it) {
+        if (it->second <= now_ms)
+            ready.push_back(it->first);
+    }
+}
+
+// earliest moment a delayed request becomes due, -1 if none is waiting
+long long RequestsManager::nextDelayDeadline() const {
+    long long deadline = -1;
+    for (MAP<int, long long>::const_iterator it = _delayed_clients.begin(); it != _delayed_clients.end(); ++it) {
+        if (deadline == -1 || it->second < deadline)
+            deadline = it->second;
+    }
+    return deadline;
+}
 
 int RequestsManager::HandleRead() {
     if (_client_fd < 0) {
-        Logger::log(Logger::ERROR, "HandleRead: Invalid client fd");
+        LOG(Logger::ERROR, "HandleRead: Invalid client fd");
         return 0;
     }
 
@@ -240,62 +375,115 @@ int RequestsManager::HandleRead() {
         return 0;
     }
 
-    return ProcessBufferedData();
+    int status = ProcessBufferedData();
+    if (status == 2) {
+        setPhase(_client_states[_client_fd], PHASE_WRITE);
+    } else if (status == 4 || status == 5 || status == 6) {
+        setPhase(_client_states[_client_fd], PHASE_HANDLER);
+    }
+    return status;
+}
+
+void RequestsManager::logAccess(const ClientState &client_state, long long now_us) {
+    AccessLogEntry entry;
+    entry.request = &client_state.request;
+    entry.remote_addr = client_state.remote_addr;
+    entry.remote_port = client_state.remote_port;
+    entry.status = client_state.response_status;
+    entry.bytes_sent = client_state.response_bytes;
+    entry.body_bytes_sent = client_state.response_bytes - client_state.response_header_bytes;
+    entry.request_time_us = client_state.request_start_us ? now_us - client_state.request_start_us : 0;
+    AccessLog::log(entry);
 }
 
 int RequestsManager::HandleWrite() {
     try {
-        STR &response = _partial_responses[_client_fd];
+        OutputChain &response = _partial_responses[_client_fd];
+        ClientState &client_state = _client_states[_client_fd];
+
+        // first bytes of a response carry its status line
+        if (!client_state.response_status) {
+            STR head = response.head(8192);
+            if (head.compare(0, 5, "HTTP/") == 0 && head.size() > 12) {
+                client_state.response_status = atoi(head.c_str() + 9);
+                size_t header_end = head.find("\r\n\r\n");
+                client_state.response_header_bytes = header_end == STR::npos ? 0 : header_end + 4;
+                Metrics::responseSent(client_state.response_status);
+            }
+        }
 
         // Log response size for debugging
-        Logger::log(Logger::DEBUG, "HandleWrite: Writing response of size " +
-                        Utils::intToString(response.length()) + " bytes");
+        LOG(Logger::DEBUG, "HandleWrite: Writing response of size " +
+                        Utils::intToString(response.size()) + " bytes");
 
-        // Try to write as much as possible
-        ssize_t bytes_written = write(_client_fd, response.c_str(), response.length());
+        // Try to write as much as possible, without moving what is left
+        ssize_t bytes_written = response.writeTo(_client_fd);
 
         if (bytes_written <= 0) {
             if (bytes_written == 0) {
                 // Socket closed by peer
-                Logger::log(Logger::INFO, "HandleWrite: Socket closed by peer");
+                LOG(Logger::DEBUG, "HandleWrite: Socket closed by peer");
                 CloseClient();
                 return 0;
             }
             // Real error
-            Logger::log(Logger::ERROR, "HandleWrite error: " + STR(strerror(errno)));
+            LOG(Logger::ERROR, "HandleWrite error: " + STR(strerror(errno)));
             CloseClient();
             return 0;
         }
 
-        Logger::log(Logger::INFO, "HandleWrite: Wrote " + Utils::intToString(bytes_written) +
-                        " bytes out of " + Utils::intToString(response.length()));
+        LOG(Logger::DEBUG, "HandleWrite: Wrote " + Utils::intToString(bytes_written) +
+                        " bytes, " + Utils::intToString(response.size()) + " left");
+        Metrics::bytesSent(bytes_written);
 
-        // Update response to remove written portion
-        response.erase(0, bytes_written);
+        long long now_us = Utils::nowUs();
+        if (!client_state.first_write_us) {
+            client_state.first_write_us = now_us;
+            if (client_state.request_start_us)
+                Metrics::observe(LATENCY_TTFB, now_us - client_state.request_start_us);
+        }
+
+        client_state.phase_bytes += bytes_written;
+        client_state.response_bytes += bytes_written;
+        client_state.last_activity = time(NULL);
+
+        if (response.empty() && getProxyHandler()) {
+            // Proxied response still streaming, PollServer resumes the upstream
+            return 1;
+        }
 
         if (response.empty()) {
             // All data has been sent, we're done with this client for now
-            Logger::log(Logger::INFO, "HandleWrite: Response sent completely");
+            LOG(Logger::DEBUG, "HandleWrite: Response sent completely");
+            Metrics::observe(LATENCY_WRITE, now_us - client_state.first_write_us);
+            if (client_state.request_start_us)
+                Metrics::observe(LATENCY_TOTAL, now_us - client_state.request_start_us);
+            logAccess(client_state, now_us);
+
+            if (client_state.close_after_write) {
+                return 0;
+            }
 
             // Reset the client state for the next request
-            ClientState &client_state = _client_states[_client_fd];
             client_state.body_read = -1;
             client_state.processing_cgi = false;
             client_state.request.clear();
+            setPhase(client_state, PHASE_IDLE);
 
-            // Clear the request buffer
+            // Clear the request buffer, the output chunks went back to the pool while sending
             _partial_requests.erase(_client_fd);
+            _partial_responses.erase(_client_fd);
 
             return 3; // Switch back to read mode
         } else {
             // More data to write, continue monitoring for write events
-            Logger::log(Logger::DEBUG, "HandleWrite: Still have " +
-                          Utils::intToString(response.length()) + " bytes to write");
+            LOG(Logger::DEBUG, "HandleWrite: Still have " +
+                          Utils::intToString(response.size()) + " bytes to write");
             return 2; // Keep monitoring for write events
         }
     }
     catch(const std::exception& e) {
-        Logger::log(Logger::ERROR, "HandleWrite error: " + STR(e.what()));
+        LOG(Logger::ERROR, "HandleWrite error: " + STR(e.what()));
         CloseClient();
         return 0;
     }
@@ -303,7 +491,7 @@ int RequestsManager::HandleWrite() {
 
 int RequestsManager::HandleCgiOutput(int cgi_fd) {
     if (cgi_fd < 0) {
-        Logger::log(Logger::ERROR, "Invalid CGI fd in HandleCgiOutput");
+        LOG(Logger::ERROR, "Invalid CGI fd in HandleCgiOutput");
         return 0;
     }
 
@@ -320,7 +508,7 @@ int RequestsManager::HandleCgiOutput(int cgi_fd) {
     }
 
     if (client_fd == -1 || !response) {
-        Logger::log(Logger::ERROR, "CGI fd " + Utils::intToString(cgi_fd) + " has no associated client");
+        LOG(Logger::ERROR, "CGI fd " + Utils::intToString(cgi_fd) + " has no associated client");
         return 0;
     }
 
@@ -329,7 +517,7 @@ int RequestsManager::HandleCgiOutput(int cgi_fd) {
 
     // Make sure we're processing CGI
     if (!client_state.processing_cgi) {
-        Logger::log(Logger::WARNING, "Client " + Utils::intToString(client_fd) +
+        LOG(Logger::WARNING, "Client " + Utils::intToString(client_fd) +
                         " not marked as processing CGI, but received CGI output");
         // Continue processing anyway since we have a response object
     }
@@ -340,7 +528,8 @@ int RequestsManager::HandleCgiOutput(int cgi_fd) {
 
         if (completed) {
             // CGI has finished
-            Logger::log(Logger::INFO, "CGI processing completed for client " + Utils::intToString(client_fd));
+            LOG(Logger::DEBUG, "CGI processing completed for client " + Utils::intToString(client_fd));
+            Metrics::observe(LATENCY_CGI, Utils::nowUs() - client_state.dispatch_us);
 
             // Get the final response
             _partial_responses[client_fd] = response->getFinalResponse();
@@ -351,6 +540,7 @@ int RequestsManager::HandleCgiOutput(int cgi_fd) {
             // Reset client state
             client_state.body_read = -1;
             client_state.processing_cgi = false;
+            setPhase(client_state, PHASE_WRITE);
 
             // Clean up
             delete response;
@@ -363,14 +553,16 @@ int RequestsManager::HandleCgiOutput(int cgi_fd) {
         // CGI still running, continue monitoring
         return -1;
     } catch (const std::exception& e) {
-        Logger::log(Logger::ERROR, "Error processing CGI output: " + STR(e.what()));
+        LOG(Logger::ERROR, "Error processing CGI output: " + STR(e.what()));
 
         // Create an error response
         _partial_responses[client_fd] = createErrorResponse(500, "text/plain", "Internal Server Error", NULL);
+        Metrics::cgiFailed();
 
         // Reset client state
         client_state.body_read = -1;
         client_state.processing_cgi = false;
+        setPhase(client_state, PHASE_WRITE);
 
         // Clean up
         delete response;
@@ -385,27 +577,105 @@ int RequestsManager::HandleClient(short int revents) {
         return 0;
     }
     if (revents & EPOLLIN) {
-        Logger::log(Logger::DEBUG, "RequestsManager::HandleClient: POLLIN event");
+        LOG(Logger::DEBUG, "RequestsManager::HandleClient: POLLIN event");
         return HandleRead();
     }
     if (revents & EPOLLOUT) {
-        Logger::log(Logger::DEBUG, "RequestsManager::HandleClient: POLLOUT event");
+        LOG(Logger::DEBUG, "RequestsManager::HandleClient: POLLOUT event");
         return HandleWrite();
     }
     if (revents & (EPOLLERR | EPOLLHUP)) {
-        Logger::log(Logger::INFO, "Socket error or hangup");
+        LOG(Logger::DEBUG, "Socket error or hangup");
         CloseClient();
         return 0;
     }
     return 0;
 }
 
+/*
+	Deadline check for the current client, called once per event loop tick.
+	Same return codes as HandleClient: 0 = close, 1 = nothing, 2 = 408 queued.
+
+	Header deadline covers the whole request head (slowloris), body and send
+	deadlines are between two reads/writes, and client_min_rate catches clients
+	that keep trickling a few bytes to stay under those.
+*/
+int RequestsManager::CheckTimeout(time_t now) {
+    MAP<int, ClientState>::iterator it = _client_states.find(_client_fd);
+    if (it == _client_states.end() || !_config) {
+        return 1;
+    }
+    ClientState &client_state = it->second;
+
+    bool expired = false;
+    switch (client_state.phase) {
+        case PHASE_HEADER:
+            expired = now - client_state.phase_start >= _config->_client_header_timeout;
+            break;
+        case PHASE_BODY:
+            expired = now - client_state.last_activity >= _config->_client_body_timeout;
+            break;
+        case PHASE_WRITE:
+            expired = now - client_state.last_activity >= _config->_send_timeout;
+            break;
+        case PHASE_IDLE:
+            expired = now - client_state.phase_start >= atoi(_config->_keepalive_timeout.c_str());
+            break;
+        case PHASE_HANDLER:
+            // a proxied response held back by a client that stopped reading
+            if (client_state.upstream_paused && now - client_state.last_activity >= _config->_send_timeout) {
+                LOG(Logger::INFO, "Client " + Utils::intToString(_client_fd) + " stopped reading the proxied response");
+                return 0;
+            }
+            return 1;
+    }
+
+    long long elapsed = now - client_state.phase_start;
+    if (!expired && _config->_client_min_rate > 0 && elapsed >= MIN_RATE_GRACE &&
+        (client_state.phase == PHASE_BODY || client_state.phase == PHASE_WRITE)) {
+        if (client_state.phase_bytes < _config->_client_min_rate * elapsed) {
+            LOG(Logger::INFO, "Client " + Utils::intToString(_client_fd) + " is below client_min_rate");
+            expired = true;
+        }
+    }
+
+    if (!expired) {
+        return 1;
+    }
+
+    LOG(Logger::INFO, "Client " + Utils::intToString(_client_fd) + " timed out in phase " +
+                    Utils::intToString(client_state.phase));
+
+    // nothing to answer to, or the client is not reading what we send
+    if (client_state.phase == PHASE_WRITE || client_state.phase == PHASE_IDLE ||
+        _partial_requests[_client_fd].empty()) {
+        return 0;
+    }
+
+    _partial_responses[_client_fd] = createErrorResponse(408, "text/plain", "Request Timeout", NULL);
+    _partial_requests.erase(_client_fd);
+    client_state.close_after_write = true;
+    setPhase(client_state, PHASE_WRITE);
+    return 2;
+}
+
+// shutting down: idle connections can go now, the others close once their response is out
+void RequestsManager::Drain(VECTOR<int> &idle) {
+    for (MAP<int, ClientState>::iterator it = _client_states.begin(); it != _client_states.end(); ++it) {
+        it->second.close_after_write = true;
+        MAP<int, STR>::iterator partial = _partial_requests.find(it->first);
+        if (it->second.phase == PHASE_IDLE ||
+            (it->second.phase == PHASE_HEADER && (partial == _partial_requests.end() || partial->second.empty())))
+            idle.push_back(it->first);
+    }
+}
+
 void RequestsManager::CloseClient() {
     if (_client_fd < 0) {
         return; // Nothing to do
     }
 
-    Logger::log(Logger::INFO, "RequestsManager::CloseClient: Cleaning up client " + Utils::intToString(_client_fd));
+    LOG(Logger::DEBUG, "RequestsManager::CloseClient: Cleaning up client " + Utils::intToString(_client_fd));
 
     // Clean up any active responses for this client
     MAP<int, Response*>::iterator it = _active_responses.find(_client_fd);
@@ -414,7 +684,7 @@ void RequestsManager::CloseClient() {
             // Make sure the CGI handler is closed properly
             int cgi_fd = it->second->getCgiOutputFd();
             if (cgi_fd > 0) {
-                Logger::log(Logger::INFO, "Closing CGI fd " + Utils::intToString(cgi_fd) +
+                LOG(Logger::DEBUG, "Closing CGI fd " + Utils::intToString(cgi_fd) +
                                 " for client " + Utils::intToString(_client_fd));
                 // Only close if still valid
                 if (fcntl(cgi_fd, F_GETFD) != -1) {
@@ -427,7 +697,7 @@ void RequestsManager::CloseClient() {
         _active_responses.erase(it);
     }
 
-    _client_states.erase(_client_fd);
+    forgetClientState(_client_fd);
 
     if (fcntl(_client_fd, F_GETFD) != -1) {
         close(_client_fd);
@@ -460,12 +730,111 @@ void RequestsManager::CleanupClient(int client_fd) {
 
     _partial_requests.erase(client_fd);
     _partial_responses.erase(client_fd);
-    _client_states.erase(_client_fd);
+    _delayed_clients.erase(client_fd);
+    forgetClientState(client_fd);
+}
+
+ProxyHandler* RequestsManager::getProxyHandler() const {
+    MAP<int, Response*>::const_iterator it = _active_responses.find(_client_fd);
+    if (it != _active_responses.end() && it->second) {
+        return it->second->getProxyHandler();
+    }
+    return NULL;
+}
+
+int RequestsManager::getCurrentUpstreamFd() const {
+    ProxyHandler *proxy = getProxyHandler();
+    return proxy ? proxy->getFd() : -1;
+}
+
+// upstream socket is ready, whatever the upstream produced is queued for the client
+void RequestsManager::HandleUpstreamEvent(uint32_t events) {
+    ProxyHandler *proxy = getProxyHandler();
+    if (!proxy) {
+        return;
+    }
+    proxy->handleEvent(events);
+    _partial_responses[_client_fd] += proxy->takeOutput();
+}
+
+// true when the upstream just timed out
+bool RequestsManager::CheckUpstreamTimeout(time_t now) {
+    ProxyHandler *proxy = getProxyHandler();
+    if (!proxy) {
+        return false;
+    }
+    return proxy->checkTimeout(now, _client_states[_client_fd].upstream_paused);
+}
+
+// what to wait for on the upstream fd, nothing while the client is behind
+uint32_t RequestsManager::getUpstreamEvents() {
+    ProxyHandler *proxy = getProxyHandler();
+    if (!proxy) {
+        return 0;
+    }
+
+    ClientState &client_state = _client_states[_client_fd];
+    size_t pending = _partial_responses[_client_fd].size();
+    if (pending >= PROXY_HIGH_WATERMARK) {
+        client_state.upstream_paused = true;
+    } else if (pending <= PROXY_LOW_WATERMARK) {
+        client_state.upstream_paused = false;
+    }
+    return client_state.upstream_paused ? 0 : proxy->wantedEvents();
+}
+
+bool RequestsManager::hasPendingOutput() const {
+    MAP<int, OutputChain>::const_iterator it = _partial_responses.find(_client_fd);
+    return it != _partial_responses.end() && !it->second.empty();
+}
+
+/*
+	Upstream is done, PollServer already took its fd out of epoll. Errors turn
+	into 502/504 as long as nothing was sent; once the response started, the
+	only way to tell the client is to close after what it already got. A
+	server of an upstream block that failed before the request went out hands
+	it to the next one (6). Same return codes as HandleClient.
+*/
+int RequestsManager::FinishUpstream() {
+    MAP<int, Response*>::iterator it = _active_responses.find(_client_fd);
+    if (it == _active_responses.end() || !it->second || !it->second->getProxyHandler()) {
+        return 0;
+    }
+    if (it->second->retryProxy()) {
+        return 6;
+    }
+    ProxyHandler *proxy = it->second->getProxyHandler();
+    ClientState &client_state = _client_states[_client_fd];
+
+    _partial_responses[_client_fd] += proxy->takeOutput();
+    if (proxy->getStatus() != PROXY_DONE && !proxy->hasForwarded()) {
+        int code = proxy->getStatus() == PROXY_TIMEDOUT ? 504 : 502;
+        _partial_responses[_client_fd] = createErrorResponse(code, "text/plain",
+            code == 504 ? "Gateway Timeout" : "Bad Gateway", it->second->getProxyLocation());
+    } else if (proxy->getStatus() != PROXY_DONE || proxy->closesClient()) {
+        client_state.close_after_write = true;
+    }
+    it->second->finishProxy();
+
+    delete it->second;
+    _active_responses.erase(it);
+    _partial_requests.erase(_client_fd);
+    client_state.body_read = -1;
+    client_state.upstream_paused = false;
+
+    if (!hasPendingOutput()) {
+        if (client_state.close_after_write) {
+            return 0;
+        }
+        client_state.request.clear();
+        setPhase(client_state, PHASE_IDLE);
+        return 3;
+    }
+    setPhase(client_state, PHASE_WRITE);
+    return 2;
 }
 
 // Helper function to create error responses
 STR RequestsManager::createErrorResponse(int statusCode, const STR& contentType, const STR& body, AConfigBase *base) {
-    Response tempResponse;
-    tempResponse.setConfig(_config);
-    return tempResponse.createErrorResponse(statusCode, contentType, body, base);
+    return Response::createErrorResponse(statusCode, contentType, body, base);
 }
@@ -1,241 +1,141 @@
 #include "Response.hpp"
 #include "Logger.hpp"
+#include "RateLimiter.hpp"
+#include "ProxyCache.hpp"
+#include "LocationTrie.hpp"
+#include "Metrics.hpp"
+#include "MimeTypes.hpp"
+#include "HttpStatus.hpp"
+#include "Clock.hpp"
+#include "DirListing.hpp"
 
-void	init_mimetypes(MAP<STR, STR>	&mime_types) {
-	mime_types[".html"] = "text/html";
-	mime_types[".htm"] = "text/html";
-	mime_types[".shtml"] = "text/html";
-	mime_types[".css"] = "text/css";
-	mime_types[".gif"] = "image/gif";
-	mime_types[".jpeg"] = "image/jpeg";
-	mime_types[".jpg"] = "image/jpeg";
-	mime_types[".js"] = "application/javascript";
-	mime_types[".atom"] = "application/atom+xml";
-	mime_types[".rss"] = "application/rss+xml";
-	mime_types[".mml"] = "text/mathml";
-	mime_types[".txt"] = "text/plain";
-	mime_types[".jad"] = "text/vnd.sun.j2me.app-descriptor";
-	mime_types[".wml"] = "text/vnd.wap.wml";
-	mime_types[".htc"] = "text/x-component";
-	mime_types[".avif"] = "image/avif";
-	mime_types[".png"] = "image/png";
-	mime_types[".svg"] = "image/svg+xml";
-	mime_types[".svgz"] = "image/svg+xml";
-	mime_types[".tif"] = "image/tiff";
-	mime_types[".tiff"] = "image/tiff";
-	mime_types[".wbmp"] = "image/vnd.wap.wbmp";
-	mime_types[".webp"] = "image/webp";
-	mime_types[".ico"] = "image/x-icon";
-	mime_types[".jng"] = "image/x-jng";
-	mime_types[".bmp"] = "image/x-ms-bmp";
-	mime_types[".woff"] = "font/woff";
-	mime_types[".woff2"] = "font/woff2";
-	mime_types[".jar"] = "application/java-archive";
-	mime_types[".war"] = "application/java-archive";
-	mime_types[".ear"] = "application/java-archive";
-	mime_types[".json"] = "application/json";
-	mime_types[".hqx"] = "application/mac-binhex40";
-	mime_types[".doc"] = "application/msword";
-	mime_types[".pdf"] = "application/pdf";
-	mime_types[".ps"] = "application/postscript";
-	mime_types[".eps"] = "application/postscript";
-	mime_types[".ai"] = "application/postscript";
-	mime_types[".rtf"] = "application/rtf";
-	mime_types[".m3u8"] = "application/vnd.apple.mpegurl";
-	mime_types[".kml"] = "application/vnd.google-earth.kml+xml";
-	mime_types[".kmz"] = "application/vnd.google-earth.kmz";
-	mime_types[".xls"] = "application/vnd.ms-excel";
-	mime_types[".eot"] = "application/vnd.ms-fontobject";
-	mime_types[".ppt"] = "application/vnd.ms-powerpoint";
-	mime_types[".odg"] = "application/vnd.oasis.opendocument.graphics";
-	mime_types[".odp"] = "application/vnd.oasis.opendocument.presentation";
-	mime_types[".ods"] = "application/vnd.oasis.opendocument.spreadsheet";
-	mime_types[".odt"] = "application/vnd.oasis.opendocument.text";
-	mime_types[".pptx"] = "application/vnd.openxmlformats-officedocument.presentationml.presentation";
-	mime_types[".xlsx"] = "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet";
-	mime_types[".docx"] = "application/vnd.openxmlformats-officedocument.wordprocessingml.document";
-	mime_types[".wmlc"] = "application/vnd.wap.wmlc";
-	mime_types[".wasm"] = "application/wasm";
-	mime_types[".7z"] = "application/x-7z-compressed";
-	mime_types[".cco"] = "application/x-cocoa";
-	mime_types[".jardiff"] = "application/x-java-archive-diff";
-	mime_types[".jnlp"] = "application/x-java-jnlp-file";
-	mime_types[".run"] = "application/x-makeself";
-	mime_types[".pl"] = "application/x-perl";
-	mime_types[".pm"] = "application/x-perl";
-	mime_types[".prc"] = "application/x-pilot";
-	mime_types[".pdb"] = "application/x-pilot";
-	mime_types[".rar"] = "application/x-rar-compressed";
-	mime_types[".rpm"] = "application/x-redhat-package-manager";
-	mime_types[".sea"] = "application/x-sea";
-	mime_types[".swf"] = "application/x-shockwave-flash";
-	mime_types[".sit"] = "application/x-stuffit";
-	mime_types[".tcl"] = "application/x-tcl";
-	mime_types[".tk"] = "application/x-tcl";
-	mime_types[".der"] = "application/x-x509-ca-cert";
-	mime_types[".pem"] = "application/x-x509-ca-cert";
-	mime_types[".crt"] = "application/x-x509-ca-cert";
-	mime_types[".xpi"] = "application/x-xpinstall";
-	mime_types[".xhtml"] = "application/xhtml+xml";
-	mime_types[".xspf"] = "application/xspf+xml";
-	mime_types[".zip"] = "application/zip";
-	mime_types[".bin"] = "application/octet-stream";
-	mime_types[".exe"] = "application/octet-stream";
-	mime_types[".dll"] = "application/octet-stream";
-	mime_types[".deb"] = "application/octet-stream";
-	mime_types[".dmg"] = "application/octet-stream";
-	mime_types[".iso"] = "application/octet-stream";
-	mime_types[".img"] = "application/octet-stream";
-	mime_types[".msi"] = "application/octet-stream";
-	mime_types[".msp"] = "application/octet-stream";
-	mime_types[".msm"] = "application/octet-stream";
-	mime_types[".mid"] = "audio/midi";
-	mime_types[".midi"] = "audio/midi";
-	mime_types[".kar"] = "audio/midi";
-	mime_types[".mp3"] = "audio/mpeg";
-	mime_types[".ogg"] = "audio/ogg";
-	mime_types[".m4a"] = "audio/x-m4a";
-	mime_types[".ra"] = "audio/x-realaudio";
-	mime_types[".3gpp"] = "video/3gpp";
-	mime_types[".3gp"] = "video/3gpp";
-	mime_types[".ts"] = "video/mp2t";
-	mime_types[".mp4"] = "video/mp4";
-	mime_types[".mpeg"] = "video/mpeg";
-	mime_types[".mpg"] = "video/mpeg";
-	mime_types[".mov"] = "video/quicktime";
-	mime_types[".webm"] = "video/webm";
-	mime_types[".flv"] = "video/x-flv";
-	mime_types[".m4v"] = "video/x-m4v";
-	mime_types[".mng"] = "video/x-mng";
-	mime_types[".asx"] = "video/x-ms-asf";
-	mime_types[".asf"] = "video/x-ms-asf";
-	mime_types[".wmv"] = "video/x-ms-wmv";
-	mime_types[".avi"] = "video/x-msvideo";
+STR Response::createResponse(int statusCode, const STR& contentType, const STR& body, const STR& extra) {
+    STR response = createHeaders(statusCode, contentType, body.length(), extra);
+    response.reserve(response.size() + body.size());
+    response += body;
+    return response;
 }
 
-void	init_status_codes(MAP<int, STR>	&status_codes) {
-	// Informational responses (100-199)
-	status_codes[100] = "100 Continue";
-	status_codes[101] = "101 Switching Protocols";
-	status_codes[102] = "102 Processing";
-	status_codes[103] = "103 Early Hints";
-
-	// Successful responses (200-299)
-	status_codes[200] = "200 OK";
-	status_codes[201] = "201 Created";
-	status_codes[202] = "202 Accepted";
-	status_codes[203] = "203 Non-Authoritative Information";
-	status_codes[204] = "204 No Content";
-	status_codes[205] = "205 Reset Content";
-	status_codes[206] = "206 Partial Content";
-	status_codes[207] = "207 Multi-Status";
-	status_codes[208] = "208 Already Reported";
-	status_codes[226] = "226 IM Used";
-
-	// Redirection messages (300-399)
-	status_codes[300] = "300 Multiple Choices";
-	status_codes[301] = "301 Moved Permanently";
-	status_codes[302] = "302 Found";
-	status_codes[303] = "303 See Other";
-	status_codes[304] = "304 Not Modified";
-	status_codes[305] = "305 Use Proxy";
-	status_codes[307] = "307 Temporary Redirect";
-	status_codes[308] = "308 Permanent Redirect";
-
-	// Client error responses (400-499)
-	status_codes[400] = "400 Bad Request";
-	status_codes[401] = "401 Unauthorized";
-	status_codes[402] = "402 Payment Required";
-	status_codes[403] = "403 Forbidden";
-	status_codes[404] = "404 Not Found";
-	status_codes[405] = "405 Method Not Allowed";
-	status_codes[406] = "406 Not Acceptable";
-	status_codes[407] = "407 Proxy Authentication Required";
-	status_codes[408] = "408 Request Timeout";
-	status_codes[409] = "409 Conflict";
-	status_codes[410] = "410 Gone";
-	status_codes[411] = "411 Length Required";
-	status_codes[412] = "412 Precondition Failed";
-	status_codes[413] = "413 Payload Too Large";
-	status_codes[414] = "414 URI Too Long";
-	status_codes[415] = "415 Unsupported Media Type";
-	status_codes[416] = "416 Range Not Satisfiable";
-	status_codes[417] = "417 Expectation Failed";
-	status_codes[418] = "418 I'm a teapot";
-	status_codes[421] = "421 Misdirected Request";
-	status_codes[422] = "422 Unprocessable Entity";
-	status_codes[423] = "423 Locked";
-	status_codes[424] = "424 Failed Dependency";
-	status_codes[425] = "425 Too Early";
-	status_codes[426] = "426 Upgrade Required";
-	status_codes[428] = "428 Precondition Required";
-	status_codes[429] = "429 Too Many Requests";
-	status_codes[431] = "431 Request Header Fields Too Large";
-	status_codes[451] = "451 Unavailable For Legal Reasons";
-
-	// Server error responses (500-599)
-	status_codes[500] = "500 Internal Server Error";
-	status_codes[501] = "501 Not Implemented";
-	status_codes[502] = "502 Bad Gateway";
-	status_codes[503] = "503 Service Unavailable";
-	status_codes[504] = "504 Gateway Timeout";
-	status_codes[505] = "505 HTTP Version Not Supported";
-	status_codes[506] = "506 Variant Also Negotiates";
-	status_codes[507] = "507 Insufficient Storage";
-	status_codes[508] = "508 Loop Detected";
-	status_codes[510] = "510 Not Extended";
-	status_codes[511] = "511 Network Authentication Required";
+STR Response::createHeaders(int statusCode, const STR& contentType, size_t contentLength, const STR& extra) {
+    STR response = statusHeaders(statusCode);
+    response += entityHeaders(contentType, contentLength, extra);
+    return response;
 }
 
-STR Response::createResponse(int statusCode, const STR& contentType, const STR& body, const STR& extra) {
-    std::stringstream response;
-    response << "HTTP/1.1 " << _all_status_codes[statusCode] << "\r\n"
-             << "Content-Type: " << contentType << "\r\n"
-             << "Content-Length: " << body.length() << "\r\n"
-             << "Access-Control-Allow-Origin: *\r\n"
-             << "Access-Control-Allow-Methods: GET, POST, DELETE, OPTIONS\r\n"
-             << "Access-Control-Allow-Headers: Content-Type\r\n"
-             << "Access-Control-Allow-Credentials: true\r\n"
-			 << extra << ((extra.empty()) ? "" : "\r\n")
-             << "Connection: close\r\n"
-             << "\r\n"
-             << body;
-    return response.str();
+// status line, Date and Server: the part that differs between two otherwise equal responses
+STR Response::statusHeaders(int statusCode) {
+    STR headers;
+    headers.reserve(128);
+    headers += HttpStatus::line(statusCode);
+    headers.append("Date: ").append(Clock::httpDate()).append("\r\n");
+    headers.append("Server: " SERVER_SOFTWARE "\r\n");
+    return headers;
+}
+
+// the rest of the header, up to the empty line
+STR Response::entityHeaders(const STR& contentType, size_t contentLength, const STR& extra) {
+    char length[24];
+    snprintf(length, sizeof(length), "%lu", (unsigned long)contentLength);
+
+    STR headers;
+    headers.reserve(256 + contentType.size() + extra.size());
+    headers.append("Content-Type: ").append(contentType).append("\r\n");
+    headers.append("Content-Length: ").append(length).append("\r\n");
+    headers += "Access-Control-Allow-Origin: *\r\n"
+               "Access-Control-Allow-Methods: GET, POST, DELETE, OPTIONS\r\n"
+               "Access-Control-Allow-Headers: Content-Type\r\n"
+               "Access-Control-Allow-Credentials: true\r\n";
+    if (!extra.empty())
+        headers.append(extra).append("\r\n");
+    headers += "Connection: close\r\n"
+               "\r\n";
+    return headers;
+}
+
+// body of a static file left to the writer (sendfile); false if there is none
+bool Response::takeBodyFile(int &fd, off_t &offset, size_t &length) {
+    if (_body_fd < 0)
+        return false;
+    fd = _body_fd;
+    offset = _body_offset;
+    length = _body_length;
+    _body_fd = -1;
+    return true;
 }
 
 Response::Response() {
-	init_mimetypes(_all_mime_types);
-	init_status_codes(_all_status_codes);
 	_request.clear();
 	_config = NULL;
     _cgi_handler = NULL;
+    _proxy_handler = NULL;
+    _upstream = NULL;
+    _upstream_server = -1;
+    _proxy_location = NULL;
+    _proxy_tries = 0;
+    _cache_locked = false;
     _state = READY;
+    _client_ip = ClientKey();
+    _remote_port = 0;
+    _listener = NULL;
+    _rate_checked = false;
+    _delay_ms = 0;
+    _routing_us = -1;
+    _body_fd = -1;
+    _body_offset = 0;
+    _body_length = 0;
 }
 
 Response::Response(Request request, HttpConfig *config) {
-	init_mimetypes(_all_mime_types);
-	init_status_codes(_all_status_codes);
 	_request.clear();
 	_request = request;
 	_config = config;
     _cgi_handler = NULL;
+    _proxy_handler = NULL;
+    _upstream = NULL;
+    _upstream_server = -1;
+    _proxy_location = NULL;
+    _proxy_tries = 0;
+    _cache_locked = false;
     _state = READY;
+    _client_ip = ClientKey();
+    _remote_port = 0;
+    _listener = NULL;
+    _rate_checked = false;
+    _delay_ms = 0;
+    _routing_us = -1;
+    _body_fd = -1;
+    _body_offset = 0;
+    _body_length = 0;
 }
 
 Response::Response(const Response &obj) {
-	_all_mime_types = obj._all_mime_types;
-	_all_status_codes = obj._all_status_codes;
 	_request.clear();
 	_request = obj._request;
 	_config = obj._config;
     _cgi_handler = NULL; // Don't copy the CGI handler
+    _proxy_handler = NULL;
+    _upstream = NULL;
+    _upstream_server = -1;
+    _proxy_location = NULL;
+    _proxy_tries = 0;
+    _cache_locked = false;
     _state = READY;
+    _client_ip = obj._client_ip;
+    _remote_addr = obj._remote_addr;
+    _remote_port = obj._remote_port;
+    _listener = obj._listener;
+    _rate_checked = obj._rate_checked;
+    _delay_ms = 0;
+    _routing_us = -1;
+    _body_fd = -1;
+    _body_offset = 0;
+    _body_length = 0;
 }
 
 Response::~Response() {
     // Make sure CGI handler is properly deleted
     if (_cgi_handler) {
-        Logger::log(Logger::DEBUG, "Response destructor: cleaning up CGI handler");
+        LOG(Logger::DEBUG, "Response destructor: cleaning up CGI handler");
 
         // Call closeCgi to clean up all resources
         _cgi_handler->closeCgi();
@@ -243,6 +143,16 @@ Response::~Response() {
         delete _cgi_handler;
         _cgi_handler = NULL;
     }
+    delete _proxy_handler;
+    _proxy_handler = NULL;
+    if (_upstream && _upstream_server != -1)
+        LoadBalancer::release(_upstream, _upstream_server, false);
+    _upstream_server = -1;
+    if (_cache_locked)
+        ProxyCache::unlock(_cache_key);
+    _cache_locked = false;
+    if (_body_fd >= 0)
+        close(_body_fd);
 }
 
 void Response::clear() {
@@ -253,6 +163,14 @@ void Response::clear() {
         delete _cgi_handler;
         _cgi_handler = NULL;
     }
+    delete _proxy_handler;
+    _proxy_handler = NULL;
+    if (_upstream && _upstream_server != -1)
+        LoadBalancer::release(_upstream, _upstream_server, false);
+    _upstream_server = -1;
+    if (_cache_locked)
+        ProxyCache::unlock(_cache_key);
+    _cache_locked = false;
 
     _state = READY;
     _response_buffer.clear();
@@ -260,7 +178,7 @@ void Response::clear() {
 
 
 
-void Response::setRequest(Request request) {
+void Response::setRequest(const Request &request) {
 	_request.clear();
 	_request = request;
 }
@@ -269,49 +187,30 @@ void Response::setConfig(HttpConfig *config) {
 	_config = config;
 }
 
-bool ends_with(const STR &str, const STR &suffix)
-{
-	if (str.length() < suffix.length())
-	{
-		return false;
-	}
-	return str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
+// peer of the connection, address already formatted at accept time
+void Response::setPeer(const ClientKey &client_ip, const STR &remote_addr, int remote_port) {
+	_client_ip = client_ip;
+	_remote_addr = remote_addr;
+	_remote_port = remote_port;
 }
 
-STR getMimeType(const STR& path) {
-    // Update MIME type detection with more common types
-    if (ends_with(path, ".html") || ends_with(path, ".htm")) return "text/html; charset=utf-8";
-    if (ends_with(path, ".css")) return "text/css; charset=utf-8";
-    if (ends_with(path, ".js")) return "text/javascript; charset=utf-8";
-    if (ends_with(path, ".json")) return "application/json; charset=utf-8";
-    if (ends_with(path, ".jpg") || ends_with(path, ".jpeg")) return "image/jpeg";
-    if (ends_with(path, ".png")) return "image/png";
-    if (ends_with(path, ".gif")) return "image/gif";
-    if (ends_with(path, ".svg")) return "image/svg+xml";
-    if (ends_with(path, ".ico")) return "image/x-icon";
-    if (ends_with(path, ".txt")) return "text/plain; charset=utf-8";
-    if (ends_with(path, ".pdf")) return "application/pdf";
-    return "text/plain; charset=utf-8";  // Default to text/plain instead of application/octet-stream
+void Response::setListener(const Listener *listener) {
+	_listener = listener;
 }
 
-STR	Response::getMime(STR path) {
+void Response::setRateChecked(bool rate_checked) {
+	_rate_checked = rate_checked;
+}
 
-	// std::cerr << "ending mime : " << ending << ", for path " << path << "\n";
-	try
-	{
-		STR	ending = path.substr(path.find_last_of('.'));
-		return _all_mime_types.at(ending);
-	}
-	catch(const std::exception& e)
+bool ends_with(const STR &str, const STR &suffix)
+{
+	if (str.length() < suffix.length())
 	{
-		return "text/plain";
+		return false;
 	}
-
-	return "text/plain";
+	return str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
 }
 
-#include <dirent.h>
-
 // Function to decode URL-encoded strings
 STR urlDecode(const STR& input) {
     STR result;
@@ -349,58 +248,13 @@ STR urlDecode(const STR& input) {
     return result;
 }
 
-STR Response::handleDIR(STR path) {
-    DIR* dir = opendir(path.c_str());
-    if (!dir) {
-		Logger::log(Logger::ERROR, "Failed to open directory: " + path + " Reason: " + strerror(errno));
-        return createErrorResponse(500, "text/plain", "Failed to read directory", NULL);
-    }
-
-    std::stringstream html;
-    html << "<html><head><title>Index of " << _request._file_path << "</title></head><body>\n";
-    html << "<h1>Index of " << _request._file_path << "</h1><hr><pre>\n";
-
-	struct dirent* entry;
-	while ((entry = readdir(dir)) != NULL) {
-		STR name = entry->d_name;
-        struct stat st;
-        STR root_path = path + "/" + name;
-
-        if (stat(root_path.c_str(), &st) == 0) {
-			if (S_ISDIR(st.st_mode)){
-				name += "/";
-			}
-			STR fullpath = _request._file_path + "/" + name;
-
-            char timeStr[100];
-            strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&st.st_mtime));	//REDO, bad funcs!
-
-            STR displayName = urlDecode(name);
-
-			// if (displayName.length() >= 45)
-			// 	displayName = displayName.substr(0, 42) + "...";
-
-			// std::cerr << "DEBUG Response::handleDIR: displayName is " << displayName << "\n";
-
-			// html << "<a href=\"" << fullpath << "\">"
-			// << displayName << "</a>"
-			// << STR(50 - displayName.length(), ' ')
-			// << timeStr
-			// << STR(20, ' ')
-			// << st.st_size << "\n";
-
-			html << "<a href=\"" << fullpath << "\">"
-			<< displayName << "</a>"
-			<< ' '
-			<< timeStr
-			<< ' '
-			<< st.st_size << "\n";
-        }
-    }
-
-    html << "</pre><hr></body></html>";
-    closedir(dir);
-    return createResponse(200, "text/html", html.str(), "");
+STR Response::handleDIR(STR path, LocationConfig *matchLocation) {
+	bool json = matchLocation && matchLocation->_autoindex_json;
+	size_t page_size = matchLocation ? matchLocation->_autoindex_page_size : DIR_LISTING_PAGE_SIZE;
+	STR body;
+	if (!DirListing::render(path, _request._file_path, _request._query_string, json, page_size, body))
+		return createErrorResponse(500, "text/plain", "Failed to read directory", NULL);
+	return createResponse(200, json ? "application/json" : "text/html", body, "");
 }
 
 void	Response::selectIndexIndexes(VECTOR<STR> indexes, STR &best_match, float &match_quality, STR dir_path) {
@@ -416,36 +270,36 @@ void	Response::selectIndexIndexes(VECTOR<STR> indexes, STR &best_match, float &m
 			continue;
 		}
 
-		STR index_mime = getMime(indexes[i]);
+		const STR &index_mime = MimeTypes::type(indexes[i]);
 
 		try
 		{
-			if (_request._accepted_types[index_mime] > match_quality) {
-				Logger::log(Logger::DEBUG, index_mime + " is better match that" + best_match + "! Quality " + Utils::floatToString(_request._accepted_types[index_mime]) + " is better than " + Utils::floatToString(match_quality));
+			if (_request.acceptQuality(index_mime) > match_quality) {
+				LOG(Logger::DEBUG, index_mime + " is better match that" + best_match + "! Quality " + Utils::floatToString(_request.acceptQuality(index_mime)) + " is better than " + Utils::floatToString(match_quality));
 				best_match = indexes[i];
-				match_quality = _request._accepted_types[index_mime];
+				match_quality = _request.acceptQuality(index_mime);
 			}
 			else
-				Logger::log(Logger::DEBUG, index_mime + " is not more than " + Utils::floatToString(match_quality));
+				LOG(Logger::DEBUG, index_mime + " is not more than " + Utils::floatToString(match_quality));
 		}
 		catch(const std::exception& e)
 		{
-			Logger::log(Logger::ERROR, index_mime + " is not accepted: " + index_mime);
+			LOG(Logger::ERROR, index_mime + " is not accepted: " + index_mime);
 		}
 		try
 		{
-			if (_request._accepted_types["*/*"] > match_quality) {
-				Logger::log(Logger::DEBUG, "*/* is the better match than " + best_match
-					+ "! Quality " + Utils::floatToString(_request._accepted_types["*/*"]) + " is better than " + Utils::floatToString(match_quality));
+			if (_request.acceptQuality("*/*") > match_quality) {
+				LOG(Logger::DEBUG, "*/* is the better match than " + best_match
+					+ "! Quality " + Utils::floatToString(_request.acceptQuality("*/*")) + " is better than " + Utils::floatToString(match_quality));
 				best_match = indexes[i];
-				match_quality = _request._accepted_types["*/*"];
+				match_quality = _request.acceptQuality("*/*");
 			}
 			else
-				Logger::log(Logger::DEBUG, "*/* is not more than " + Utils::floatToString(match_quality));
+				LOG(Logger::DEBUG, "*/* is not more than " + Utils::floatToString(match_quality));
 		}
 		catch(const std::exception& e)
 		{
-			Logger::log(Logger::ERROR, "*/* is not accepted: " + index_mime);
+			LOG(Logger::ERROR, "*/* is not accepted: " + index_mime);
 		}
 
 		i++;
@@ -460,32 +314,29 @@ STR	Response::selectIndexAll(LocationConfig* location, STR dir_path) {
 
 		quality is not needed - remove later
 	*/
-	AConfigBase* local_ref = location;
-	while (local_ref) {
-		if (!local_ref->_index.empty()) {
-			selectIndexIndexes(local_ref->_index, best_match, match_quality, dir_path);
-			if (match_quality == 1)
-				break;
-		}
-		local_ref = local_ref->back_ref;
+	const VECTOR<VECTOR<STR> > &levels = location->_effective->_index_levels;
+	for (size_t i = 0; i < levels.size(); i++) {
+		selectIndexIndexes(levels[i], best_match, match_quality, dir_path);
+		if (match_quality == 1)
+			break;
 	}
 
 	if (best_match == "")
 		throw std::runtime_error("No index match");
 	else
-		Logger::log(Logger::DEBUG, "Response::selectIndexAll: best_match is " + best_match + ", quality: " + Utils::floatToString(match_quality));
+		LOG(Logger::DEBUG, "Response::selectIndexAll: best_match is " + best_match + ", quality: " + Utils::floatToString(match_quality));
 	return best_match;
 }
 
 FileType Response::checkFile(const STR& path) {
 	if (path.empty()) {
-		Logger::log(Logger::INFO, "File " + path + " not found: Empty path provided.");
+		LOG(Logger::DEBUG, "File " + path + " not found: Empty path provided.");
         return NotFound;
     }
 
     struct stat path_stat;
     if (stat(path.c_str(), &path_stat) != 0) {
-		Logger::log(Logger::INFO, "File " + path + " not found. Reason: " + strerror(errno));
+		LOG(Logger::DEBUG, "File " + path + " not found. Reason: " + strerror(errno));
         return NotFound;
     }
 
@@ -496,28 +347,40 @@ FileType Response::checkFile(const STR& path) {
 }
 
 
-STR	Response::handleGET(STR full_path, bool isDIR) {
+STR	Response::handleGET(STR full_path, bool isDIR, LocationConfig *matchLocation) {
 	if (isDIR) {
-		return handleDIR(full_path);
+		return handleDIR(full_path, matchLocation);
 	}
 
-	if (access(full_path.c_str(), R_OK) == 0) {
-		std::ifstream file(full_path.c_str(), std::ios::binary);
-		if (file) {
-			std::stringstream content;
-			content << file.rdbuf();
-			return createResponse(200, getMimeType(full_path), content.str(), "");
+	int fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0) {
+		// large files go out with sendfile, small ones with the headers in one write
+		if (st.st_size >= SENDFILE_MIN_SIZE) {
+			_body_fd = fd;
+			_body_offset = 0;
+			_body_length = st.st_size;
+			return createHeaders(200, MimeTypes::contentType(full_path), _body_length,
+				"Last-Modified: " + Clock::httpDate(st.st_mtime));
 		}
+		STR content(st.st_size, '\0');
+		ssize_t got = st.st_size ? read(fd, &content[0], st.st_size) : 0;
+		close(fd);
+		if (got == st.st_size)
+			return createResponse(200, MimeTypes::contentType(full_path), content,
+				"Last-Modified: " + Clock::httpDate(st.st_mtime));
+	} else if (fd >= 0) {
+		close(fd);
 	}
 	return createErrorResponse(403, "text/plain", "HANDLEGET ERROR (Forbidden)", NULL);
 }
 
 STR Response::handlePOST(STR full_path) {
-    Logger::log(Logger::DEBUG, "Response::handlePOST: start for " + full_path);
+    LOG(Logger::DEBUG, "Response::handlePOST: start for " + full_path);
 
     // Check if directory exists to upload to
     STR dir_path = full_path.substr(0, full_path.find_last_of('/'));
-    Logger::log(Logger::DEBUG, "Response::handlePOST: dir_path is " + dir_path);
+    LOG(Logger::DEBUG, "Response::handlePOST: dir_path is " + dir_path);
 
     if (access(dir_path.c_str(), W_OK) != 0) {
         return createErrorResponse(403, "text/plain", "HANDLEPOST ERROR (Forbidden - Cannot write to directory)", NULL);
@@ -539,7 +402,7 @@ STR Response::handlePOST(STR full_path) {
     STR status_message = file_exists ? "OK - File Updated" : "Created";
     int status_code = file_exists ? 200 : 201;
 
-	Logger::log(Logger::INFO, "Response::handlePOST end");
+	LOG(Logger::DEBUG, "Response::handlePOST end");
 
     return createResponse(status_code, "text/plain", status_message, "");
 }
@@ -564,6 +427,10 @@ STR Response::handleDELETE(STR full_path) {
     return createResponse(204, "text/plain", "", "");
 }
 
+bool	is_cgi_script(const STR &path) {
+	return ends_with(path, ".py") || ends_with(path, ".php") || ends_with(path, ".pl") || ends_with(path, ".sh");
+}
+
 STR	regress_path(STR path) {
 	if (path.find_last_of("/") == STR::npos)
 		return path;
@@ -594,61 +461,13 @@ std::string joinPaths(const std::string& p1, const std::string& p2) {
 }
 
 LocationConfig *Response::buildDirPath(ServerConfig *matchServer, STR &full_path, bool &isDIR) {
-	LocationConfig *matchLocation = NULL;
-	STR path_to_match = _request._file_path;
-
-	// search exact match first
-	while (path_to_match != "" && !matchLocation) {
-		MAP<STR, LocationConfig *> loc_loc = matchServer->_locations;
-		while (loc_loc.size() > 0) {
-			MAP<STR, LocationConfig *>::iterator it = loc_loc.begin();
-			if (it->first == path_to_match) {
-				matchLocation = it->second;
-				break;
-			}
-			if (it->second->_locations.size() > 0) {
-				loc_loc.insert(it->second->_locations.begin(), it->second->_locations.end());
-			}
-			loc_loc.erase(it);
-		}
-
-		if (!matchLocation && path_to_match != "" && path_to_match[path_to_match.length() - 1] != '/') {
-			STR path_with_slash = path_to_match + "/";
-			loc_loc = matchServer->_locations;
-			while (loc_loc.size() > 0) {
-				MAP<STR, LocationConfig *>::iterator it = loc_loc.begin();
-				if (it->first == path_with_slash) {
-					matchLocation = it->second;
-					break;
-				}
-				if (it->second->_locations.size() > 0) {
-					loc_loc.insert(it->second->_locations.begin(), it->second->_locations.end());
-				}
-				loc_loc.erase(it);
-			}
-		}
-
-		if (!matchLocation) {
-			Logger::log(Logger::DEBUG, "Regressed path " + path_to_match + " -> " + regress_path(path_to_match));
-			path_to_match = regress_path(path_to_match);
-		}
-	}
+	STR path_to_match = "";
+	LocationConfig *matchLocation = matchServer->_location_trie->match(_request._file_path, path_to_match);
 
 	if (!matchLocation)
 		return NULL;
 
-	STR relative_path = "";
-
-	// add root path
-	AConfigBase* local_ref = matchLocation;
-	while (local_ref) {
-		if (local_ref->_root != "") {
-			relative_path.append(local_ref->_root);
-			break;
-		}
-		local_ref = local_ref->back_ref;
-	}
-
+	STR relative_path = matchLocation->_effective->_root;
 	relative_path.append(_request._file_path);
 
 	STR absolute_path = _request._file_path;
@@ -667,10 +486,10 @@ LocationConfig *Response::buildDirPath(ServerConfig *matchServer, STR &full_path
 
 			relative_path = new_path;
 
-			Logger::log(Logger::DEBUG, "Applied alias: replaced '" + path_to_match +
+			LOG(Logger::DEBUG, "Applied alias: replaced '" + path_to_match +
 						"' with '" + matchLocation->_alias + "' => '" + relative_path + "'");
 		} else {
-			Logger::log(Logger::WARNING, "Could not apply alias: location path not found in request path");
+			LOG(Logger::WARNING, "Could not apply alias: location path not found in request path");
 		}
 
 		if (pos_abs != STR::npos) {
@@ -679,31 +498,31 @@ LocationConfig *Response::buildDirPath(ServerConfig *matchServer, STR &full_path
 
 			absolute_path = new_path;
 
-			Logger::log(Logger::DEBUG, "Applied alias: replaced '" + path_to_match +
+			LOG(Logger::DEBUG, "Applied alias: replaced '" + path_to_match +
 						"' with '" + matchLocation->_alias + "' => '" + absolute_path + "'");
 		} else {
-			Logger::log(Logger::WARNING, "Could not apply alias: location path not found in request path");
+			LOG(Logger::WARNING, "Could not apply alias: location path not found in request path");
 		}
 	}
 
 	// check which path exists - relative or absolute
 	if (checkFile(relative_path) != NotFound) {
-		Logger::log(Logger::DEBUG, "Response::buildDirPath: relative path is " + relative_path);
+		LOG(Logger::DEBUG, "Response::buildDirPath: relative path is " + relative_path);
 		full_path = relative_path;
 	} else if (checkFile(absolute_path) != NotFound) {
-		Logger::log(Logger::DEBUG, "Response::buildDirPath: absolute path is " + absolute_path);
+		LOG(Logger::DEBUG, "Response::buildDirPath: absolute path is " + absolute_path);
 		full_path = absolute_path;
 	} else if (!isDIR && checkFile(regress_path(relative_path)) != NotFound) {
-		Logger::log(Logger::DEBUG, "Response::buildDirPath: relative path is " + relative_path);
+		LOG(Logger::DEBUG, "Response::buildDirPath: relative path is " + relative_path);
 		full_path = relative_path;
 	} else if (!isDIR && checkFile(regress_path(absolute_path)) != NotFound) {
-		Logger::log(Logger::DEBUG, "Response::buildDirPath: absolute path is " + absolute_path);
+		LOG(Logger::DEBUG, "Response::buildDirPath: absolute path is " + absolute_path);
 		full_path = relative_path;
 	} else {
-		Logger::log(Logger::INFO, "Response::buildDirPath: no such file or directory \"" + full_path + "\" for " + _request._file_path + "!");
+		LOG(Logger::DEBUG, "Response::buildDirPath: no such file or directory \"" + full_path + "\" for " + _request._file_path + "!");
 	}
 
-	Logger::log(Logger::DEBUG, "Response::buildDirPath: dir path is " + full_path);
+	LOG(Logger::DEBUG, "Response::buildDirPath: dir path is " + full_path);
 	return matchLocation;
 }
 
@@ -716,133 +535,121 @@ int Response::buildIndexPath(LocationConfig *matchLocation, STR &best_file_path,
 	try
 	{
 		best_file_path.append(selectIndexAll(matchLocation, dir_path));
-		Logger::log(Logger::DEBUG, "Response::buildFilePath: AFT best_file_path is " + best_file_path);
+		LOG(Logger::DEBUG, "Response::buildFilePath: AFT best_file_path is " + best_file_path);
 	}
 	catch(const std::exception& e)
 	{
 		// return createResponse(403, "text/plain", "NO SUCH FILE FOUND (change later)", "");
 
-		Logger::log(Logger::ERROR, "Response::buildFilePath: no index file found");
+		LOG(Logger::ERROR, "Response::buildFilePath: no index file found");
 		return 0;
 	}
 
-	Logger::log(Logger::INFO, "Response::buildFilePath: index file is " + best_file_path);
+	LOG(Logger::DEBUG, "Response::buildFilePath: index file is " + best_file_path);
 	return 1;
 }
 
 bool	check_method_allowed(STR method, LocationConfig *matchLocation) {
-	AConfigBase* local_ref = matchLocation;
-	while (local_ref && local_ref->_identify(local_ref) != SERVER) {
-		LocationConfig* location = dynamic_cast<LocationConfig*>(local_ref);
-		if (location->_allowed_methods[method] == true)
-			return true;
-		local_ref = local_ref->back_ref;
-	}
-	return false;
+	return matchLocation && (matchLocation->_effective->_methods & EffectiveLocation::methodBit(method));
 }
 
 STR	Response::matchMethod(STR path, bool isDIR, LocationConfig *matchLocation) {
 	if (_request._method == "GET") {
 		if (!check_method_allowed("GET", matchLocation))
 			return createErrorResponse(405, "text/plain", "Method Not Allowed", matchLocation);
-		Logger::log(Logger::INFO, "Response::matchMethod GET path" + path + " isDIR " + Utils::floatToString(isDIR));
-		return (handleGET(path, isDIR));
+		LOG(Logger::DEBUG, "Response::matchMethod GET path" + path + " isDIR " + Utils::floatToString(isDIR));
+		return (handleGET(path, isDIR, matchLocation));
 	} else if (_request._method == "POST") {
 		if (!check_method_allowed("POST", matchLocation))
 			return createErrorResponse(405, "text/plain", "Method Not Allowed", matchLocation);
-		Logger::log(Logger::INFO, "Response::matchMethod POST path" + path + " isDIR " + Utils::floatToString(isDIR));
+		LOG(Logger::DEBUG, "Response::matchMethod POST path" + path + " isDIR " + Utils::floatToString(isDIR));
 		return (handlePOST(path));
 	} else if (_request._method == "DELETE") {
 		if (!check_method_allowed("DELETE", matchLocation))
 			return createErrorResponse(405, "text/plain", "Method Not Allowed", matchLocation);
-		Logger::log(Logger::INFO, "Response::matchMethod DELETE path" + path + " isDIR " + Utils::floatToString(isDIR));
+		LOG(Logger::DEBUG, "Response::matchMethod DELETE path" + path + " isDIR " + Utils::floatToString(isDIR));
 		return (handleDELETE(path));
 	} else {
-		Logger::log(Logger::ERROR, "Response::matchMethod: UNUSUAL METHOD ERROR: " + _request._method);
+		LOG(Logger::ERROR, "Response::matchMethod: UNUSUAL METHOD ERROR: " + _request._method);
 		return createErrorResponse(405, "text/plain", "Method Not Allowed", matchLocation);
 	}
 }
 
 
 STR	Response::checkRedirect(LocationConfig *matchLocation) {
-	AConfigBase*	back_ref = matchLocation;
-	ServerConfig* tempServer;
-	LocationConfig* tempLocation;
-
-	while (back_ref && back_ref->_identify(back_ref) != HTTP) {
-		switch (back_ref->_identify(back_ref))
-		{
-		case SERVER:
-			 tempServer = dynamic_cast<ServerConfig*>(back_ref);
-
-			if (tempServer->_return_url != "" && tempServer->_return_code == -1) {
-				return createResponse(301, "text/plain", "Redirect", "Location: " + tempServer->_return_url);
-			}
-			if (tempServer->_return_url != "") {
-				return createResponse(tempServer->_return_code, "text/plain", "Redirect", "Location: " + tempServer->_return_url);
-			}
-			break;
-		case LOCATION:
-			 tempLocation = dynamic_cast<LocationConfig*>(back_ref);
-
-			if (tempLocation->_return_url != "" && tempLocation->_return_code == -1) {
-				return createResponse(301, "text/plain", "Redirect", "Location: " + tempLocation->_return_url);
-			}
-			if (tempLocation->_return_url != "") {
-				return createResponse(tempLocation->_return_code, "text/plain", "Redirect", "Location: " + tempLocation->_return_url);
-			}
-			break;
-		case HTTP:
-			return "";
-		default:
-			break;
-		}
-
-		back_ref = back_ref->back_ref;
-	}
-	return "";
+	if (!matchLocation || matchLocation->_effective->_return_code == -1)
+		return "";
+	return createResponse(matchLocation->_effective->_return_code, "text/plain", "Redirect",
+		"Location: " + matchLocation->_effective->_return_url);
 }
 
 
+// error_page responses are built with the configuration, nothing is read here
 STR	Response::createErrorResponse(int statusCode, const STR& contentType, const STR& body, AConfigBase *base) {
-	while (base) {
-		try
-		{
-			if (strncmp(base->_error_pages[statusCode].c_str(), "default_errors/", 15) || base->_identify(base) == HTTP) {
-				if (access(base->_error_pages[statusCode].c_str(), R_OK) == 0) {
-					std::ifstream file(base->_error_pages[statusCode].c_str(), std::ios::binary);
-					if (file) {
-						std::stringstream content;
-						content << file.rdbuf();
-						return createResponse(statusCode, getMimeType(base->_error_pages[statusCode]), content.str(), "");
-					}
-				}
-			}
-		}
-		catch(const std::exception& e)
-		{
-		}
-		base = base->back_ref;
+	if (base && base->_effective) {
+		MAP<int, const STR*>::const_iterator page = base->_effective->_error_responses.find(statusCode);
+		if (page != base->_effective->_error_responses.end())
+			return statusHeaders(statusCode) + *page->second;
 	}
 
 	return createResponse(statusCode, contentType, body, "");
 }
 
 bool	Response::checkBodySize(LocationConfig *matchLocation) {
-	AConfigBase* local_ref = matchLocation;
-	while (local_ref) {
-		if (local_ref->_client_max_body_size > 0) {
-			// std::cerr << "Response::checkBodySize: client_max_body_size is " << local_ref->_client_max_body_size << "\n";
-			// std::cerr << "Response::checkBodySize: body size is " << _request._body.length() << "\n";
-			if (_request._body.length() > (size_t)local_ref->_client_max_body_size)
-				return false;
-			else
-				return true;
-		}
+	if (!matchLocation || matchLocation->_effective->_client_max_body_size <= 0)
+		return true;
+	return _request._body.length() <= (size_t)matchLocation->_effective->_client_max_body_size;
+}
+
+/*
+	limit_req of the closest location that has one, nested locations share it.
+	Returns the 429 response, or "" with _state DELAYED when the request has to wait.
+*/
+STR	Response::checkRateLimit(LocationConfig *matchLocation) {
+	if (_rate_checked)
+		return "";
 
-		local_ref = local_ref->back_ref;
+	LocationConfig* zone = matchLocation ? matchLocation->_effective->_limit_req_zone : NULL;
+	if (!zone)
+		return "";
+
+	_rate_checked = true;
+	switch (RateLimiter::check(zone, _client_ip, _delay_ms)) {
+		case LIMIT_REJECT:
+			LOG(Logger::WARNING, "Response::checkRateLimit: limiting requests to " + zone->_path);
+			return createErrorResponse(429, "text/plain", "Too Many Requests", matchLocation);
+		case LIMIT_DELAY:
+			LOG(Logger::DEBUG, "Response::checkRateLimit: delaying request by " + Utils::intToString(_delay_ms) + "ms");
+			_state = DELAYED;
+			return "";
+		default:
+			return "";
 	}
-	return true;
+}
+
+/*
+	/cgi-bin/script.py/extra/path -> script /cgi-bin/script.py, PATH_INFO /extra/path.
+	Only for a target that does not exist, when a leading part of it is a
+	script file; the location of the script serves the request then.
+*/
+STR	Response::splitPathInfo(ServerConfig *matchServer, LocationConfig *&matchLocation, STR &dir_path) {
+	STR uri = _request._file_path;
+
+	for (size_t pos = uri.find('/', 1); pos != STR::npos; pos = uri.find('/', pos + 1)) {
+		if (!is_cgi_script(uri.substr(0, pos)))
+			continue;
+		_request._file_path = uri.substr(0, pos);
+		STR script_path = "";
+		bool isDIR = false;
+		LocationConfig *location = buildDirPath(matchServer, script_path, isDIR);
+		if (location && checkFile(script_path) == NormalFile) {
+			matchLocation = location;
+			dir_path = script_path;
+			return uri.substr(pos);
+		}
+		_request._file_path = uri;
+	}
+	return "";
 }
 
 /*
@@ -856,25 +663,17 @@ STR Response::getResponse() {
 	STR dir_path = "";
 	STR	file_path = "";
 
+	long long start_us = Utils::nowUs();
 	_request._file_path = urlDecode(_request._file_path);
 
 	if (_request._full_request == "" || !_config) {
-		Logger::log(Logger::ERROR, "Response::getResponse error, no config or request");
+		LOG(Logger::ERROR, "Response::getResponse error, no config or request");
 		return "";
 	}
 
-	for (size_t i = 0; i < _config->_servers.size(); i++) {
-		if (_config->_servers[i]->_listen_port != _request._port)
-			continue;
-		for (size_t k = 0; k < _config->_servers[i]->_server_name.size(); k++) {
-			if (_config->_servers[i]->_server_name[k] == _request._host) {
-				matchServer = _config->_servers[i];
-				break;
-			}
-		}
-	}
-
-	//if no server matches - defauts to first one
+	// server_name lookup among the servers of the listening socket, its default server otherwise
+	if (_listener)
+		matchServer = _listener->findServer(_request._host);
 	if (!matchServer)
 		matchServer = _config->_servers[0];
 
@@ -886,14 +685,19 @@ STR Response::getResponse() {
 	}
 
 	matchLocation = buildDirPath(matchServer, dir_path, isDIR);
+	_routing_us = Utils::nowUs() - start_us;
 	// if (!matchLocation){
-	// 	Logger::log(Logger::ERROR, "Response::getResponse: no match location found for " + _request._file_path);
+	// 	LOG(Logger::ERROR, "Response::getResponse: no match location found for " + _request._file_path);
 	// 	return createErrorResponse(404, "text/plain", "Not Found", matchServer);
 	// }
 
+	STR limit_response = checkRateLimit(matchLocation);
+	if (limit_response != "" || _state == DELAYED)
+		return limit_response;
+
 	// check body size
 	if (!checkBodySize(matchLocation)) {
-		Logger::log(Logger::ERROR, "Response::getResponse: body size is too big");
+		LOG(Logger::ERROR, "Response::getResponse: body size is too big");
 		return createErrorResponse(413, "text/plain", "Payload Too Large", matchServer);
 	}
 
@@ -901,8 +705,21 @@ STR Response::getResponse() {
 	if (temp_str != "")
 		return temp_str;
 
+	if (matchLocation && matchLocation->_stub_status)
+		return createResponse(200, "text/plain; version=0.0.4", Metrics::render(), "");
+
+	if (matchLocation && matchLocation->_proxy_pass_host != "")
+		return startProxy(matchLocation);
+
+	STR path_info = "";
+	if (matchLocation && checkFile(dir_path) == NotFound) {
+		path_info = splitPathInfo(matchServer, matchLocation, dir_path);
+		if (isDIR && path_info != "")
+			path_info += "/";
+	}
+
 	//if it's a script file - execute it
-	if (ends_with(dir_path, ".py") || ends_with(dir_path, ".php") || ends_with(dir_path, ".pl") || ends_with(dir_path, ".sh")) {
+	if (is_cgi_script(dir_path)) {
 		MAP<STR, STR> env;
 
 		env["REQUEST_METHOD"] = _request._method;
@@ -911,9 +728,18 @@ STR Response::getResponse() {
 		env["CONTENT_TYPE"] = _request._http_content_type.empty() ? "text/plain" : _request._http_content_type;
 		env["CONTENT_LENGTH"] = Utils::intToString(_request._body.length());
 		env["HTTP_HOST"] = _request._host;
-		env["SERVER_PORT"] = Utils::intToString(_request._port);
+		env["SERVER_PORT"] = Utils::intToString(_listener ? _listener->port() : _request._port);
 		env["SERVER_PROTOCOL"] = _request._http_version;
 		env["HTTP_COOKIE"] = _request._cookies;
+		env["REMOTE_ADDR"] = _remote_addr;
+		env["REMOTE_PORT"] = Utils::intToString(_remote_port);
+		// without a Host header: the first server_name, else the address the request came in on
+		env["SERVER_NAME"] = _request._host;
+		if (!_request._has_host && matchServer->_server_name.size() > SERVER_NAME_BUILTIN)
+			env["SERVER_NAME"] = matchServer->_server_name[SERVER_NAME_BUILTIN];
+		else if (!_request._has_host && _listener && !_listener->isWildcard())
+			env["SERVER_NAME"] = _listener->address();
+		env["PATH_INFO"] = path_info;
 
 		if (!matchLocation->_upload_store.empty()) {
 			env["UPLOAD_STORE"] = matchLocation->_upload_store;
@@ -931,16 +757,18 @@ STR Response::getResponse() {
         if (_cgi_handler->startCgi()) {
             // Successfully started CGI, switch state
             _state = PROCESSING_CGI;
+            Metrics::cgiSpawned();
             return ""; // Return empty string to indicate that processing is not complete
         } else {
             // Failed to start CGI
             delete _cgi_handler;
             _cgi_handler = NULL;
+            Metrics::cgiFailed();
             return createErrorResponse(500, "text/plain", "Failed to start CGI process", matchServer);
         }
 	}
 	if (_request._method == "POST") {
-		Logger::log(Logger::INFO, "Response::getResponse POST path " + dir_path + " isDIR " + Utils::floatToString(isDIR));
+		LOG(Logger::DEBUG, "Response::getResponse POST path " + dir_path + " isDIR " + Utils::floatToString(isDIR));
 
 		try {
 			if (!matchLocation->_upload_store.empty()) {  // this part is to be tested, upload_store
@@ -949,11 +777,11 @@ STR Response::getResponse() {
 				} else {
 					dir_path = matchLocation->_upload_store + dir_path;
 				}
-				Logger::log(Logger::INFO, "Response::getResponse POST path " + dir_path + " isDIR " + Utils::floatToString(isDIR));
+				LOG(Logger::DEBUG, "Response::getResponse POST path " + dir_path + " isDIR " + Utils::floatToString(isDIR));
 			}
 		}
 		catch (const std::exception& e) {
-			Logger::log(Logger::ERROR, "Response::getResponse: upload_store error: " + STR(e.what()));
+			LOG(Logger::ERROR, "Response::getResponse: upload_store error: " + STR(e.what()));
 		}
 		return (handlePOST(dir_path));
 	}
@@ -994,6 +822,235 @@ STR Response::getResponse() {
 	return createErrorResponse(403, "text/plain", "TERRIBLE ERROR (Impossible)", matchLocation);
 }
 
+/*
+	Request as sent to the proxy_pass upstream: the original target, with the
+	location prefix swapped for the proxy_pass URI when there is one. Hop-by-hop
+	headers are dropped, the body is already complete so it goes with a
+	Content-Length, and the client address is passed in X-Forwarded-For.
+*/
+STR	Response::buildProxyRequest(LocationConfig *matchLocation) {
+	const STR &raw = _request._full_request;
+	size_t line_end = raw.find("\r\n");
+	size_t head_end = raw.find("\r\n\r\n");
+	if (line_end == STR::npos || head_end == STR::npos)
+		return "";
+
+	VECTOR<STR> request_line = Utils::split(raw.substr(0, line_end), ' ', 0);
+	if (request_line.size() < 2)
+		return "";
+	STR target = request_line[1];
+	if (matchLocation->_proxy_pass_uri != "" && target.compare(0, matchLocation->_path.size(), matchLocation->_path) == 0)
+		target = matchLocation->_proxy_pass_uri + target.substr(matchLocation->_path.size());
+
+	STR forwarded_for = "";
+	STR original_host = "";
+	STR headers = "";
+	bool authorized = false;
+	size_t pos = line_end + 2;
+	while (pos < head_end) {
+		size_t next = raw.find("\r\n", pos);
+		STR line = raw.substr(pos, next - pos);
+		pos = next + 2;
+
+		size_t colon = line.find(':');
+		if (colon == STR::npos)
+			continue;
+		STR name = line.substr(0, colon);
+		STR value = line.substr(colon + 1);
+		value.erase(0, value.find_first_not_of(" \t"));
+		for (size_t i = 0; i < name.size(); ++i)
+			name[i] = tolower(name[i]);
+
+		if (name == "host") {
+			original_host = value;
+		} else if (name == "x-forwarded-for") {
+			forwarded_for = value + ", ";
+		} else if (name == "authorization") {
+			authorized = true;
+			headers += line + "\r\n";
+		} else if (name != "connection" && name != "keep-alive" && name != "proxy-connection" &&
+			name != "te" && name != "trailer" && name != "upgrade" && name != "transfer-encoding" &&
+			name != "content-length" && name != "expect" && name != "x-real-ip" &&
+			name != "x-forwarded-host" && name != "x-forwarded-proto") {
+			headers += line + "\r\n";
+		}
+	}
+
+	STR upstream_host = matchLocation->_proxy_pass_host;
+	if (matchLocation->_proxy_pass_port != 80)
+		upstream_host += ":" + Utils::intToString(matchLocation->_proxy_pass_port);
+
+	// responses to authorized requests are not shared
+	_cache_key = "";
+	if (matchLocation->_proxy_cache && ProxyCache::enabled() && !authorized &&
+		(_request._method == "GET" || _request._method == "HEAD"))
+		_cache_key = upstream_host + target;
+
+	std::stringstream request;
+	request << request_line[0] << " " << target << " HTTP/1.1\r\n"
+			<< "Host: " << upstream_host << "\r\n"
+			<< headers
+			<< "X-Real-IP: " << _remote_addr << "\r\n"
+			<< "X-Forwarded-For: " << forwarded_for << _remote_addr << "\r\n"
+			<< "X-Forwarded-Host: " << original_host << "\r\n"
+			<< "X-Forwarded-Proto: http\r\n";
+	if (!_request._body.empty() || _request._method == "POST")
+		request << "Content-Length: " << _request._body.size() << "\r\n";
+	request << "\r\n" << _request._body;
+	return request.str();
+}
+
+// value the upstream's hash directive balances on
+STR	Response::upstreamHashValue(UpstreamConfig *upstream) {
+	if (upstream->_hash_key == "$remote_addr")
+		return _remote_addr;
+	if (upstream->_hash_key == "$host")
+		return _request._host;
+	return _request._file_path + "?" + _request._query_string;
+}
+
+STR	Response::startProxy(LocationConfig *matchLocation) {
+	_proxy_location = matchLocation;
+	_proxy_request = buildProxyRequest(matchLocation);
+	if (_proxy_request.empty())
+		return createErrorResponse(400, "text/plain", "Bad Request", matchLocation);
+
+	if (_cache_key != "") {
+		STR headers;
+		int fd;
+		off_t offset;
+		size_t length;
+		if (ProxyCache::lookup(_cache_key, headers, fd, offset, length))
+			return cachedResponse(headers, fd, offset, length);
+		if (_request._method == "GET") {
+			CacheLock lock = ProxyCache::lock(_cache_key);
+			if (lock == CACHE_LOCK_WAIT) {
+				// parked like a limit_req delay, looks at the cache again when woken up
+				_state = DELAYED;
+				_delay_ms = PROXY_CACHE_LOCK_WAIT_MS;
+				return "";
+			}
+			_cache_locked = lock == CACHE_LOCK_ACQUIRED;
+		}
+	}
+
+	_upstream = matchLocation->_upstream;
+	_proxy_tries = _upstream ? _upstream->_upstream_servers.size() : 1;
+	if (!connectNext())
+		return createErrorResponse(502, "text/plain", "Bad Gateway", matchLocation);
+	_state = PROCESSING_PROXY;
+	return "";
+}
+
+/*
+	Starts the request on the next server: the one the balancer picks when the
+	location has an upstream block, the proxy_pass address otherwise. A server
+	that refuses the connection right away is reported and the next one tried.
+	The previous handler goes only once the new one is connecting, so the
+	upstream fd number changes and PollServer re-registers it.
+*/
+bool Response::connectNext() {
+	while (_proxy_tries > 0) {
+		_proxy_tries--;
+		STR host = _proxy_location->_proxy_pass_host;
+		int port = _proxy_location->_proxy_pass_port;
+		const struct sockaddr_in *addr = &_proxy_location->_proxy_pass_addr;
+		if (_upstream) {
+			_upstream_server = LoadBalancer::pick(_upstream, upstreamHashValue(_upstream));
+			if (_upstream_server == -1)
+				return false;
+			host = _upstream->_upstream_servers[_upstream_server]._host;
+			port = _upstream->_upstream_servers[_upstream_server]._port;
+			addr = &_upstream->_upstream_servers[_upstream_server]._addr;
+		}
+
+		ProxyHandler *handler = new ProxyHandler(host, port, *addr, _proxy_request, _request._method == "HEAD",
+			_config->_proxy_connect_timeout, _config->_proxy_read_timeout);
+		if (handler->start()) {
+			delete _proxy_handler;
+			_proxy_handler = handler;
+			if (_cache_locked)
+				_proxy_handler->capture(PROXY_CACHE_MAX_ENTRY);
+			LOG(Logger::DEBUG, "Response::startProxy: " + _request._method + " " + _request._file_path + " -> " +
+				host + ":" + Utils::intToString(port));
+			return true;
+		}
+		delete handler;
+		if (_upstream) {
+			LoadBalancer::release(_upstream, _upstream_server, true);
+			_upstream_server = -1;
+		}
+	}
+	return false;
+}
+
+// the picked server failed or timed out before the request went out, another one may take it
+bool Response::retryProxy() {
+	if (!_proxy_handler || !_upstream || _upstream_server == -1 || _proxy_tries == 0)
+		return false;
+	if (_proxy_handler->getStatus() == PROXY_DONE || _proxy_handler->hasSent())
+		return false;
+
+	LoadBalancer::release(_upstream, _upstream_server, true);
+	_upstream_server = -1;
+	return connectNext();
+}
+
+/*
+	proxy_cache hit: the stored header, the body sent from the entry's file
+	like a static one. HEAD gets the head of the stored GET response.
+*/
+STR	Response::cachedResponse(const STR &headers, int fd, off_t offset, size_t length) {
+	LOG(Logger::DEBUG, "Response::startProxy: cache hit for " + _cache_key);
+	size_t line_end = headers.find("\r\n") + 2;
+	STR response;
+	response.reserve(headers.size() + 24);
+	response.append(headers, 0, line_end).append("X-Cache-Status: HIT\r\n").append(headers, line_end, STR::npos);
+	if (_request._method == "HEAD" || length == 0) {
+		close(fd);
+		return response;
+	}
+
+	if (length >= SENDFILE_MIN_SIZE) {
+		_body_fd = fd;
+		_body_offset = offset;
+		_body_length = length;
+		return response;
+	}
+	size_t head_size = response.size();
+	response.resize(head_size + length);
+	ssize_t got = pread(fd, &response[head_size], length, offset);
+	close(fd);
+	if (got != (ssize_t)length)
+		return createErrorResponse(500, "text/plain", "Internal Server Error", _proxy_location);
+	return response;
+}
+
+// upstream done: connection back to the pool or closed, outcome reported to the balancer
+void Response::finishProxy() {
+	if (!_proxy_handler)
+		return;
+
+	bool failed = _proxy_handler->getStatus() != PROXY_DONE;
+	if (_cache_locked) {
+		if (!failed && !_proxy_handler->closesClient() && _proxy_handler->isCaptured())
+			ProxyCache::store(_cache_key, _proxy_handler->captured(), _proxy_location->_proxy_cache_valid);
+		ProxyCache::unlock(_cache_key);
+		_cache_locked = false;
+	}
+	_proxy_handler->finish();
+	if (_upstream && _upstream_server != -1)
+		LoadBalancer::release(_upstream, _upstream_server, failed);
+	_upstream_server = -1;
+}
+
+int Response::getUpstreamFd() const {
+	if (_state == PROCESSING_PROXY && _proxy_handler) {
+		return _proxy_handler->getFd();
+	}
+	return -1;
+}
+
 int Response::getCgiOutputFd() const {
     if (_state == PROCESSING_CGI && _cgi_handler) {
         return _cgi_handler->getOutputFd();
@@ -1010,20 +1067,20 @@ bool Response::processCgiOutput() {
         // Read available data from CGI
         STR output = _cgi_handler->readFromCgi();
         if (!output.empty()) {
-            Logger::log(Logger::DEBUG, "Read " + Utils::intToString(output.length()) +
+            LOG(Logger::DEBUG, "Read " + Utils::intToString(output.length()) +
                           " bytes from CGI output");
             _response_buffer += output;
         }
 
         // Check if CGI has completed
         if (_cgi_handler->checkCgiStatus()) {
-			Logger::log(Logger::INFO, "CGI process has completed");
+			LOG(Logger::DEBUG, "CGI process has completed");
 			_state = COMPLETE;
 			return true;
         }
         return false; // Still running
     } catch (const std::exception& e) {
-        Logger::log(Logger::ERROR, "Error in processCgiOutput: " + STR(e.what()));
+        LOG(Logger::ERROR, "Error in processCgiOutput: " + STR(e.what()));
 
 		if(_cgi_handler) _cgi_handler->closeCgi();
         _state = COMPLETE;
@@ -1040,21 +1097,24 @@ STR Response::getFinalResponse() {
 	CgiStatus cgiStatus = _cgi_handler->getCgiStatus();
 
 	if (cgiStatus == TIMEDOUT) {  // CGI process timed out
-		Logger::log(Logger::ERROR, "CGI process timed out");
+		LOG(Logger::ERROR, "CGI process timed out");
 		_response_buffer =  createErrorResponse(504, "text/plain", "504 Gateway Timeout", NULL);
+		Metrics::cgiTimedOut();
 	}
 
 	if (cgiStatus == FINISHED_ERROR) {  // CGI finished with an error
-		Logger::log(Logger::ERROR, "CGI process finished with an error");
+		LOG(Logger::ERROR, "CGI process finished with an error");
 		_response_buffer = createErrorResponse(502, "text/plain", "502 Bad Gateway", NULL);
+		Metrics::cgiFailed();
 	}
 
 	if (cgiStatus == FINISHED_OK && _response_buffer.find("\r\n\r\n") == STR::npos) {  // malformed headers response
-        Logger::log(Logger::ERROR, "CGI script produced a malformed response (no headers). Generating 502 Bad Gateway.");
+        LOG(Logger::ERROR, "CGI script produced a malformed response (no headers). Generating 502 Bad Gateway.");
         _response_buffer = createErrorResponse(502, "text/plain", "502 Bad Gateway", NULL);
+        Metrics::cgiFailed();
     }
 
-	Logger::log(Logger::INFO, "CGI finished successfully, processing output");
+	LOG(Logger::DEBUG, "CGI finished successfully, processing output");
 
     try {
         // Process CGI output into a proper HTTP response
@@ -1128,12 +1188,11 @@ STR Response::getFinalResponse() {
             response << "HTTP/1.1 " << statusCode << " ";
 
             // Add status text
-            if (_all_status_codes.find(statusCode) != _all_status_codes.end()) {
-                response << _all_status_codes[statusCode].substr(4); // Skip the code part
-            } else {
-                response << "OK"; // Default
-            }
+            const char *reason = HttpStatus::reason(statusCode);
+            response << (*reason ? reason : "OK");
             response << "\r\n";
+            response << "Date: " << Clock::httpDate() << "\r\n"
+                     << "Server: " SERVER_SOFTWARE "\r\n";
 
             // Track common headers
             bool hasContentType = false;
@@ -1166,13 +1225,13 @@ STR Response::getFinalResponse() {
 
             // Don't delete _cgi_handler here - it will be deleted in destructor
 
-            Logger::log(Logger::DEBUG, "Generated HTTP response from CGI output");
+            LOG(Logger::DEBUG, "Generated HTTP response from CGI output");
             return response.str();
         }
 
         // No valid headers found, wrap with default headers
         std::stringstream response;
-        response << "HTTP/1.1 200 OK\r\n"
+        response << statusHeaders(200)
                  << "Content-Type: text/html\r\n"
                  << "Content-Length: " << _response_buffer.length() << "\r\n"
                  << "\r\n"
@@ -1184,11 +1243,11 @@ STR Response::getFinalResponse() {
 
         // Don't delete _cgi_handler here - it will be deleted in destructor
 
-        Logger::log(Logger::DEBUG, "Generated default HTTP response for CGI output");
+        LOG(Logger::DEBUG, "Generated default HTTP response for CGI output");
         return response.str();
     } catch (const std::exception& e) {
         // Handle any unexpected errors
-        Logger::log(Logger::ERROR, "Error in getFinalResponse: " + STR(e.what()));
+        LOG(Logger::ERROR, "Error in getFinalResponse: " + STR(e.what()));
 
         // Clean up
         _response_buffer.clear();
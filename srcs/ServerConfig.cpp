@@ -1,5 +1,6 @@
 #include "ServerConfig.hpp"
 #include "LocationConfig.hpp"
+#include "LocationTrie.hpp"
 
 void ServerConfig::_self_destruct() {
 	for (MAP<STR, LocationConfig*>::iterator it = _locations.begin(); it != _locations.end(); ++it) {
@@ -7,5 +8,6 @@ void ServerConfig::_self_destruct() {
 			it->second->_self_destruct();
 		it->second = NULL;
 	}
+	delete _location_trie;
 	delete (this);
 }
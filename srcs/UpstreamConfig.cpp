@@ -0,0 +1,9 @@
+#include "UpstreamConfig.hpp"
+
+void UpstreamConfig::_self_destruct() {
+	for (size_t i = 0; i < _upstream_servers.size(); i++) {
+		if (_upstream_servers[i]._probe_fd >= 0)
+			close(_upstream_servers[i]._probe_fd);
+	}
+	delete (this);
+}
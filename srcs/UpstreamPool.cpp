@@ -0,0 +1,73 @@
+#include "UpstreamPool.hpp"
+#include "Logger.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+
+std::map<STR, std::vector<UpstreamPool::IdleConnection> >	UpstreamPool::_idle;
+time_t														UpstreamPool::_last_cleanup = 0;
+
+/*
+	Most recently used connection first. The upstream may have closed an idle
+	connection in the meantime: peek at it, an idle socket must have nothing to read.
+*/
+int UpstreamPool::acquire(const STR &key) {
+	std::map<STR, std::vector<IdleConnection> >::iterator it = _idle.find(key);
+	if (it == _idle.end())
+		return -1;
+
+	std::vector<IdleConnection> &idle = it->second;
+	while (!idle.empty()) {
+		int fd = idle.back().fd;
+		idle.pop_back();
+
+		char c;
+		ssize_t peeked = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			LOG(Logger::DEBUG, "UpstreamPool: reusing connection " + Utils::intToString(fd) + " to " + key);
+			return fd;
+		}
+		close(fd);
+	}
+	return -1;
+}
+
+void UpstreamPool::release(const STR &key, int fd) {
+	std::vector<IdleConnection> &idle = _idle[key];
+	if (idle.size() >= UPSTREAM_KEEPALIVE) {
+		close(fd);
+		return;
+	}
+
+	IdleConnection conn;
+	conn.fd = fd;
+	conn.since = time(NULL);
+	idle.push_back(conn);
+}
+
+// close connections idle for longer than UPSTREAM_KEEPALIVE_TIMEOUT
+void UpstreamPool::cleanup(time_t now) {
+	if (now == _last_cleanup)
+		return;
+	_last_cleanup = now;
+
+	for (std::map<STR, std::vector<IdleConnection> >::iterator it = _idle.begin(); it != _idle.end(); ++it) {
+		std::vector<IdleConnection> &idle = it->second;
+		size_t kept = 0;
+		for (size_t i = 0; i < idle.size(); ++i) {
+			if (now - idle[i].since >= UPSTREAM_KEEPALIVE_TIMEOUT)
+				close(idle[i].fd);
+			else
+				idle[kept++] = idle[i];
+		}
+		idle.resize(kept);
+	}
+}
+
+void UpstreamPool::closeAll() {
+	for (std::map<STR, std::vector<IdleConnection> >::iterator it = _idle.begin(); it != _idle.end(); ++it) {
+		for (size_t i = 0; i < it->second.size(); ++i)
+			close(it->second[i].fd);
+	}
+	_idle.clear();
+}
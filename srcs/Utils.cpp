@@ -1,5 +1,8 @@
 #include "Utils.hpp"
 #include "AConfigBase.hpp"
+#include <ctime>
+#include <cstring>
+#include <arpa/inet.h>
 
 STR  Utils::intToString(int num) {
 	std::ostringstream oss;
@@ -43,3 +46,69 @@ std::vector<std::string>	Utils::split(STR string, char delim, bool use_whitespac
 
 	return result;
 }
+
+// monotonic milliseconds, for intervals only (not wall clock)
+long long Utils::nowMs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// monotonic microseconds, for latency measurements
+long long Utils::nowUs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// numeric form of an IPv4 or IPv6 socket address, IPv4-mapped IPv6 printed as IPv4
+STR Utils::addressToString(const struct sockaddr *addr) {
+	char buf[INET6_ADDRSTRLEN];
+
+	if (addr->sa_family == AF_INET6) {
+		const struct in6_addr *in6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+		if (IN6_IS_ADDR_V4MAPPED(in6))
+			return inet_ntop(AF_INET, in6->s6_addr + 12, buf, sizeof(buf)) ? buf : "";
+		return inet_ntop(AF_INET6, in6, buf, sizeof(buf)) ? buf : "";
+	}
+	return inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, buf, sizeof(buf)) ? buf : "";
+}
+
+int Utils::addressPort(const struct sockaddr *addr) {
+	if (addr->sa_family == AF_INET6)
+		return ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+	return ntohs(((const struct sockaddr_in *)addr)->sin_port);
+}
+
+/*
+	Key for the per-client limits (limit_conn_per_ip, limit_req). IPv6 clients
+	are counted per /64, the block one host usually gets; IPv4-mapped ones as
+	the IPv4 address they are.
+*/
+ClientKey Utils::addressKey(const struct sockaddr *addr) {
+	if (addr->sa_family != AF_INET6)
+		return ClientKey(AF_INET, ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr));
+
+	const unsigned char *bytes = ((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+	uint64_t key = 0;
+	if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)bytes)) {
+		for (int i = 12; i < 16; i++)
+			key = key << 8 | bytes[i];
+		return ClientKey(AF_INET, key);
+	}
+	for (int i = 0; i < 8; i++)
+		key = key << 8 | bytes[i];
+	return ClientKey(AF_INET6, key);
+}
+
+// FNV-1a 64 bit: server_name buckets, upstream hash ring, proxy_cache file names
+uint64_t Utils::hash(const STR &value) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < value.size(); i++) {
+		h ^= (unsigned char)value[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
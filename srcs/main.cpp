@@ -13,20 +13,17 @@
 // gobal variable to treat signal
 volatile sig_atomic_t g_signal_received = 0;
 
-// signal handler
+// signal handler: only records the signal, the server loop logs and acts on it
 void signal_handler(int sig) {
 	g_signal_received = sig;
-	if (sig == SIGINT) {
-		Logger::log(Logger::INFO, "SIGINT received, shutting down...");
-	}
-	if (sig == SIGQUIT) {
-		Logger::log(Logger::INFO, "SIGQUIT received, shutting down...");
-	}
 }
 
-int	init_start_webserv(HttpConfig *config) {
+// the server owns config from here on, a reload replaces it
+int	init_start_webserv(HttpConfig *config, const STR &config_path, const STR &binary_path) {
 	PollServer		poll_server;
 
+		poll_server.setConfigPath(config_path);
+		poll_server.setBinaryPath(binary_path);
 		try {
 			poll_server.setConfig(config);
 		} catch (const std::exception& e) {
@@ -53,13 +50,20 @@ void printLocationConfig(const LocationConfig* loc, int indent = 2) {
     std::cout << pad << "LocationConfig:\n";
     std::cout << pad << "  _proxy_pass_host: " << loc->_proxy_pass_host << "\n";
     std::cout << pad << "  _proxy_pass_port: " << loc->_proxy_pass_port << "\n";
+    std::cout << pad << "  _proxy_pass_uri: " << loc->_proxy_pass_uri << "\n";
     std::cout << pad << "  _path: " << loc->_path << "\n";
     std::cout << pad << "  _add_header: " << loc->_add_header << "\n";
     std::cout << pad << "  _return_code: " << loc->_return_code << "\n";
     std::cout << pad << "  _return_url: " << loc->_return_url << "\n";
     std::cout << pad << "  _root: " << loc->_root << "\n";
     std::cout << pad << "  _client_max_body_size: " << loc->_client_max_body_size << "\n";
-    std::cout << pad << "  _autoindex: " << (loc->_autoindex ? "true" : "false") << "\n";
+    std::cout << pad << "  _autoindex: " << (loc->_autoindex ? "true" : "false")
+              << " format " << (loc->_autoindex_json ? "json" : "html") << " page_size " << loc->_autoindex_page_size << "\n";
+    std::cout << pad << "  _proxy_cache: " << (loc->_proxy_cache ? "on" : "off")
+              << " valid " << loc->_proxy_cache_valid << "s\n";
+    std::cout << pad << "  _stub_status: " << (loc->_stub_status ? "on" : "off") << "\n";
+    std::cout << pad << "  _limit_req: " << loc->_limit_req_rate << "r/s burst=" << loc->_limit_req_burst
+              << (loc->_limit_req_nodelay ? " nodelay" : "") << "\n";
 
     std::cout << pad << "  _index: [";
     for (VECTOR<STR>::const_iterator it = loc->_index.begin(); it != loc->_index.end(); ++it) {
@@ -94,6 +98,7 @@ void printServerConfig(const ServerConfig* server, int indent = 2) {
     std::cout << pad << "  _add_header: " << server->_add_header << "\n";
     std::cout << pad << "  _listen_port: " << server->_listen_port << "\n";
     std::cout << pad << "  _listen_server: " << server->_listen_server << "\n";
+    std::cout << pad << "  _listen_default: " << server->_listen_default << "\n";
     std::cout << pad << "  _root: " << server->_root << "\n";
     std::cout << pad << "  _client_max_body_size: " << server->_client_max_body_size << "\n";
 
@@ -126,9 +131,31 @@ void printHttpConfig(const HttpConfig& http, int indent = 0) {
     std::cout << pad << "HttpConfig:\n";
     std::cout << pad << "  _global_user: " << http._global_user << "\n";
     std::cout << pad << "  _global_worker_process: " << http._global_worker_process << "\n";
-    std::cout << pad << "  _global_error_log: " << http._global_error_log << "\n";
+    std::cout << pad << "  _global_error_log: " << http._global_error_log << " level " << http._error_log_level << "\n";
     std::cout << pad << "  _global_pid: " << http._global_pid << "\n";
     std::cout << pad << "  _keepalive_timeout: " << http._keepalive_timeout << "\n";
+    std::cout << pad << "  _client_header_timeout: " << http._client_header_timeout << "\n";
+    std::cout << pad << "  _client_body_timeout: " << http._client_body_timeout << "\n";
+    std::cout << pad << "  _send_timeout: " << http._send_timeout << "\n";
+    std::cout << pad << "  _client_min_rate: " << http._client_min_rate << "\n";
+    std::cout << pad << "  _worker_connections: " << http._worker_connections << "\n";
+    std::cout << pad << "  _worker_shutdown_timeout: " << http._worker_shutdown_timeout << "\n";
+    std::cout << pad << "  _limit_conn_per_ip: " << http._limit_conn_per_ip << "\n";
+    std::cout << pad << "  _proxy_timeouts: connect " << http._proxy_connect_timeout
+              << "s, read " << http._proxy_read_timeout << "s\n";
+    std::cout << pad << "  _proxy_cache_path: " << http._proxy_cache_path << " levels";
+    for (size_t i = 0; i < http._proxy_cache_levels.size(); i++) {
+        std::cout << (i ? ":" : " ") << http._proxy_cache_levels[i];
+    }
+    std::cout << " max_size " << http._proxy_cache_max_size << " inactive " << http._proxy_cache_inactive
+              << "s lock_timeout " << http._proxy_cache_lock_timeout << "s\n";
+    std::cout << pad << "  _access_log: " << http._access_log << " format " << http._access_log_format
+              << " buffer " << http._access_log_buffer << " flush " << http._access_log_flush << "s\n";
+    for (MAP<STR, STR>::const_iterator it = http._log_formats.begin(); it != http._log_formats.end(); ++it) {
+        std::cout << pad << "  _log_format " << it->first << ": " << it->second << "\n";
+    }
+    std::cout << pad << "  _types_file: " << http._types_file << "\n";
+    std::cout << pad << "  _error_documents: " << http._error_documents.size() << " prebuilt\n";
     std::cout << pad << "  _add_header: " << http._add_header << "\n";
     std::cout << pad << "  _client_max_body_size: " << http._client_max_body_size << "\n";
     std::cout << pad << "  _root: " << http._root << "\n";
@@ -144,6 +171,17 @@ void printHttpConfig(const HttpConfig& http, int indent = 0) {
         std::cout << pad << "    " << it->first << ": " << it->second << "\n";
     }
 
+    std::cout << pad << "  _upstreams:\n";
+    for (VECTOR<UpstreamConfig*>::const_iterator it = http._upstreams.begin(); it != http._upstreams.end(); ++it) {
+        std::cout << pad << "    " << (*it)->_name << ": balance " << (*it)->_balance << " " << (*it)->_hash_key
+                  << " health_check " << (*it)->_health_check_uri << "\n";
+        for (size_t i = 0; i < (*it)->_upstream_servers.size(); i++) {
+            const UpstreamServer &server = (*it)->_upstream_servers[i];
+            std::cout << pad << "      " << server._host << ":" << server._port << " weight=" << server._weight
+                      << " max_fails=" << server._max_fails << " fail_timeout=" << server._fail_timeout << "\n";
+        }
+    }
+
     std::cout << pad << "  _servers:\n";
     for (VECTOR<ServerConfig*>::const_iterator it = http._servers.begin(); it != http._servers.end(); ++it) {
         std::cout << pad << "    Server #" << (it - http._servers.begin()) << ":\n";
@@ -158,7 +196,11 @@ int main(int argc, char **argv) {
 	}
 
 	signal(SIGINT, signal_handler);  // Ctrl+C
-	signal(SIGQUIT, signal_handler); // Ctrl with backslash
+	signal(SIGQUIT, signal_handler); // Ctrl with backslash, graceful
+	signal(SIGTERM, signal_handler); // graceful, like SIGQUIT
+	signal(SIGHUP, signal_handler);  // reload the config file
+	signal(SIGUSR1, signal_handler); // reopen the log files after rotation
+	signal(SIGUSR2, signal_handler); // start a new binary on the same sockets
 
 	Parser parser(argv[1]);
 
@@ -180,13 +222,11 @@ int main(int argc, char **argv) {
 	// printHttpConfig(*newConf);
 
     try {
-        init_start_webserv(newConf);
+        init_start_webserv(newConf, argv[1], argv[0]);
     } catch (const std::exception& e) {
 		Logger::log(Logger::ERROR, "Running failure: " + STR(e.what()));
-        newConf->_self_destruct();
         return 1;
     }
 
-    newConf->_self_destruct();
     return 0;
 }